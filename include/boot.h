@@ -0,0 +1,25 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <Arduino.h>
+
+// Boot phases, in the order they complete.
+enum boot_phase {
+  BOOT_DISPLAY = 0, // Display up and showing the splash
+  BOOT_STORAGE,     // File system mounted, configuration and saved state loaded
+  BOOT_SCREEN,      // Widgets laid out, cached values on their way to the display
+  BOOT_RADIO,       // Wireless bring-up handed to the scheduled tasks
+  BOOT_READING,     // First reading received from a sensor
+  BOOT_DONE,
+  BOOT_PHASE_COUNT
+};
+
+void    boot_begin();
+uint8_t boot_step();
+uint8_t boot_phase();
+void    boot_first_reading();
+void    print_boot_metrics();
@@ -0,0 +1,32 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <Arduino.h>
+
+#include "breadcrumb_types.h"
+
+// The breadcrumb lives in watchdog scratch registers 0-3, which survive a
+// watchdog reset but not a power cycle. The SDK only uses registers 4-7.
+//
+//   0: magic << 24 | current stage << 16 | last finished stage << 8
+//   1: uptime in seconds
+//   2: (free heap / 16) << 16 | (largest free block / 16)
+//   3: duration of the last finished stage in microseconds
+#define BREADCRUMB_MAGIC 0xb5
+#define BREADCRUMB_IDLE 0xff
+
+#define RESET_LOG_FILE "resets.bin"
+// Records kept in the reset log, the oldest are dropped first.
+#define RESET_LOG_RECORDS 32
+
+uint8_t breadcrumb_enter(uint8_t stage);
+void    breadcrumb_exit(uint8_t stage, uint8_t previous, uint32_t duration);
+void    breadcrumb_uptime(uint32_t seconds);
+void    breadcrumb_heap(uint32_t heap_free, uint32_t largest_block);
+
+void                  report_reset();
+const reset_record_t& last_reset();
@@ -0,0 +1,25 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <Arduino.h>
+
+enum reset_cause { RESET_POWER_ON = 0, RESET_WATCHDOG, RESET_REBOOT };
+
+/**
+ * What was known about the system when it reset, as stored in the reset log.
+ */
+typedef struct reset_record {
+  uint32_t sequence;      // Increases by one for every logged reset
+  uint8_t  cause;         // One of reset_cause
+  uint8_t  stage;         // Stage running when the reset happened, BREADCRUMB_IDLE if none
+  uint8_t  last_stage;    // The last stage that finished
+  uint8_t  reserved;      // Padding, always 0
+  uint32_t uptime;        // Seconds since boot, as of the last watchdog feed
+  uint32_t last_duration; // How long the last finished stage took in microseconds
+  uint32_t heap_free;     // Free heap at the last memory sample, 0 if none was taken
+  uint32_t largest_block; // Largest free block at the last memory sample, 0 if none was taken
+} reset_record_t;
@@ -0,0 +1,10 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <Arduino.h>
+
+uint32_t crc32(const void* data, size_t length, uint32_t crc = 0);
@@ -10,11 +10,21 @@
 
 #include "configuration_types.h"
 #include "ruuvi_types.h"
+#include "warm_state_types.h"
+#include "zone_types.h"
 
-void print_climate();
-void process_pressure();
+// Seconds between the two pressure samples making up the trend.
+#define PRESSURE_TREND_INTERVAL 10800
 
-void log_current_temperature(float temperature, bool location_outdoor);
+void                    update_zone_aggregates();
+const zone_aggregate_t& zone_aggregate(uint8_t zone);
+uint8_t                 climate_page_count();
+void                    print_climate(uint8_t page);
+void                    hide_climate();
+void     process_pressure();
+uint32_t pressure_sample_delay();
+void     save_climate_state(warm_state_t* state);
+void     restore_climate_state(const warm_state_t* state);
 
 float   pressure_trend();
 int32_t average_pressure();
@@ -25,4 +25,5 @@
 #endif
 
 bool is_filesystem_safe();
+void set_filesystem_safe(bool safe);
 U8G2 get_display();
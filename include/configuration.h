@@ -9,8 +9,9 @@
 
 const char json_config[] PROGMEM = "config.json";
 
-bool   configured();
-bool   configuration_loaded();
-void   load_configuration();
-void   load_config_file();
-Config get_config();
+bool configured();
+bool configuration_loaded();
+void load_configuration();
+void load_config_file();
+
+const Config& get_config();
@@ -34,9 +34,24 @@ typedef struct ruuvi_section {
   std::vector<ruuvi_device_t> devices; // Variable length list of sensors
 } ruuvi_section_t;
 
+typedef struct uplink_section {
+  std::string host; // Host name or address of the collector, empty to keep readings on the device
+  uint16_t    port; // Port of the collector
+  std::string path; // Path readings are posted to
+} uplink_section_t;
+
+// The HTTP server only runs during WiFi windows, it is off the network the
+// rest of the time and not fit for regular scraping, see the README.
+typedef struct http_section {
+  uint16_t port;   // Port of the HTTP server, 0 to turn it off
+  uint16_t listen; // Seconds WiFi is kept up for the server in each WiFi window
+} http_section_t;
+
 struct Config {
   network_section_t networks; // Network section
   std::string       timezone; // Timezone
   location_t        location; // Geographic location section
   ruuvi_section_t   ruuvi;    // Ruuvi device section
+  uplink_section_t  uplink;   // Collector readings are sent to
+  http_section_t    http;     // HTTP server for scraping
 };
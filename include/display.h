@@ -0,0 +1,46 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <Arduino.h>
+#include <U8g2lib.h>
+
+// Size of one u8g2 tile in the frame buffer, 8x8 pixels at 1 bit per pixel.
+#define DISPLAY_TILE_BYTES 8
+// Shadow copy of the frame buffer, large enough for the 64x128 SH1107.
+#define DISPLAY_BUFFER_SIZE 1024
+// Estimated I2C overhead for each updateDisplayArea() row: addressing,
+// control bytes and the page/column commands.
+#define DISPLAY_AREA_OVERHEAD 6
+
+// On the RP2040 frames are streamed to the display by DMA in the background.
+// Build with -DDISPLAY_NO_DMA to send through u8g2 instead.
+#if defined(ARDUINO_ARCH_RP2040) && !defined(DISPLAY_NO_DMA)
+#  define DISPLAY_DMA
+#endif
+
+#ifndef DISPLAY_I2C
+#  define DISPLAY_I2C i2c0
+#endif
+
+// I2C command stream for one frame, a word per byte sent. Each run of tiles
+// is a command and a data transfer, DISPLAY_STREAM_RUN_OVERHEAD words on top
+// of its tile data. A full refresh of the 64x128 SH1107 takes 1064 words. Runs
+// that do not fit are sent through u8g2 instead.
+#define DISPLAY_STREAM_SIZE 1408
+#define DISPLAY_STREAM_RUN_OVERHEAD 5
+
+enum display_transfer { DISPLAY_TRANSFER_IDLE = 0, DISPLAY_TRANSFER_BUSY, DISPLAY_TRANSFER_ERROR };
+
+void     display_begin();
+bool     display_update();
+void     display_invalidate();
+bool     display_wait(uint32_t timeout = 100);
+uint8_t  display_transfer_status();
+uint32_t display_frames_deferred();
+uint32_t display_transfer_errors();
+uint32_t display_bytes_per_second();
+uint32_t display_frame_time();
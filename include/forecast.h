@@ -8,11 +8,12 @@
 
 #include "configuration_types.h"
 #include "forecast_types.h"
+#include "timekeeping_types.h"
 
 float pa_to_mb(uint32_t pressure_pa);
 float pressure_to_slp(float pressure, int16_t elevation, float temperature);
 
 pressure_change_t    current_trend(float change);
-zambretti_forecast_t get_forecast();
+zambretti_forecast_t get_forecast(const time_context_t& now);
 uint16_t             forecast_icon(char forecast, bool day);
-void                 print_forecast_icon();
+void                 print_forecast_icon(const time_context_t& now);
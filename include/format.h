@@ -0,0 +1,36 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <Arduino.h>
+#include <time.h>
+
+// Buffer sizes large enough for any value the functions below produce.
+#define FORMAT_INT_SIZE 12         // "-2147483648"
+#define FORMAT_TEMPERATURE_SIZE 16 // "-214748364.8°C"
+#define FORMAT_PERCENT_SIZE 13     // "-2147483648%"
+#define FORMAT_CLOCK_SIZE 6        // "23:59"
+#define FORMAT_DATE_SIZE 24        // "Torsdag 31 dec 2023"
+
+// UTF-8 encoded degree sign.
+#define FORMAT_DEGREE "\xc2\xb0"
+
+size_t format_append(char* buffer, size_t size, size_t length, const char* text);
+size_t format_int(char* buffer, size_t size, int32_t value, uint8_t width = 0, char pad = ' ');
+size_t format_fixed(char* buffer, size_t size, int32_t value, uint8_t decimals);
+size_t format_temperature(char* buffer, size_t size, int32_t tenths);
+size_t format_percent(char* buffer, size_t size, int32_t percent);
+size_t format_clock(char* buffer, size_t size, int hour, int minute);
+size_t format_date(char* buffer, size_t size, const struct tm* date);
+
+int32_t to_fixed(float value, uint8_t decimals);
+
+const char* weekday_name(uint8_t weekday);
+const char* month_name(uint8_t month);
+
+#ifdef HEM_BENCHMARK
+void benchmark_format();
+#endif
@@ -0,0 +1,39 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <Arduino.h>
+#include <time.h>
+
+#include "history_types.h"
+#include "ruuvi_types.h"
+
+#define HISTORY_DIRECTORY "/history"
+#define HISTORY_MAGIC 0x4853
+#define HISTORY_VERSION 1
+// Size of a segment, one flash erase block.
+#define HISTORY_SEGMENT_SIZE 4096
+// Segment files kept, the oldest is removed when a new one is started. 16
+// segments take 64 KB of the 768 KB file system.
+#define HISTORY_SEGMENTS 16
+// Records waiting between the Bluetooth callback and the history task.
+#define HISTORY_STAGING 32
+// Longest time records stay in RAM only, in milliseconds.
+#define HISTORY_CHECKPOINT_INTERVAL 3600000
+// Stored pressures are offset by this many Pa to fit in 16 bits.
+#define HISTORY_PRESSURE_BASE 50000
+// Flash program page, and the erase cycles a sector is good for.
+#define HISTORY_FLASH_PAGE 256
+#define HISTORY_FLASH_ENDURANCE 100000
+
+void history_begin();
+void history_log_reading(uint8_t device, const ruuvi_data_t& reading, time_t time);
+void history_service();
+
+uint32_t               history_count();
+bool                   history_read(uint32_t index, history_record_t* record);
+const history_stats_t* history_stats();
+uint32_t               history_lifetime_years();
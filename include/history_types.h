@@ -0,0 +1,59 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <Arduino.h>
+
+// Records in a segment, what fits in 4 KB after the header.
+#define HISTORY_SEGMENT_RECORDS 340
+
+/**
+ * A logged reading as it is stored in flash, in fixed point.
+ */
+typedef struct history_record {
+  uint32_t time;        // Seconds since the epoch
+  int16_t  temperature; // Hundredths of a degree Celsius
+  uint16_t humidity;    // Hundredths of a percent
+  uint16_t pressure;    // Pascal above HISTORY_PRESSURE_BASE
+  uint8_t  device;      // Index of the device in the configuration
+  uint8_t  reserved;    // Zero
+} history_record_t;
+
+/**
+ * Start of a segment file, followed by count records.
+ */
+typedef struct history_segment_header {
+  uint16_t magic;    // HISTORY_MAGIC
+  uint8_t  version;  // HISTORY_VERSION, other versions are removed
+  uint8_t  reserved; // Zero
+  uint16_t count;    // Records in the segment
+  uint16_t spare;    // Zero
+  uint32_t sequence; // Increases with every segment, also the file name
+  uint32_t crc;      // CRC-32 of the header up to here and the records
+} history_segment_header_t;
+
+/**
+ * A whole segment, as it is built up in RAM and written to flash.
+ */
+typedef struct history_segment {
+  history_segment_header_t header;
+  history_record_t         records[HISTORY_SEGMENT_RECORDS];
+} history_segment_t;
+
+/**
+ * Statistics on the history log since boot.
+ */
+typedef struct history_stats {
+  uint32_t records;       // Records logged
+  uint32_t dropped;       // Records dropped because the staging queue was full
+  uint32_t writes;        // Segment files written, sealed or not
+  uint32_t sealed;        // Full segments written
+  uint32_t failures;      // Writes that failed
+  uint32_t payload_bytes; // Bytes of new records written
+  uint32_t flash_bytes;   // Bytes programmed for them, estimated, see history.cpp
+  uint32_t last_duration; // Microseconds the last write took
+  uint32_t max_duration;  // Microseconds the slowest write took
+} history_stats_t;
@@ -0,0 +1,29 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <Arduino.h>
+
+// Bytes gathered before a write to the socket.
+#define HTTP_CHUNK_SIZE 256
+// Longest request line read, the rest of the request is ignored.
+#define HTTP_REQUEST_LINE 64
+// Milliseconds a client gets to send its request line.
+#define HTTP_REQUEST_TIMEOUT 2000
+// Longest time WiFi is kept up for the server in a window, in seconds. Between
+// windows the server is not reachable at all.
+#define HTTP_LISTEN_MAX 60
+
+void     http_server_begin();
+void     http_server_end();
+void     http_server_poll();
+bool     http_server_enabled();
+uint32_t http_server_listen_time();
+uint32_t http_server_requests();
+
+void http_write_metrics(Print& out);
+void http_write_json(Print& out);
+void http_write_summary(Print& out, uint32_t hours);
@@ -0,0 +1,25 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+// Messages of the deferred log, as X(id, level, format). Only the id and the
+// arguments are recorded, the format stays in flash and is applied when the
+// log is drained. tools/log_decode.py reads this table too, so keep one entry
+// per line and only append: the position of an entry is its id.
+//
+// Formats take %d, %u, %x, %c, %f with an optional precision like %.2f, and
+// %%. Every argument is recorded as 32 bits, strings cannot be logged.
+
+// clang-format off
+#define LOG_MESSAGES(X) \
+  X(LOG_DROPPED,          LOG_LEVEL_WARNING, "%u log records dropped") \
+  X(LOG_IBEACON,          LOG_LEVEL_DEBUG,   "iBeacon found, RSSI %d, MajorID %u, MinorID %u, Measured Power %d") \
+  X(LOG_READING_LOGGED,   LOG_LEVEL_INFO,    "Logged reading of device %u: %.2f C, %.2f %%, %u Pa") \
+  X(LOG_PRESSURE_TREND,   LOG_LEVEL_INFO,    "Current pressure trend: %.2f, Zambretti trend: %d") \
+  X(LOG_FORECAST,         LOG_LEVEL_INFO,    "Forecast: %c") \
+  X(LOG_PRESSURE_AVERAGE, LOG_LEVEL_INFO,    "Pressure: %.2f hPa, was %.2f hPa, SLP: %.2f hPa") \
+  X(LOG_HISTORY_WRITE,    LOG_LEVEL_INFO,    "History segment %u: %u records, %u us, amplification %.2f, %u years")
+// clang-format on
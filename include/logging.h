@@ -0,0 +1,91 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <Arduino.h>
+#include <string.h>
+
+#include "log_messages.h"
+
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARNING 2
+#define LOG_LEVEL_ERROR 3
+
+// Messages below this level are compiled out.
+#ifndef HEM_LOG_LEVEL
+#  define HEM_LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+// Bytes of the ring buffer records wait in until they are drained.
+#define LOG_BUFFER_SIZE 2048
+// Most arguments of a record.
+#define LOG_MAX_ARGUMENTS 6
+// Records drained in one idle pass.
+#define LOG_DRAIN_RECORDS 4
+
+#define LOG_ID(id, level, format) id,
+enum log_id { LOG_MESSAGES(LOG_ID) LOG_ID_COUNT };
+#undef LOG_ID
+
+#define LOG_ID_LEVEL(id, level, format) level,
+constexpr uint8_t log_levels[LOG_ID_COUNT] = {LOG_MESSAGES(LOG_ID_LEVEL)};
+#undef LOG_ID_LEVEL
+
+void   log_write(uint8_t id, const uint32_t* arguments, uint8_t count);
+void   log_drain();
+size_t log_pending();
+bool   log_ready();
+
+inline uint32_t log_argument(float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+inline uint32_t log_argument(double value) {
+  return log_argument((float)value);
+}
+inline uint32_t log_argument(char value) {
+  return value;
+}
+inline uint32_t log_argument(int value) {
+  return value;
+}
+inline uint32_t log_argument(unsigned int value) {
+  return value;
+}
+inline uint32_t log_argument(long value) {
+  return value;
+}
+inline uint32_t log_argument(unsigned long value) {
+  return value;
+}
+inline uint32_t log_argument(long long value) {
+  return value;
+}
+inline uint32_t log_argument(unsigned long long value) {
+  return value;
+}
+
+/**
+ * Record a message with its arguments, each stored as 32 bits.
+ */
+template <typename... Args> void log_record(uint8_t id, Args... arguments) {
+  static_assert(sizeof...(Args) <= LOG_MAX_ARGUMENTS, "too many log arguments");
+  uint32_t values[sizeof...(Args) + 1] = {log_argument(arguments)...};
+  log_write(id, values, sizeof...(Args));
+}
+
+/**
+ * Log a message from LOG_MESSAGES. Takes a few microseconds and never waits
+ * for the serial port. Messages below HEM_LOG_LEVEL leave no code behind.
+ */
+#define LOG(id, ...)                                                                                                   \
+  do {                                                                                                                 \
+    if (log_levels[id] >= HEM_LOG_LEVEL) {                                                                             \
+      log_record(id, ##__VA_ARGS__);                                                                                   \
+    }                                                                                                                  \
+  } while (0)
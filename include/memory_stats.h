@@ -0,0 +1,29 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <Arduino.h>
+
+#include "memory_types.h"
+
+// Samples kept for the rolling summary, an hour at one sample a minute.
+#define MEMORY_HISTORY 60
+// Pattern written to unused stack so the high-water mark can be found.
+#define MEMORY_STACK_PAINT 0xdeadbeef
+// Stack below the caller's frame that is left alone while painting.
+#define MEMORY_STACK_MARGIN 64
+
+void     memory_paint_stack();
+uint32_t memory_stack_used(uint8_t core);
+uint32_t memory_largest_block();
+uint32_t memory_allocations();
+void     memory_pass_begin();
+void     memory_pass_end();
+
+void                   memory_sample();
+const memory_sample_t* memory_latest();
+const memory_sample_t* memory_oldest();
+void                   memory_print_summary();
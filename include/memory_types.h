@@ -0,0 +1,23 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <Arduino.h>
+
+/**
+ * One sample of the memory state, sizes in bytes.
+ */
+typedef struct memory_sample {
+  uint32_t time;              // millis() when the sample was taken
+  uint32_t heap_used;         // Allocated from the heap
+  uint32_t heap_free;         // Left on the heap, including what sbrk has not handed out yet
+  uint32_t largest_block;     // Largest single allocation that would succeed
+  uint32_t allocations;       // Calls to operator new since the previous sample
+  uint32_t live_allocations;  // Objects allocated with operator new and not yet deleted
+  uint16_t pass_allocations;  // Most allocations seen in one render pass
+  uint16_t stack_used[2];     // Stack high-water mark per core, 0 if not painted
+  uint32_t network_heap_used; // lwIP heap in use, 0 if lwIP stats are not built in
+} memory_sample_t;
@@ -8,6 +8,8 @@
 #include <sunset.h>
 
 #include "configuration_types.h"
+#include "network_time_types.h"
+#include "timekeeping_types.h"
 
 #ifndef NTP_SERVER1
 #  define NTP_SERVER1 "0.fi.pool.ntp.org"
@@ -15,11 +17,20 @@
 #ifndef NTP_SERVER2
 #  define NTP_SERVER2 "1.fi.pool.ntp.org"
 #endif
-#define NTP_TIMEOUT 3600
+#define NTP_LOCAL_PORT 2390
+#define NTP_PACKET_SIZE 48
+// Seconds from the NTP epoch in 1900 to the Unix epoch in 1970.
+#define NTP_UNIX_OFFSET 2208988800LL
+// Milliseconds before an unanswered request is sent again.
+#define NTP_RETRY 2000
 
-void   configure_network_time();
+bool   configure_network_time();
+void   cancel_network_time();
+void   configure_timezone();
 bool   network_time_set();
 bool   network_time_received();
-void   print_time();
-void   configure_sunset();
-SunSet sun();
+void   print_time(const time_context_t& now);
+void   configure_sunset(const time_context_t& now);
+bool   daytime(const time_context_t& now);
+
+const ntp_sample_t* last_ntp_sample();
@@ -0,0 +1,18 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <Arduino.h>
+
+/**
+ * One answer from an NTP server.
+ */
+typedef struct ntp_sample {
+  uint32_t received;   // millis() when the answer arrived
+  int64_t  server;     // Server time at arrival in milliseconds since the epoch, half the round trip added
+  int64_t  offset;     // Server time minus the local clock in milliseconds
+  uint16_t round_trip; // Milliseconds from request to answer
+} ntp_sample_t;
@@ -0,0 +1,19 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <Arduino.h>
+
+#include "timekeeping_types.h"
+
+// Pages of the display, shown in turn: one or more climate pages, depending
+// on the number of zones, then a graph page per sparkline series. The graph
+// pages are skipped while there is nothing to draw on them.
+void    page_next();
+uint8_t current_page();
+uint8_t page_count();
+void    print_page();
+void    draw_page();
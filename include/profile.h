@@ -0,0 +1,68 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <Arduino.h>
+#include <pico/time.h>
+
+#include "breadcrumb.h"
+
+// Stages of the main loop that are timed in profiling builds.
+enum profile_stage {
+  PROFILE_CONTROL_WIRELESS = 0,
+  PROFILE_BLUETOOTH_SCANNING,
+  PROFILE_PRINT_WIFI_STATUS,
+  PROFILE_PRINT_TIME,
+  PROFILE_PRINT_BLUETOOTH_STATUS,
+  PROFILE_PRINT_CLIMATE,
+  PROFILE_PRINT_FORECAST_ICON,
+  PROFILE_PROCESS_PRESSURE,
+  PROFILE_CONTROL_BACKLIGHT,
+  PROFILE_ADVERTISEMENT_CALLBACK,
+  PROFILE_RENDER_WIDGETS,
+  PROFILE_DISPLAY_UPDATE,
+  PROFILE_WATCHDOG_INTERVAL,
+  PROFILE_DRAW_SPARKLINE,
+  PROFILE_STAGE_COUNT
+};
+
+// Histogram buckets are powers of two, bucket n counts durations from 2^(n-1)
+// up to 2^n - 1 microseconds. The last bucket takes everything from 16.4 ms up.
+#define PROFILE_BUCKETS 16
+// How often the histograms are printed, in milliseconds.
+#define PROFILE_DUMP_INTERVAL 60000
+
+const char* profile_stage_name(uint8_t stage);
+
+#ifdef HEM_PROFILE
+void profile_record(uint8_t stage, uint32_t duration);
+void profile_dump();
+void profile_histogram(uint8_t stage, uint32_t* max, uint32_t* buckets);
+#endif
+
+/**
+ * Times the scope it lives in and leaves a breadcrumb of the stage in case
+ * the watchdog fires during it. Profiling builds also count the duration in
+ * the histogram for the stage.
+ */
+class profile_scope {
+public:
+  profile_scope(uint8_t stage) : _stage(stage), _previous(breadcrumb_enter(stage)), _start(time_us_32()) {}
+  ~profile_scope() {
+    uint32_t duration = time_us_32() - _start;
+    breadcrumb_exit(_stage, _previous, duration);
+#ifdef HEM_PROFILE
+    profile_record(_stage, duration);
+#endif
+  }
+
+private:
+  uint8_t  _stage;
+  uint8_t  _previous;
+  uint32_t _start;
+};
+
+#define PROFILE_STAGE(stage) profile_scope _profile_scope(stage)
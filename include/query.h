@@ -0,0 +1,25 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <Arduino.h>
+#include <time.h>
+
+#include "query_tree.h"
+#include "query_types.h"
+
+// Days added to a tree per run of the service, at most. Each day takes 24
+// hourly reads.
+#define QUERY_DAYS_PER_RUN 31
+// A run of the service starts no new sensor and adds no more days after this
+// many milliseconds, well inside the watchdog timeout. Rewriting a tree of
+// 24 KB comes on top.
+#define QUERY_RUN_TIME 500
+
+bool query_service();
+bool query_window(uint8_t device, time_t from, time_t to, query_result_t* result);
+bool query_zone(uint8_t zone, time_t from, time_t to, query_result_t* result);
+
@@ -0,0 +1,31 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <Arduino.h>
+
+#include "query_types.h"
+
+// Days in the tree of each sensor, a year of finished days and today.
+#define QUERY_DAYS 366
+// Nodes of a tree: node 0 is the header, 1 the root and the days are the
+// leaves from QUERY_DAYS up.
+#define QUERY_TREE_NODES (2 * QUERY_DAYS)
+#define QUERY_TREE_MAGIC 0x51545245
+// Nodes from a leaf up to the root, at most.
+#define QUERY_TREE_HEIGHT 10
+
+// Reads a node of a tree, from a file on the device or from memory.
+typedef bool (*query_node_reader_t)(uint16_t node, query_summary_t* summary);
+
+void query_empty(query_summary_t& summary);
+void query_combine(query_summary_t& into, const query_summary_t& from);
+void query_tree_leaves(uint16_t first, uint16_t last, query_node_reader_t read, query_summary_t& summary);
+
+void                   query_batch_begin(query_batch_t& batch);
+bool                   query_batch_set_day(query_batch_t& batch, uint16_t day, const query_summary_t& leaf);
+void                   query_batch_finish(query_batch_t& batch, uint16_t newest, query_node_reader_t read);
+const query_summary_t* query_batch_node(const query_batch_t& batch, uint16_t node);
@@ -0,0 +1,53 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <Arduino.h>
+
+// Nodes changed by one batch of days: the leaves, the nodes above them and the
+// header. A month of days changes at most 73.
+#define QUERY_BATCH_NODES 96
+
+/**
+ * Totals over some stretch of time, as a node of the tree of days and while a
+ * query is being answered. Sums are weighted by the minutes sampled, so they
+ * combine exactly.
+ */
+typedef struct query_summary {
+  int64_t  temperature_sum; // Hundredths of a degree Celsius times minutes
+  int64_t  pressure_sum;    // Pascal above ROLLUP_PRESSURE_BASE times minutes
+  uint32_t humidity_sum;    // Half percent times minutes
+  uint32_t minutes;         // Minutes sampled, 0 if none
+  int16_t  temperature_min; // Hundredths of a degree Celsius
+  int16_t  temperature_max;
+  uint8_t  humidity_min;    // Half percent
+  uint8_t  humidity_max;
+  uint16_t day;             // For a leaf, the day it holds in days since the epoch
+} query_summary_t;
+
+/**
+ * The answer to a query.
+ */
+typedef struct query_result {
+  float    temperature_min; // Degrees Celsius
+  float    temperature;     // Average
+  float    temperature_max;
+  float    humidity_min;    // Percent
+  float    humidity;        // Average
+  float    humidity_max;
+  float    pressure;        // Average, Pascal
+  uint32_t minutes;         // Minutes sampled in the window, 0 if none
+} query_result_t;
+
+/**
+ * The nodes of a tree that change with a batch of days, sorted by node once
+ * the batch is finished.
+ */
+typedef struct query_batch {
+  uint16_t        count;                        // Nodes in use
+  uint16_t        nodes[QUERY_BATCH_NODES];     // Node numbers
+  query_summary_t summaries[QUERY_BATCH_NODES]; // New contents of each node
+} query_batch_t;
@@ -0,0 +1,17 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <Arduino.h>
+#include <WiFi.h>
+
+#include "resolver_types.h"
+
+// A lookup without an answer after this long is started again, milliseconds.
+#define RESOLVER_TIMEOUT 10000
+
+bool resolve(resolver_t& entry, const char* host, IPAddress* address);
+void resolver_forget(resolver_t& entry);
@@ -0,0 +1,20 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <Arduino.h>
+
+enum resolver_state { RESOLVER_UNRESOLVED = 0, RESOLVER_PENDING, RESOLVER_RESOLVED };
+
+/**
+ * A cached host name lookup. The lookup finishes in the lwIP callback, so the
+ * fields it writes are volatile.
+ */
+typedef struct resolver {
+  volatile uint8_t state;      // One of resolver_state
+  volatile uint8_t address[4]; // IPv4 address once resolved
+  uint32_t         started;    // millis() when the lookup was started
+} resolver_t;
@@ -0,0 +1,48 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <Arduino.h>
+
+#include "rollup_types.h"
+#include "timekeeping_types.h"
+#include "warm_state_types.h"
+
+#define ROLLUP_DIRECTORY "/rollup"
+// Slots of each tier, per sensor: 24 hours of minutes, 30 days of quarter
+// hours and a year of hours.
+#define ROLLUP_MINUTES 1440
+#define ROLLUP_QUARTERS 2880
+#define ROLLUP_HOURS 8760
+// Each tier is kept in files of one flash erase block, so writing a slot
+// rewrites one block.
+#define ROLLUP_FILE_SIZE 4096
+#define ROLLUP_MINUTES_PER_FILE (ROLLUP_FILE_SIZE / sizeof(rollup_minute_t))
+#define ROLLUP_RECORDS_PER_FILE (ROLLUP_FILE_SIZE / sizeof(rollup_record_t))
+#define ROLLUP_FILES_PER_DEVICE                                                                                        \
+  ((ROLLUP_MINUTES + ROLLUP_MINUTES_PER_FILE - 1) / ROLLUP_MINUTES_PER_FILE +                                          \
+   (ROLLUP_QUARTERS + ROLLUP_RECORDS_PER_FILE - 1) / ROLLUP_RECORDS_PER_FILE +                                         \
+   (ROLLUP_HOURS + ROLLUP_RECORDS_PER_FILE - 1) / ROLLUP_RECORDS_PER_FILE)
+// Flash taken by the tiers once every slot was written: 43 files per sensor,
+// 516 KB for three.
+#define ROLLUP_STORAGE_SIZE (ROLLUP_DEVICES * ROLLUP_FILES_PER_DEVICE * ROLLUP_FILE_SIZE)
+// A reading older than this is not sampled, in milliseconds.
+#define ROLLUP_STALE_AFTER 300000
+#define ROLLUP_PRESSURE_BASE 50000
+// Marks a slot as written, with the low 15 bits of the bucket number. The
+// bucket numbers wrap long after every tier has wrapped.
+#define ROLLUP_TAG(bucket) ((uint16_t)(0x8000 | ((bucket)&0x7fff)))
+
+void rollup_begin();
+void save_rollup_state(warm_state_t* state);
+void restore_rollup_state(const warm_state_t* state);
+void rollup_sample(const time_context_t& now);
+void rollup_service();
+
+uint32_t              rollup_bucket_seconds(uint8_t tier);
+bool                  rollup_read_minute(uint8_t device, uint32_t minute, rollup_minute_t* sample);
+bool                  rollup_read(uint8_t tier, uint8_t device, uint32_t bucket, rollup_record_t* record);
+const rollup_stats_t* rollup_stats();
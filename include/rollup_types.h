@@ -0,0 +1,94 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <Arduino.h>
+
+// Sensors rolled up, the first ones in the configuration. The tiers of a
+// sensor take 172 KB of flash, so more do not fit the file system.
+#define ROLLUP_DEVICES 3
+// Records kept in RAM between flushes. A flush follows every closed hour, by
+// then each sensor has up to 61 minutes, 5 quarters and 2 hours waiting.
+#define ROLLUP_PENDING (ROLLUP_DEVICES * 72)
+
+// Tiers of the rollups, finest first.
+enum rollup_tier { ROLLUP_MINUTE = 0, ROLLUP_QUARTER, ROLLUP_HOUR, ROLLUP_TIER_COUNT };
+
+/**
+ * A one-minute sample of a sensor, in fixed point.
+ */
+typedef struct rollup_minute {
+  uint16_t tag;         // ROLLUP_TAG() of the minute, tells a current slot from a stale or empty one
+  int16_t  temperature; // Hundredths of a degree Celsius
+  uint16_t humidity;    // Hundredths of a percent
+  uint16_t pressure;    // Pascal above ROLLUP_PRESSURE_BASE
+} rollup_minute_t;
+
+/**
+ * Minimum, average and maximum of a sensor over a 15-minute or hourly bucket.
+ */
+typedef struct rollup_record {
+  uint16_t tag;             // ROLLUP_TAG() of the bucket
+  int16_t  temperature_min; // Hundredths of a degree Celsius
+  int16_t  temperature;     // Average
+  int16_t  temperature_max;
+  uint16_t pressure;        // Average, Pascal above ROLLUP_PRESSURE_BASE
+  uint8_t  humidity_min;    // Half percent
+  uint8_t  humidity;        // Average
+  uint8_t  humidity_max;
+  uint8_t  samples;         // Minutes that went into the bucket
+} rollup_record_t;
+
+/**
+ * Running totals of the bucket being filled, one per sensor and tier.
+ */
+typedef struct rollup_accumulator {
+  uint32_t bucket;          // Bucket number, seconds since the epoch over the bucket length
+  uint16_t samples;         // 0 while nothing was added
+  int16_t  temperature_min; // Hundredths of a degree Celsius
+  int16_t  temperature_max;
+  uint16_t humidity_min;    // Hundredths of a percent
+  uint16_t humidity_max;
+  int32_t  temperature_sum;
+  uint32_t humidity_sum;
+  uint32_t pressure_sum;    // Pascal above ROLLUP_PRESSURE_BASE
+} rollup_accumulator_t;
+
+/**
+ * A record waiting in RAM for the next flush.
+ */
+typedef struct rollup_pending {
+  uint32_t bucket; // Bucket number of the record
+  uint8_t  tier;   // ROLLUP_MINUTE, ROLLUP_QUARTER or ROLLUP_HOUR
+  uint8_t  device; // Index of the device in the configuration
+  union {
+    rollup_minute_t minute; // For the minute tier
+    rollup_record_t record; // For the others
+  };
+} rollup_pending_t;
+
+/**
+ * The rollups waiting in RAM, as kept in the warm state.
+ */
+typedef struct rollup_state {
+  uint8_t              devices;                                     // Sensors configured when saved
+  uint16_t             pending_count;                               // Records in pending
+  rollup_accumulator_t open[ROLLUP_DEVICES][ROLLUP_TIER_COUNT - 1]; // Quarter and hour being filled
+  rollup_pending_t     pending[ROLLUP_PENDING];                     // Records waiting for a flush
+} rollup_state_t;
+
+/**
+ * Statistics on the rollups since boot.
+ */
+typedef struct rollup_stats {
+  uint32_t samples;       // One-minute samples taken
+  uint32_t records;       // Records written, all tiers
+  uint32_t writes;        // Files written
+  uint32_t failures;      // Files that could not be written
+  uint32_t dropped;       // Records dropped because too many were waiting for a flush
+  uint32_t skipped;       // Samples not taken because the sensor is not among the first ROLLUP_DEVICES
+  uint32_t last_duration; // Microseconds the last flush took
+} rollup_stats_t;
@@ -10,15 +10,25 @@
 #include <vector>
 
 #include "ruuvi_types.h"
+#include "warm_state_types.h"
 
 void setup_ruuvi_devices();
 bool ruuvi_devices_configured();
 
-std::vector<uint8_t>      ruuvi_outdoor_sensor();
 std::vector<ruuvi_data_t> ruuvi_readings();
 std::vector<time_t>       ruuvi_reading_times();
 
+uint8_t      ruuvi_device_count();
+uint8_t      ruuvi_zone(uint8_t i);
+bool         ruuvi_is_outdoor(uint8_t i);
+ruuvi_data_t ruuvi_reading(uint8_t i);
+time_t       ruuvi_reading_time(uint8_t i);
+uint32_t     ruuvi_heard_at(uint8_t i);
+
 ruuvi_data_t make_ruuvi_data(uint8_t data[]);
 
 void store_ruuvi_reading(uint8_t i, volatile ruuvi_data_t rdata);
 void store_ruuvi_reading_time(size_t i, volatile time_t time);
+
+void save_ruuvi_state(warm_state_t* state);
+void restore_ruuvi_state(const warm_state_t* state);
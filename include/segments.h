@@ -0,0 +1,30 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <Arduino.h>
+#include <U8g2lib.h>
+
+#define SEGMENTS_GLYPH_ROWS 16
+#define SEGMENTS_MAX_GLYPHS 16
+
+/**
+ * A glyph from font_segments_12x17, pre-rasterized by tools/segments_glyphs.py
+ * for the frame buffer layout of a display turned with U8G2_R3.
+ */
+typedef struct segments_glyph {
+  uint16_t encoding;                  // Unicode code point
+  uint8_t  advance;                   // Distance to the next glyph
+  uint8_t  ink_width;                 // Width of the glyph itself
+  uint16_t rows[SEGMENTS_GLYPH_ROWS]; // Rows above the baseline, bit 15 is the leftmost column
+} segments_glyph_t;
+
+bool segments_width(const char* text, uint16_t* width);
+bool draw_segments(U8G2& u8g2, int16_t x, int16_t y, const char* text);
+
+#ifdef HEM_BENCHMARK
+void benchmark_segments();
+#endif
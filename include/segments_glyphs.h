@@ -0,0 +1,35 @@
+// Pre-rasterized glyphs for the Segments 12x17 font.
+//
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+//
+// Generated by tools/segments_glyphs.py from fonts/Segments_12x17.bdf, do
+// not edit by hand.
+
+#pragma once
+
+#include "segments.h"
+
+// clang-format off
+const segments_glyph_t segments_glyphs[17] PROGMEM = {
+  {32, 11, 0, {0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000}},
+  {37, 10, 9, {0x7000, 0xe800, 0xd800, 0xd880, 0xd980, 0xbb00, 0x7600, 0x0c00, 0x1800, 0x3700, 0x6e80, 0xcd80, 0x8d80, 0x0d80, 0x0b80, 0x0700}},
+  {43, 9, 8, {0x0000, 0x0000, 0x0000, 0x0000, 0x1800, 0x1800, 0x1800, 0xef00, 0xf700, 0x1800, 0x1800, 0x1800, 0x0000, 0x0000, 0x0000, 0x0000}},
+  {45, 9, 8, {0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0xff00, 0xff00, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000}},
+  {46, 3, 2, {0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0xc000, 0xc000}},
+  {48, 10, 9, {0x7f00, 0xbe80, 0xc180, 0xc180, 0xc180, 0xc180, 0xc180, 0x8080, 0x8080, 0xc180, 0xc180, 0xc180, 0xc180, 0xc180, 0xbe80, 0x7f00}},
+  {49, 10, 9, {0x0000, 0x0080, 0x0180, 0x0180, 0x0180, 0x0180, 0x0180, 0x0080, 0x0080, 0x0180, 0x0180, 0x0180, 0x0180, 0x0180, 0x0080, 0x0000}},
+  {50, 10, 9, {0x7f00, 0x3e80, 0x0180, 0x0180, 0x0180, 0x0180, 0x0180, 0x7e80, 0xbf00, 0xc000, 0xc000, 0xc000, 0xc000, 0xc000, 0xbe00, 0x7f00}},
+  {51, 10, 9, {0x7f00, 0x3e80, 0x0180, 0x0180, 0x0180, 0x0180, 0x0180, 0x7e80, 0x3e80, 0x0180, 0x0180, 0x0180, 0x0180, 0x0180, 0x3e80, 0x7f00}},
+  {52, 10, 9, {0x0000, 0x8080, 0xc180, 0xc180, 0xc180, 0xc180, 0xc180, 0xbe80, 0x7e80, 0x0180, 0x0180, 0x0180, 0x0180, 0x0180, 0x0080, 0x0000}},
+  {53, 10, 9, {0x7f00, 0xbe00, 0xc000, 0xc000, 0xc000, 0xc000, 0xc000, 0xbf00, 0x7e80, 0x0180, 0x0180, 0x0180, 0x0180, 0x0180, 0x3e80, 0x7f00}},
+  {54, 10, 9, {0x7f00, 0xbe00, 0xc000, 0xc000, 0xc000, 0xc000, 0xc000, 0xbf00, 0xbe80, 0xc180, 0xc180, 0xc180, 0xc180, 0xc180, 0xbe80, 0x7f00}},
+  {55, 10, 9, {0x7f00, 0x3e80, 0x0180, 0x0180, 0x0180, 0x0180, 0x0180, 0x0080, 0x0080, 0x0180, 0x0180, 0x0180, 0x0180, 0x0180, 0x0080, 0x0000}},
+  {56, 10, 9, {0x7f00, 0xbe80, 0xc180, 0xc180, 0xc180, 0xc180, 0xc180, 0xbe80, 0xbe80, 0xc180, 0xc180, 0xc180, 0xc180, 0xc180, 0xbe80, 0x7f00}},
+  {57, 10, 9, {0x7f00, 0xbe80, 0xc180, 0xc180, 0xc180, 0xc180, 0xc180, 0xbe80, 0x7e80, 0x0180, 0x0180, 0x0180, 0x0180, 0x0180, 0x3e80, 0x7f00}},
+  {67, 9, 8, {0x7f00, 0xbe00, 0xc000, 0xc000, 0xc000, 0xc000, 0xc000, 0x8000, 0x8000, 0xc000, 0xc000, 0xc000, 0xc000, 0xc000, 0xbe00, 0x7f00}},
+  {176, 7, 6, {0x7800, 0xf400, 0xcc00, 0xcc00, 0xbc00, 0x7800, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000}},
+};
+// clang-format on
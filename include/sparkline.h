@@ -0,0 +1,27 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <Arduino.h>
+#include <U8g2lib.h>
+
+#include "sparkline_types.h"
+#include "timekeeping_types.h"
+
+enum sparkline_series { SPARKLINE_TEMPERATURE = 0, SPARKLINE_PRESSURE, SPARKLINE_SERIES_COUNT };
+
+// One column per pixel across the display, 24 hours over 128 columns.
+#define SPARKLINE_COLUMNS 128
+#define SPARKLINE_COLUMN_SECONDS 675
+// Columns filled from the minute rollups per run of the service, after boot.
+#define SPARKLINE_BACKFILL_COLUMNS 16
+
+void sparkline_sample(const time_context_t& now);
+void sparkline_service();
+
+bool     sparkline_range(uint8_t series, int16_t* low, int16_t* high);
+uint32_t sparkline_version();
+void     draw_sparkline(U8G2& u8g2, uint8_t series, int16_t y, uint8_t height);
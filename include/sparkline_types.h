@@ -0,0 +1,18 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <Arduino.h>
+
+/**
+ * The lowest and highest outdoor values seen in one column of the sparklines,
+ * indexed by series.
+ */
+typedef struct sparkline_column {
+  uint32_t column;  // Seconds since the epoch over SPARKLINE_COLUMN_SECONDS, 0 if empty
+  int16_t  min[2];  // Hundredths of a degree Celsius and tenths of a hectopascal
+  int16_t  max[2];
+} sparkline_column_t;
@@ -0,0 +1,31 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <Arduino.h>
+
+// Periods of the scheduled tasks, in milliseconds.
+#define TASK_PERIOD_BOOT 10
+#define TASK_PERIOD_WIRELESS 500
+#define TASK_PERIOD_SCANNING 1000
+#define TASK_PERIOD_BACKLIGHT 1000
+#define TASK_PERIOD_WATCHDOG 5000
+#define TASK_PERIOD_PRESSURE 600000
+#define TASK_PERIOD_MEMORY 60000
+#define TASK_PERIOD_WARM_STATE 600000
+#define TASK_PERIOD_HISTORY 60000
+// Started on every new UTC day, runs this often until the days are added.
+#define TASK_PERIOD_DAYS 1000
+#define TASK_PERIOD_PAGE 15000
+#define TASK_PERIOD_TELEMETRY 100
+// While a telemetry response is being sent, one frame goes out this often.
+#define TASK_PERIOD_TELEMETRY_BUSY 2
+// Longest time the CPU sleeps between scheduler passes.
+#define TASK_MAX_SLEEP 100
+
+void setup_tasks();
+void run_tasks();
+void request_render();
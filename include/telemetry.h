@@ -0,0 +1,41 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <Arduino.h>
+
+#include "profile.h"
+
+// Requests from the host, a response has the request with the top bit set.
+enum telemetry_command {
+  TELEMETRY_PING = 0,  // No items, answers with an empty frame
+  TELEMETRY_READINGS,  // Latest reading of each sensor
+  TELEMETRY_COUNTERS,  // One item of internal counters
+  TELEMETRY_PROFILE,   // Histogram of each profiled stage, profiling builds only
+  TELEMETRY_HISTORY,   // Readings kept on the device, oldest first
+  TELEMETRY_COMMAND_COUNT
+};
+
+#define TELEMETRY_RESPONSE 0x80
+// Sent unasked, one deferred log record per frame, see logging.h.
+#define TELEMETRY_LOG 0x90
+#define TELEMETRY_ERROR 0xff
+// Set in the flags of the last frame of a response.
+#define TELEMETRY_LAST 0x01
+
+// Largest frame before COBS encoding: a 4 byte header, the items and a CRC-32.
+// Small enough that an encoded frame fits the USB CDC transmit buffer.
+#define TELEMETRY_FRAME_SIZE 192
+#define TELEMETRY_HEADER_SIZE 4
+#define TELEMETRY_ENCODED_SIZE (TELEMETRY_FRAME_SIZE + TELEMETRY_FRAME_SIZE / 254 + 3)
+// Largest item, a profile histogram.
+#define TELEMETRY_ITEM_SIZE (5 + PROFILE_BUCKETS * 4)
+// Longest request, command and arguments before the CRC.
+#define TELEMETRY_REQUEST_SIZE 16
+
+bool telemetry_poll();
+bool telemetry_room();
+bool telemetry_send(uint8_t type, uint16_t number, uint8_t flags, const uint8_t* body, size_t length);
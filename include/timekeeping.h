@@ -0,0 +1,39 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <Arduino.h>
+#include <time.h>
+
+#include "network_time_types.h"
+#include "timekeeping_types.h"
+
+// Offsets larger than this are corrected with a step, smaller ones are slewed.
+#define CLOCK_STEP_THRESHOLD 2000
+// Fastest rate an offset is slewed away at, in parts per million.
+#define CLOCK_SLEW_PPM 500
+// How often the drift and slew corrections are applied, in milliseconds.
+#define CLOCK_ADJUST_INTERVAL 1000
+// Syncs are spaced so the clock stays within this many milliseconds.
+#define CLOCK_TARGET_ERROR 250
+// Bounds on the time between syncs, in milliseconds.
+#define CLOCK_SYNC_MIN 3600000
+#define CLOCK_SYNC_MAX 86400000
+// Syncs kept in the offset history.
+#define CLOCK_HISTORY 16
+
+void     clock_sync(const ntp_sample_t& sample);
+void     clock_adjust();
+void     clock_seed(time_t utc);
+bool     clock_synced();
+int32_t  clock_drift();
+uint32_t clock_sync_interval();
+uint8_t  clock_offset_count();
+
+const clock_offset_t* clock_offset_history(uint8_t age);
+
+const time_context_t& time_tick();
+const time_context_t& time_context();
@@ -0,0 +1,35 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <Arduino.h>
+#include <time.h>
+
+/**
+ * The local clock compared to NTP at one sync.
+ */
+typedef struct clock_offset {
+  time_t  time;    // When the sync happened
+  int32_t offset;  // Server time minus the local clock in milliseconds
+  int32_t drift;   // Drift estimate after the sync, parts per billion, positive if the local clock is slow
+  uint8_t stepped; // 1 if the clock was stepped rather than slewed
+} clock_offset_t;
+
+/**
+ * The time as seen by everything during one clock tick, converted once.
+ */
+typedef struct time_context {
+  time_t    utc;            // Seconds since the epoch
+  struct tm local;          // Local time, after the timezone is set up
+  struct tm gmt;            // UTC broken down
+  uint16_t  yday;           // Local day of the year, 0-365
+  uint16_t  minute;         // Local minute of the day, 0-1439
+  bool      valid;          // False until the clock has been set, from the network or a restored snapshot
+  bool      synced;         // The clock has been set from the network
+  bool      date_changed;   // The local date changed since the previous tick, or the clock was just set
+  bool      utc_changed;    // Same for the UTC date, which the daily summaries follow
+  bool      minute_changed; // The local minute changed since the previous tick
+} time_context_t;
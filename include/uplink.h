@@ -0,0 +1,40 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <Arduino.h>
+
+#include "ruuvi_types.h"
+#include "uplink_types.h"
+
+// Readings kept on the device until the collector has them, the oldest are
+// dropped first.
+#define UPLINK_QUEUE_SIZE 512
+// Windows can be up to a day apart, longer than the queue lasts with three
+// sensors logging every six minutes. With this many readings waiting, a WiFi
+// window is opened early, see uplink_backlogged().
+#define UPLINK_HIGH_WATER (UPLINK_QUEUE_SIZE / 2)
+// Devices that can be queued, the device index is kept in four bits.
+#define UPLINK_DEVICES 16
+// Most readings sent in one frame.
+#define UPLINK_FRAME_READINGS 64
+// Header, the readings at up to 17 bytes each and the CRC.
+#define UPLINK_FRAME_SIZE (10 + UPLINK_FRAME_READINGS * 17 + 4)
+#define UPLINK_FRAME_MAGIC 0x4548
+#define UPLINK_FRAME_VERSION 1
+// Timeouts of a flush, in milliseconds. Connecting includes looking up the
+// collector.
+#define UPLINK_CONNECT_TIMEOUT 10000
+#define UPLINK_RESPONSE_TIMEOUT 5000
+
+void uplink_queue_reading(uint8_t device, const ruuvi_data_t& reading, time_t time);
+bool uplink_flush();
+void uplink_cancel();
+bool uplink_configured();
+bool uplink_backlogged();
+
+uint16_t              uplink_pending();
+const uplink_stats_t* uplink_stats();
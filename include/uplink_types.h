@@ -0,0 +1,34 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <Arduino.h>
+
+/**
+ * A reading waiting in the uplink queue, in fixed point.
+ */
+typedef struct uplink_reading {
+  uint32_t time;        // Seconds since the epoch
+  uint32_t pressure;    // Pascal
+  int16_t  temperature; // Hundredths of a degree Celsius
+  uint16_t humidity;    // Hundredths of a percent
+  uint8_t  device;      // Index of the device in the configuration
+} uplink_reading_t;
+
+/**
+ * Statistics on the uplink since boot.
+ */
+typedef struct uplink_stats {
+  uint32_t queued;        // Readings added to the queue
+  uint32_t sent;          // Readings acknowledged by the collector
+  uint32_t dropped;       // Readings dropped because the queue was full
+  uint32_t frames;        // Frames acknowledged
+  uint32_t failures;      // Frames that were not acknowledged
+  uint32_t bytes;         // Bytes sent in acknowledged requests, headers included
+  uint32_t last_bytes;    // Bytes sent in the last flush
+  uint32_t last_readings; // Readings acknowledged in the last flush
+  uint32_t last_duration; // How long the last flush took in milliseconds
+} uplink_stats_t;
@@ -0,0 +1,38 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <Arduino.h>
+
+#include "usb_drive_types.h"
+
+// The drive is a FAT12 volume that exists only as the sectors the host reads.
+#define USB_DRIVE_SECTOR_SIZE 512
+// An 8 MB volume of 4 KB clusters, 2046 of them.
+#define USB_DRIVE_SECTORS 16384
+#define USB_DRIVE_CLUSTER_SECTORS 8
+// Boot sector, one FAT and one sector of 16 root directory entries.
+#define USB_DRIVE_FAT_SECTORS 7
+#define USB_DRIVE_FAT_START 1
+#define USB_DRIVE_ROOT_START (USB_DRIVE_FAT_START + USB_DRIVE_FAT_SECTORS)
+#define USB_DRIVE_DATA_START (USB_DRIVE_ROOT_START + 1)
+#define USB_DRIVE_CLUSTERS ((USB_DRIVE_SECTORS - USB_DRIVE_DATA_START) / USB_DRIVE_CLUSTER_SECTORS)
+#define USB_DRIVE_CLUSTER_SIZE (USB_DRIVE_CLUSTER_SECTORS * USB_DRIVE_SECTOR_SIZE)
+
+// Every line of history.csv after the header has the same length, so the line
+// holding any byte of the file is found without reading the ones before it.
+#define USB_DRIVE_CSV_HEADER "time,kind,sensor,temperature,humidity,pressure\r\n"
+#define USB_DRIVE_CSV_LINE 50
+
+enum usb_drive_state {
+  USB_DRIVE_IDLE = 0,  // The monitor has the file system
+  USB_DRIVE_REQUESTED, // The host wants the drive, waiting for the monitor to hand it over
+  USB_DRIVE_READY,     // The host has the file system
+  USB_DRIVE_RELEASED   // The host ejected the drive, waiting for the monitor to take it back
+};
+
+void    usb_drive_service();
+uint8_t usb_drive_state();
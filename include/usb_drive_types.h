@@ -0,0 +1,37 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <Arduino.h>
+
+/**
+ * A FAT directory entry, as the host reads it.
+ */
+typedef struct usb_drive_entry {
+  char     name[11];      // 8.3 name, space padded, without the dot
+  uint8_t  attributes;    // 0x01 read only, 0x08 volume label, 0x20 archive
+  uint8_t  reserved;      // 0x08 and 0x10 show the name and extension in lower case
+  uint8_t  created_tenth; // Zero
+  uint16_t created_time;  // FAT time, same as written_time
+  uint16_t created_date;  // FAT date, same as written_date
+  uint16_t accessed_date; // FAT date
+  uint16_t cluster_high;  // Zero on FAT12
+  uint16_t written_time;  // Hour << 11 | minute << 5 | second / 2
+  uint16_t written_date;  // (Year - 1980) << 9 | month << 5 | day
+  uint16_t cluster;       // First cluster, 0 for the label
+  uint32_t size;          // Bytes in the file
+} usb_drive_entry_t;
+
+/**
+ * A file on the drive. Files take consecutive clusters, in the order of the
+ * directory.
+ */
+typedef struct usb_drive_file {
+  const char* name;    // 8.3 name as in the directory entry
+  uint32_t    size;    // Bytes, fixed when the host takes the drive
+  uint16_t    cluster; // First cluster
+  uint16_t    last;    // Last cluster
+} usb_drive_file_t;
@@ -0,0 +1,19 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <Arduino.h>
+
+#include "warm_state_types.h"
+
+#define WARM_STATE_VERSION 3
+// Snapshots alternate between two files, so a reset during a write always
+// leaves the previous one intact.
+#define WARM_STATE_FILE_A "warm_a.bin"
+#define WARM_STATE_FILE_B "warm_b.bin"
+
+void save_warm_state();
+bool restore_warm_state();
@@ -0,0 +1,35 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <Arduino.h>
+#include <time.h>
+
+#include "rollup_types.h"
+#include "ruuvi_types.h"
+
+// Sensors whose latest readings are kept across restarts.
+#define WARM_STATE_DEVICES 8
+
+/**
+ * Live state written to flash so a restart does not lose the pressure trend,
+ * the latest readings or the rollups waiting in RAM.
+ */
+typedef struct warm_state {
+  uint32_t       version;                           // WARM_STATE_VERSION, older records are ignored
+  uint32_t       sequence;                          // Increases with every write, the highest valid one is newest
+  time_t         saved_at;                          // Time of the snapshot, 0 if the time was not set
+  uint32_t       saved_uptime;                      // Seconds since boot at the snapshot
+  time_t         last_pressure;                     // When the pressure trend was last sampled
+  float          pressure_trend_data[2];            // The two latest pressure samples in hPa
+  uint32_t       average_pressure;                  // Average outdoor pressure in Pa
+  float          average_temperature;               // Average outdoor temperature
+  uint8_t        device_count;                      // Sensors in readings, 0 if none were configured
+  ruuvi_data_t   readings[WARM_STATE_DEVICES];      // Latest reading per sensor
+  time_t         reading_times[WARM_STATE_DEVICES]; // When each sensor was last logged
+  rollup_state_t rollup;                            // Rollups not yet written
+  uint32_t       crc;                               // CRC-32 of everything above
+} warm_state_t;
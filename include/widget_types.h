@@ -0,0 +1,38 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <Arduino.h>
+
+#define WIDGET_TEXT_SIZE 32
+
+typedef enum widget_align { WIDGET_ALIGN_LEFT = 0, WIDGET_ALIGN_RIGHT } widget_align_t;
+
+/**
+ * Retained state for one element on the display. The formatted text and its
+ * measured width are cached so nothing is formatted or measured unless the
+ * value bound to the widget changes.
+ */
+typedef struct widget {
+  const uint8_t* font;                   // Font used to draw the widget
+  int16_t        x;                      // Anchor, left or right edge depending on align
+  int16_t        y;                      // Baseline
+  widget_align_t align;                  // Horizontal alignment relative to x
+  int8_t         ascent;                 // Cached font ascent
+  int8_t         descent;                // Cached font descent, zero or negative
+  uint16_t       glyph;                  // Glyph to draw, 0 for text widgets
+  char           text[WIDGET_TEXT_SIZE]; // Cached formatted text
+  uint16_t       width;                  // Cached width of the text or glyph
+  int32_t        value;                  // Last value bound to the widget
+  bool           bound;                  // Whether value holds anything yet
+  bool           visible;                // Whether the widget should be shown
+  bool           dirty;                  // Whether the widget needs redrawing
+  bool           drawn;                  // Whether the widget is on screen
+  int16_t        drawn_x;                // Left edge of what is on screen
+  int16_t        drawn_y;                // Top edge of what is on screen
+  uint16_t       drawn_width;            // Width of what is on screen
+  uint16_t       drawn_height;           // Height of what is on screen
+} widget_t;
@@ -0,0 +1,57 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <Arduino.h>
+#include <U8g2lib.h>
+
+#include "widget_types.h"
+
+// Number of widgets making up one climate row: icon, temperature and humidity.
+// A row of the zone table has the zone name in place of the icon.
+#define WIDGET_CLIMATE_ROW_SIZE 3
+// Zones shown at a time in the zone table.
+#define WIDGET_ZONE_ROWS 3
+
+enum widget_id {
+  WIDGET_DATE = 0,
+  WIDGET_CLOCK,
+  WIDGET_SUNRISE_ICON,
+  WIDGET_SUNRISE,
+  WIDGET_SUNSET_ICON,
+  WIDGET_SUNSET,
+  WIDGET_INDOOR_ICON,
+  WIDGET_INDOOR_TEMPERATURE,
+  WIDGET_INDOOR_HUMIDITY,
+  WIDGET_OUTDOOR_ICON,
+  WIDGET_OUTDOOR_TEMPERATURE,
+  WIDGET_OUTDOOR_HUMIDITY,
+  WIDGET_WIFI,
+  WIDGET_NETWORK_SETUP,
+  WIDGET_BLUETOOTH,
+  WIDGET_FORECAST,
+  WIDGET_GRAPH_TITLE,
+  WIDGET_ZONE_1_NAME,
+  WIDGET_ZONE_1_TEMPERATURE,
+  WIDGET_ZONE_1_HUMIDITY,
+  WIDGET_ZONE_2_NAME,
+  WIDGET_ZONE_2_TEMPERATURE,
+  WIDGET_ZONE_2_HUMIDITY,
+  WIDGET_ZONE_3_NAME,
+  WIDGET_ZONE_3_TEMPERATURE,
+  WIDGET_ZONE_3_HUMIDITY,
+  WIDGET_COUNT
+};
+
+void layout_widgets();
+void invalidate_widgets();
+bool render_widgets();
+
+bool widget_bind(uint8_t id, int32_t value);
+void widget_set_text(uint8_t id, const char* text);
+void widget_set_glyph(uint8_t id, uint16_t glyph);
+void widget_set_visible(uint8_t id, bool visible);
+void widget_graph_area(int16_t* top, uint8_t* height);
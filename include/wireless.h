@@ -8,9 +8,42 @@
 #include <U8g2lib.h>
 #include <WiFi.h>
 
+#include "wireless_types.h"
+
 enum WiFiSignal { AMAZING, GREAT, GOOD, OK, BAD, UNUSABLE };
 
-void control_wireless();
+// Steps of the wireless bring-up: connect to WiFi, get the time, send queued
+// readings, serve HTTP for a while, turn WiFi off and start Bluetooth.
+enum wireless_state {
+  WIRELESS_IDLE = 0,      // Nothing started, or starting over
+  WIRELESS_CONNECTING,    // Waiting for WiFi to connect
+  WIRELESS_TIME,          // Connected, waiting for NTP
+  WIRELESS_UPLINK,        // Sending queued readings to the collector
+  WIRELESS_SERVING,       // Answering HTTP requests
+  WIRELESS_DISCONNECTING, // Time set, turning WiFi off
+  WIRELESS_BLUETOOTH,     // Starting Bluetooth
+  WIRELESS_READY,         // Bluetooth running
+  WIRELESS_BACKOFF        // Something failed, waiting before trying again
+};
+
+// Timeouts and retry delays of the bring-up, in milliseconds.
+#define WIRELESS_CONNECT_TIMEOUT 15000
+#define WIRELESS_TIME_TIMEOUT 20000
+#define WIRELESS_BACKOFF_MIN 2000
+#define WIRELESS_BACKOFF_MAX 120000
+// Once Bluetooth runs, scanning is paused for a WiFi window whenever the clock
+// needs a resync, see clock_sync_interval(). A window is closed after at most
+// this long, not counting the time WiFi is kept up for the HTTP server.
+#define WIRELESS_WINDOW_TIMEOUT 30000
+// A window for a backlogged uplink queue opens at most this often, so a
+// collector that is down does not keep the radio from Bluetooth.
+#define WIRELESS_UPLINK_WINDOW_GAP 3600000
+
+void    control_wireless();
+uint8_t wireless_state();
+bool    wireless_window_open();
+
+const wireless_window_stats_t* wireless_window_stats();
 
 void    connect_network();
 void    disconnect_network();
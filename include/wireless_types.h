@@ -0,0 +1,18 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <Arduino.h>
+
+/**
+ * Statistics on the windows where Bluetooth scanning is paused for WiFi.
+ */
+typedef struct wireless_window_stats {
+  uint32_t windows;    // Windows opened since boot
+  uint32_t failed;     // Windows closed without getting the time
+  uint32_t last_lost;  // Milliseconds of scanning lost in the last window
+  uint32_t total_lost; // Milliseconds of scanning lost in all windows
+} wireless_window_stats_t;
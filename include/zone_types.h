@@ -0,0 +1,32 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <Arduino.h>
+
+#include <string>
+
+#define ZONE_MAX 8
+#define ZONE_NAME_SIZE 12 // Longer placements are shown cut to 11 characters
+#define ZONE_NONE 0xff    // Zone of a sensor whose placement did not fit
+
+/**
+ * A named zone, one per distinct placement in the configuration.
+ */
+typedef struct zone {
+  std::string placement; // As configured, zones are told apart by all of it
+  char        name[ZONE_NAME_SIZE];
+  bool        outdoor; // Placed "outdoor" or "outside"
+} zone_t;
+
+/**
+ * Averages of the latest readings of the sensors in a zone.
+ */
+typedef struct zone_aggregate {
+  int16_t  temperature; // Hundredths of a degree Celsius
+  uint16_t humidity;    // Hundredths of a percent
+  uint8_t  sensors;     // Sensors averaged, 0 if none
+} zone_aggregate_t;
@@ -0,0 +1,16 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <Arduino.h>
+
+#include "zone_types.h"
+
+void        zones_clear();
+uint8_t     zone_intern(const char* name);
+uint8_t     zone_count();
+const char* zone_name(uint8_t zone);
+bool        zone_is_outdoor(uint8_t zone);
@@ -0,0 +1,105 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "boot.h"
+
+#include <Arduino.h>
+#include <LittleFS.h>
+
+#include "breadcrumb.h"
+#include "configuration.h"
+#include "history.h"
+#include "rollup.h"
+#include "ruuvi.h"
+#include "tasks.h"
+#include "warm_state.h"
+#include "widgets.h"
+
+const char* boot_phase_names[BOOT_PHASE_COUNT] PROGMEM = {"display", "storage", "screen", "radio", "reading", "done"};
+
+uint8_t           _boot_phase                   = BOOT_DISPLAY;
+uint32_t          _boot_times[BOOT_PHASE_COUNT] = {0};
+volatile uint32_t _boot_first_reading           = 0;
+
+/**
+ * Note that the display is up. Called from setup() once the splash is shown,
+ * the rest of the boot runs as steps from the task scheduler.
+ */
+void boot_begin() {
+  _boot_phase               = BOOT_DISPLAY;
+  _boot_times[BOOT_DISPLAY] = millis();
+}
+
+/**
+ * Run the next boot phase. Each step is short so the display, backlight and
+ * watchdog tasks get to run in between.
+ *
+ * \return the phase that was reached
+ */
+uint8_t boot_step() {
+  switch (_boot_phase) {
+    case BOOT_DISPLAY:
+      LittleFS.begin();
+      report_reset();
+      load_config_file();
+      setup_ruuvi_devices();
+      restore_warm_state();
+      history_begin();
+      rollup_begin();
+      _boot_phase = BOOT_STORAGE;
+      break;
+    case BOOT_STORAGE:
+      layout_widgets();
+      request_render();
+      _boot_phase = BOOT_SCREEN;
+      break;
+    case BOOT_SCREEN:
+      _boot_phase = BOOT_RADIO;
+      break;
+    case BOOT_RADIO:
+      if (_boot_first_reading == 0) {
+        return _boot_phase;
+      }
+      _boot_phase               = BOOT_READING;
+      _boot_times[BOOT_READING] = _boot_first_reading;
+      print_boot_metrics();
+      return _boot_phase;
+    case BOOT_READING:
+      _boot_phase = BOOT_DONE;
+      break;
+    default:
+      return _boot_phase;
+  }
+  _boot_times[_boot_phase] = millis();
+  return _boot_phase;
+}
+
+uint8_t boot_phase() {
+  return _boot_phase;
+}
+
+/**
+ * Note the first reading from a sensor. Called from the Bluetooth callback, so
+ * it only stores the time.
+ */
+void boot_first_reading() {
+  if (_boot_first_reading == 0) {
+    _boot_first_reading = millis();
+  }
+}
+
+/**
+ * Print the time from power-up to each completed boot phase.
+ */
+void print_boot_metrics() {
+  Serial.print(F("Boot:"));
+  for (uint8_t phase = 0; phase <= _boot_phase && phase < BOOT_DONE; phase++) {
+    Serial.print(' ');
+    Serial.print(boot_phase_names[phase]);
+    Serial.print('=');
+    Serial.print(_boot_times[phase]);
+  }
+  Serial.println(F(" ms"));
+}
@@ -0,0 +1,147 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "breadcrumb.h"
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <hardware/watchdog.h>
+#include <string.h>
+
+#include "breadcrumb_types.h"
+#include "common.h"
+#include "profile.h"
+
+const char* reset_causes[] PROGMEM = {"power on", "watchdog", "reboot"};
+
+reset_record_t _last_reset;
+
+/**
+ * Note that a stage started. Called through PROFILE_STAGE().
+ *
+ * \return the stage that was running before, to be restored on exit
+ */
+uint8_t breadcrumb_enter(uint8_t stage) {
+  uint32_t crumb          = watchdog_hw->scratch[0];
+  watchdog_hw->scratch[0] = (crumb & 0xff00ffff) | ((uint32_t)stage << 16);
+  return (crumb >> 16) & 0xff;
+}
+
+/**
+ * Note that a stage finished and how long it took.
+ */
+void breadcrumb_exit(uint8_t stage, uint8_t previous, uint32_t duration) {
+  watchdog_hw->scratch[0] = ((uint32_t)BREADCRUMB_MAGIC << 24) | ((uint32_t)previous << 16) | ((uint32_t)stage << 8);
+  watchdog_hw->scratch[3] = duration;
+}
+
+void breadcrumb_uptime(uint32_t seconds) {
+  watchdog_hw->scratch[1] = seconds;
+}
+
+void breadcrumb_heap(uint32_t heap_free, uint32_t largest_block) {
+  uint32_t high           = min(heap_free >> 4, (uint32_t)0xffff);
+  uint32_t low            = min(largest_block >> 4, (uint32_t)0xffff);
+  watchdog_hw->scratch[2] = (high << 16) | low;
+}
+
+/**
+ * \return what report_reset() found out about the last reset
+ */
+const reset_record_t& last_reset() {
+  return _last_reset;
+}
+
+/**
+ * Add a record to the reset log, dropping the oldest if the log is full.
+ */
+void append_reset_log(reset_record_t& record) {
+  if (!is_filesystem_safe()) {
+    return;
+  }
+  reset_record_t records[RESET_LOG_RECORDS];
+  size_t         count = 0;
+  File           log   = LittleFS.open(RESET_LOG_FILE, "r");
+  if (log) {
+    count = log.read((uint8_t*)records, sizeof(records)) / sizeof(reset_record_t);
+    log.close();
+  }
+
+  record.sequence = (count > 0 ? records[count - 1].sequence + 1 : 1);
+  if (count == RESET_LOG_RECORDS) {
+    memmove(&records[0], &records[1], (count - 1) * sizeof(reset_record_t));
+    count--;
+  }
+  records[count++] = record;
+
+  log = LittleFS.open(RESET_LOG_FILE, "w");
+  if (log) {
+    log.write((const uint8_t*)records, count * sizeof(reset_record_t));
+    log.close();
+  }
+}
+
+/**
+ * Find out why the Pico started, print what the breadcrumb says about the
+ * previous run and add it to the reset log. Call once early in setup(), after
+ * the file system is mounted.
+ */
+void report_reset() {
+  reset_record_t& record = _last_reset;
+  memset(&record, 0, sizeof(record));
+  record.stage      = BREADCRUMB_IDLE;
+  record.last_stage = BREADCRUMB_IDLE;
+
+  if (watchdog_enable_caused_reboot()) {
+    record.cause = RESET_WATCHDOG;
+  } else if (watchdog_caused_reboot()) {
+    record.cause = RESET_REBOOT;
+  } else {
+    record.cause = RESET_POWER_ON;
+  }
+
+  uint32_t crumb = watchdog_hw->scratch[0];
+  if (record.cause != RESET_POWER_ON && (crumb >> 24) == BREADCRUMB_MAGIC) {
+    record.stage         = (crumb >> 16) & 0xff;
+    record.last_stage    = (crumb >> 8) & 0xff;
+    record.uptime        = watchdog_hw->scratch[1];
+    record.heap_free     = (watchdog_hw->scratch[2] >> 16) << 4;
+    record.largest_block = (watchdog_hw->scratch[2] & 0xffff) << 4;
+    record.last_duration = watchdog_hw->scratch[3];
+  }
+
+  watchdog_hw->scratch[0] = ((uint32_t)BREADCRUMB_MAGIC << 24) | (BREADCRUMB_IDLE << 16) | (BREADCRUMB_IDLE << 8);
+  watchdog_hw->scratch[1] = 0;
+  watchdog_hw->scratch[2] = 0;
+  watchdog_hw->scratch[3] = 0;
+
+  Serial.print(F("Reset by "));
+  Serial.println(reset_causes[record.cause]);
+  if (record.cause == RESET_POWER_ON) {
+    return;
+  }
+  Serial.print(F("Running: "));
+  Serial.print(profile_stage_name(record.stage));
+  Serial.print(F(" after "));
+  Serial.print(record.uptime);
+  Serial.println(F(" s"));
+  Serial.print(F("Last finished: "));
+  Serial.print(profile_stage_name(record.last_stage));
+  Serial.print(F(" in "));
+  Serial.print(record.last_duration);
+  Serial.println(F(" us"));
+  // Both are 0 until the first memory sample of the run was taken.
+  if (record.heap_free > 0) {
+    Serial.print(F("Heap free: "));
+    Serial.print(record.heap_free);
+    if (record.largest_block > 0) {
+      Serial.print(F(", largest block: "));
+      Serial.print(record.largest_block);
+    }
+    Serial.println();
+  }
+
+  append_reset_log(record);
+}
@@ -0,0 +1,33 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "checksum.h"
+
+#include <Arduino.h>
+
+// CRC-32 (IEEE 802.3) a nibble at a time, small enough to keep in flash.
+const uint32_t crc32_nibbles[16] PROGMEM = {0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4,
+                                            0x4db26158, 0x5005713c, 0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+                                            0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c};
+
+/**
+ * Calculate the CRC-32 of a block of memory, the same CRC as zlib and Python's
+ * zlib.crc32() use.
+ *
+ * \param data the data to checksum
+ * \param length number of bytes
+ * \param crc the CRC of the data before this block, to checksum in parts
+ * \return the CRC of everything so far
+ */
+uint32_t crc32(const void* data, size_t length, uint32_t crc) {
+  const uint8_t* bytes = (const uint8_t*)data;
+  crc                  = ~crc;
+  while (length-- > 0) {
+    crc ^= *bytes++;
+    crc = (crc >> 4) ^ crc32_nibbles[crc & 0x0f];
+    crc = (crc >> 4) ^ crc32_nibbles[crc & 0x0f];
+  }
+  return ~crc;
+}
@@ -15,8 +15,15 @@
 #include "configuration.h"
 #include "configuration_types.h"
 #include "forecast.h"
+#include "format.h"
+#include "logging.h"
+#include "profile.h"
 #include "ruuvi.h"
 #include "ruuvi_types.h"
+#include "warm_state_types.h"
+#include "widgets.h"
+#include "zone_types.h"
+#include "zones.h"
 
 float    pressure_trend_data[2] = {0.0f, 0.0f};
 int32_t  _pressure_trend        = 0;
@@ -25,7 +32,7 @@ uint32_t _average_pressure      = 0;
 float    _average_temperature   = 0;
 float    pressure_readings[18];
 
-float _average_temperatures[2] = {0.0f, 0.0f};
+zone_aggregate_t _zone_aggregates[ZONE_MAX];
 
 void log_pressure_reading(float new_last_element) {
   for (uint8_t i = 0; i < sizeof(pressure_readings) / sizeof(float) - 1; i++) {
@@ -41,22 +48,31 @@ float get_pressure_trend() {
 }
 
 void process_pressure() {
+  PROFILE_STAGE(PROFILE_PROCESS_PRESSURE);
   if (!configured()) {
     return;
   }
   Config configuration = get_config();
   float  timediff      = difftime(time(nullptr), last_pressure);
 
-  if ((timediff >= 10800.0f) ||
-      ((timediff >= 60.0f) &&
-       ((pressure_trend_data[0] == 0.0) || (pressure_trend_data[1] == 0.0)))) {
+  if (timediff >= 21600.0f) {
+    // The samples are too old to make a trend with, most likely restored after
+    // a long time without power. Start over.
+    pressure_trend_data[0] = 0.0f;
+    pressure_trend_data[1] = 0.0f;
+  }
+
+  // The first sample is taken as soon as there are readings, the ones after
+  // it a trend interval apart.
+  if ((timediff >= PRESSURE_TREND_INTERVAL) || (pressure_trend_data[1] == 0.0)) {
     uint8_t  number_of_readings = 0;
     uint32_t pressure_sum       = 0;
-    uint32_t temperature_sum    = 0;
-    for (uint8_t i = 0; i < configuration.ruuvi.count; i++) {
-      if (ruuvi_outdoor_sensor()[i]) {
-        pressure_sum += ruuvi_readings()[i].pressure;
-        temperature_sum += ruuvi_readings()[i].temperature;
+    float    temperature_sum    = 0.0f;
+    for (uint8_t i = 0; i < ruuvi_device_count(); i++) {
+      if (ruuvi_is_outdoor(i)) {
+        ruuvi_data_t reading = ruuvi_reading(i);
+        pressure_sum += reading.pressure;
+        temperature_sum += reading.temperature;
         number_of_readings++;
       }
     }
@@ -72,17 +88,27 @@ void process_pressure() {
                                                _average_temperature);
       pressure_trend_data[1] = pa_to_mb(_average_pressure);
 
-      Serial.print(F("Oldest pressure data: "));
-      Serial.println(pressure_trend_data[0]);
-      Serial.print(F("Newest pressure data: "));
-      Serial.println(pressure_trend_data[1]);
-      Serial.print(F("SLP: "));
-      Serial.println(slp);
+      LOG(LOG_PRESSURE_AVERAGE, pressure_trend_data[1], pressure_trend_data[0], slp);
       last_pressure = time(nullptr);
     }
   }
 }
 
+/**
+ * \return milliseconds until the next pressure sample is due, for the task
+ *         scheduler
+ */
+uint32_t pressure_sample_delay() {
+  if (pressure_trend_data[1] == 0.0) {
+    return 60000;
+  }
+  float timediff = difftime(time(nullptr), last_pressure);
+  if (timediff >= PRESSURE_TREND_INTERVAL - 1) {
+    return 1000;
+  }
+  return (PRESSURE_TREND_INTERVAL - (uint32_t)max(timediff, 0.0f)) * 1000;
+}
+
 int32_t average_pressure() {
   return _average_pressure;
 }
@@ -97,56 +123,155 @@ float pressure_trend() {
               : pressure_trend_data[1] - pressure_trend_data[0]);
 }
 
-void log_current_temperature(float temperature, bool location_outdoor = false) {
-  // EEPROM.update(0 + (location_outdoor * sizeof(float)), temperature);
-}
-
-void print_climate() {
-  U8G2    u8g2    = get_display();
-  uint8_t yoffset = 1;
-  u8g2.setFont(u8g2_font_helvR08_tf);
-  yoffset += u8g2.getMaxCharHeight();
-  float   temperature_readings[] = {0.0, 0.0};
-  float   humidity_readings[]    = {0.0, 0.0};
-  uint8_t number_of_readings[]   = {0, 0};
-
-  for (uint8_t i = 0; i < get_config().ruuvi.devices.size(); i++) {
-    if (ruuvi_outdoor_sensor()[i]) {
-      temperature_readings[1] += ruuvi_readings()[i].temperature;
-      humidity_readings[1] += ruuvi_readings()[i].humidity;
-      number_of_readings[1]++;
-    } else {
-      temperature_readings[0] += ruuvi_readings()[i].temperature;
-      humidity_readings[0] += ruuvi_readings()[i].humidity;
-      number_of_readings[0]++;
+/**
+ * Copy the pressure trend and averages into a snapshot.
+ */
+void save_climate_state(warm_state_t* state) {
+  state->last_pressure          = last_pressure;
+  state->pressure_trend_data[0] = pressure_trend_data[0];
+  state->pressure_trend_data[1] = pressure_trend_data[1];
+  state->average_pressure       = _average_pressure;
+  state->average_temperature    = _average_temperature;
+}
+
+/**
+ * Continue the pressure trend from a snapshot.
+ */
+void restore_climate_state(const warm_state_t* state) {
+  last_pressure          = state->last_pressure;
+  pressure_trend_data[0] = state->pressure_trend_data[0];
+  pressure_trend_data[1] = state->pressure_trend_data[1];
+  _average_pressure      = state->average_pressure;
+  _average_temperature   = state->average_temperature;
+}
+
+/**
+ * Average the latest readings of every zone in one pass over the sensors.
+ * Sensors that have not been heard from, and had nothing restored, are left
+ * out.
+ */
+void update_zone_aggregates() {
+  int32_t  temperature_sum[ZONE_MAX] = {0};
+  uint32_t humidity_sum[ZONE_MAX]    = {0};
+  uint8_t  sensors[ZONE_MAX]         = {0};
+  for (uint8_t i = 0; i < ruuvi_device_count(); i++) {
+    ruuvi_data_t reading = ruuvi_reading(i);
+    uint8_t      zone    = ruuvi_zone(i);
+    if (reading.pressure == 0 || zone >= ZONE_MAX) {
+      continue;
     }
+    temperature_sum[zone] += lroundf(reading.temperature * 100);
+    humidity_sum[zone] += lroundf(reading.humidity * 100);
+    sensors[zone]++;
+  }
+  for (uint8_t zone = 0; zone < ZONE_MAX; zone++) {
+    zone_aggregate_t& aggregate = _zone_aggregates[zone];
+    aggregate.sensors           = sensors[zone];
+    aggregate.temperature       = sensors[zone] > 0 ? temperature_sum[zone] / sensors[zone] : 0;
+    aggregate.humidity          = sensors[zone] > 0 ? humidity_sum[zone] / sensors[zone] : 0;
   }
+}
+
+/**
+ * \return the averages of a zone as of the last update_zone_aggregates()
+ */
+const zone_aggregate_t& zone_aggregate(uint8_t zone) {
+  return _zone_aggregates[zone < ZONE_MAX ? zone : 0];
+}
+
+/**
+ * Whether the zones are shown as a table instead of the two climate rows,
+ * which only have room for one indoor and one outdoor zone.
+ */
+bool climate_uses_table() {
+  uint8_t outdoor = 0;
+  for (uint8_t zone = 0; zone < zone_count(); zone++) {
+    outdoor += zone_is_outdoor(zone);
+  }
+  return outdoor > 1 || zone_count() - outdoor > 1;
+}
+
+/**
+ * \return the number of climate pages, one per WIDGET_ZONE_ROWS zones in the
+ *         table
+ */
+uint8_t climate_page_count() {
+  return climate_uses_table() ? (zone_count() + WIDGET_ZONE_ROWS - 1) / WIDGET_ZONE_ROWS : 1;
+}
+
+/**
+ * Show the averages of a zone in the temperature and humidity widgets of a
+ * row. Values are bound in tenths of a degree and whole percent, so text is
+ * only formatted when what is shown changes.
+ *
+ * \param zone the zone, nullptr to hide the values
+ */
+void print_climate_row(uint8_t row, const zone_aggregate_t* zone) {
+  bool shown = zone != nullptr && zone->sensors > 0;
+  widget_set_visible(row + 1, shown);
+  widget_set_visible(row + 2, shown);
+  if (!shown) {
+    return;
+  }
+  int32_t temperature_tenths = to_fixed(zone->temperature / 100.0f, 1);
+  if (widget_bind(row + 1, temperature_tenths)) {
+    char temperature_string[FORMAT_TEMPERATURE_SIZE];
+    format_temperature(temperature_string, sizeof(temperature_string), temperature_tenths);
+    widget_set_text(row + 1, temperature_string);
+  }
+  if (widget_bind(row + 2, zone->humidity / 100)) {
+    char humidity_string[FORMAT_PERCENT_SIZE];
+    format_percent(humidity_string, sizeof(humidity_string), zone->humidity / 100);
+    widget_set_text(row + 2, humidity_string);
+  }
+}
+
+/**
+ * Show average temperature and humidity per zone on the OLED. With one indoor
+ * and one outdoor zone they get a row each in large digits, indoor above
+ * outdoor. Otherwise the zones are listed by name in a table, WIDGET_ZONE_ROWS
+ * to a page, in the order they first appear in the configuration.
+ *
+ * \param page the climate page, from 0 to climate_page_count() - 1
+ */
+void print_climate(uint8_t page) {
+  PROFILE_STAGE(PROFILE_PRINT_CLIMATE);
+  update_zone_aggregates();
+  bool table = climate_uses_table();
 
   for (uint8_t i = 0; i < 2; i++) {
-    u8g2.setFont(font_segments_12x17);
-    yoffset += u8g2.getMaxCharHeight() + 2;
-    char    temperature_string[8];
-    char    humidity_string[6];
-    uint8_t xoffset = 0;
-    float   average_temperature =
-        temperature_readings[i] /
-        ((number_of_readings[i] > 0 ? number_of_readings[i] : 1) * 1.0f);
-    float average_humidity =
-        humidity_readings[i] /
-        ((number_of_readings[i] > 0 ? number_of_readings[i] : 1) * 1.0f);
-    sprintf(temperature_string, "%2.1f°C", average_temperature);
-    sprintf(humidity_string, "%3d%c", int(average_humidity), '%');
-
-    u8g2.setFont((i == 0 ? u8g2_font_open_iconic_embedded_2x_t
-                         : u8g2_font_open_iconic_thing_2x_t));
-    u8g2.drawGlyph(xoffset, yoffset, (i == 0 ? 68 : 76));
-    xoffset += u8g2.getMaxCharWidth() + 2;
-    u8g2.setFont(font_segments_12x17);
-    u8g2.drawUTF8(xoffset, yoffset, temperature_string);
-
-    u8g2.setFont(font_segments_12x17);
-    xoffset = u8g2.getUTF8Width(humidity_string);
-    u8g2.drawUTF8(u8g2.getDisplayWidth() - xoffset - 1, yoffset,
-                  humidity_string);
+    uint8_t                 row  = WIDGET_INDOOR_ICON + i * WIDGET_CLIMATE_ROW_SIZE;
+    const zone_aggregate_t* zone = nullptr;
+    for (uint8_t id = 0; id < zone_count() && !table; id++) {
+      if (zone_is_outdoor(id) == (i == 1)) {
+        zone = &_zone_aggregates[id];
+      }
+    }
+    widget_set_visible(row, zone != nullptr && zone->sensors > 0);
+    print_climate_row(row, zone);
+  }
+
+  for (uint8_t i = 0; i < WIDGET_ZONE_ROWS; i++) {
+    uint8_t row = WIDGET_ZONE_1_NAME + i * WIDGET_CLIMATE_ROW_SIZE;
+    uint8_t id  = page * WIDGET_ZONE_ROWS + i;
+    if (!table || id >= zone_count()) {
+      widget_set_visible(row, false);
+      print_climate_row(row, nullptr);
+      continue;
+    }
+    widget_set_text(row, zone_name(id));
+    print_climate_row(row, &_zone_aggregates[id]);
+  }
+}
+
+/**
+ * Hide the climate rows and the zone table, for the graph pages.
+ */
+void hide_climate() {
+  for (uint8_t id = WIDGET_INDOOR_ICON; id < WIDGET_INDOOR_ICON + 2 * WIDGET_CLIMATE_ROW_SIZE; id++) {
+    widget_set_visible(id, false);
+  }
+  for (uint8_t id = WIDGET_ZONE_1_NAME; id < WIDGET_ZONE_1_NAME + WIDGET_ZONE_ROWS * WIDGET_CLIMATE_ROW_SIZE; id++) {
+    widget_set_visible(id, false);
   }
 }
@@ -45,7 +45,7 @@ void load_config_file() {
   }
 }
 
-Config get_config() {
+const Config& get_config() {
   return _config;
 }
 
@@ -59,6 +59,11 @@ void load_configuration() {
   interrupts();
 
   if (error) {
+    if (!LittleFS.exists(json_config)) {
+      // The file system was formatted, after the first upload or a change of
+      // its size in platformio.ini.
+      Serial.println(F("No config.json, upload the file system image"));
+    }
     Serial.println(F("Failed to read file, using default configuration"));
     Serial.println(error.c_str());
     _configuration_loaded = false;
@@ -90,6 +95,15 @@ void load_configuration() {
   _config.location.tz_offset = location["tz_offset"];
   _config.location.elevation = location["elevation"];
 
+  JsonObject uplink    = doc["uplink"];
+  _config.uplink.host = uplink["host"] | "";
+  _config.uplink.port = uplink["port"] | 8080;
+  _config.uplink.path = uplink["path"] | "/readings";
+
+  JsonObject http     = doc["http"];
+  _config.http.port   = http["port"] | 0;
+  _config.http.listen = http["listen"] | 10;
+
   uint8_t device_number = 0;
   for (JsonObject ruuvi_device : doc["ruuvi"]["devices"].as<JsonArray>()) {
     ruuvi_device_t device;
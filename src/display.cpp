@@ -0,0 +1,282 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "display.h"
+
+#include <Arduino.h>
+#include <U8g2lib.h>
+#include <string.h>
+
+#include "common.h"
+#include "profile.h"
+
+#ifdef DISPLAY_DMA
+#  include <hardware/dma.h>
+#  include <hardware/i2c.h>
+#endif
+
+uint8_t  _shadow_buffer[DISPLAY_BUFFER_SIZE];
+bool     _display_full_refresh     = true;
+uint32_t _display_bytes_sent       = 0;
+uint32_t _display_bytes_per_second = 0;
+uint32_t _display_frame_time       = 0;
+uint32_t _display_frames_deferred  = 0;
+uint32_t _display_transfer_errors  = 0;
+uint32_t display_rate_timer        = 0;
+
+#ifdef DISPLAY_DMA
+// The frame being streamed to the display, as words for the I2C DATA_CMD
+// register. u8g2 keeps rendering into its own buffer meanwhile.
+uint16_t _display_stream[DISPLAY_STREAM_SIZE];
+uint16_t _display_stream_length = 0;
+int      _display_dma_channel   = -1;
+
+/**
+ * Check on the transfer running in the background. An aborted transfer, for
+ * instance when the display does not acknowledge, stops the DMA and makes the
+ * next update send the whole frame.
+ */
+uint8_t poll_transfer() {
+  if (_display_dma_channel < 0) {
+    return DISPLAY_TRANSFER_IDLE;
+  }
+  i2c_hw_t* hw = i2c_get_hw(DISPLAY_I2C);
+  if (hw->raw_intr_stat & I2C_IC_RAW_INTR_STAT_TX_ABRT_BITS) {
+    dma_channel_abort(_display_dma_channel);
+    (void)hw->clr_tx_abrt;
+    _display_transfer_errors++;
+    _display_full_refresh = true;
+    return DISPLAY_TRANSFER_ERROR;
+  }
+  if (dma_channel_is_busy(_display_dma_channel) || !(hw->status & I2C_IC_STATUS_TFE_BITS) ||
+      (hw->status & I2C_IC_STATUS_MST_ACTIVITY_BITS)) {
+    return DISPLAY_TRANSFER_BUSY;
+  }
+  return DISPLAY_TRANSFER_IDLE;
+}
+
+// Runs never outnumber half the tiles plus a run per tile row, so with rows of
+// 16 tiles a frame is at most the whole buffer and 72 runs.
+static_assert(DISPLAY_STREAM_SIZE >= DISPLAY_BUFFER_SIZE + 72 * DISPLAY_STREAM_RUN_OVERHEAD,
+              "The stream is too small for a frame of the shadow buffer");
+
+/**
+ * Add a run of tiles on one tile row to the stream: one I2C transfer setting
+ * column and page address, then one transfer with the tile data.
+ *
+ * \return the number of bytes queued, 0 if the run does not fit the stream
+ */
+uint32_t stream_run(U8G2& u8g2, uint8_t ty, uint8_t tx, uint8_t count, const uint8_t* data) {
+  uint16_t  length = count * DISPLAY_TILE_BYTES;
+  uint8_t   column = tx * DISPLAY_TILE_BYTES + u8g2.getU8x8()->x_offset;
+  uint16_t* out    = _display_stream + _display_stream_length;
+  if (_display_stream_length + length + DISPLAY_STREAM_RUN_OVERHEAD > DISPLAY_STREAM_SIZE) {
+    return 0;
+  }
+
+  *out++ = 0x00; // Control byte, commands follow
+  *out++ = 0x10 | (column >> 4);
+  *out++ = 0x00 | (column & 0x0f);
+  *out++ = (0xb0 | ty) | I2C_IC_DATA_CMD_STOP_BITS;
+  *out++ = 0x40; // Control byte, data follows
+  for (uint16_t i = 0; i < length; i++) {
+    *out++ = data[i];
+  }
+  *(out - 1) |= I2C_IC_DATA_CMD_STOP_BITS;
+
+  _display_stream_length = out - _display_stream;
+  return length + DISPLAY_STREAM_RUN_OVERHEAD;
+}
+
+/**
+ * Start streaming what has been collected for this frame.
+ */
+void start_transfer() {
+  i2c_hw_t* hw = i2c_get_hw(DISPLAY_I2C);
+  hw->enable   = 0;
+  hw->tar      = I2C_ADDRESS;
+  hw->enable   = 1;
+
+  dma_channel_config config = dma_channel_get_default_config(_display_dma_channel);
+  channel_config_set_transfer_data_size(&config, DMA_SIZE_16);
+  channel_config_set_read_increment(&config, true);
+  channel_config_set_write_increment(&config, false);
+  channel_config_set_dreq(&config, i2c_get_dreq(DISPLAY_I2C, true));
+  dma_channel_configure(_display_dma_channel, &config, &hw->data_cmd, _display_stream, _display_stream_length, true);
+}
+#endif
+
+/**
+ * Prepare the partial refresh state. Call once the display has been started
+ * with begin(), which also clears the panel.
+ */
+void display_begin() {
+  memset(_shadow_buffer, 0, sizeof(_shadow_buffer));
+  _display_full_refresh = true;
+  display_rate_timer    = millis();
+#ifdef DISPLAY_DMA
+  if (_display_dma_channel < 0) {
+    _display_dma_channel = dma_claim_unused_channel(false);
+  }
+#endif
+}
+
+/**
+ * Mark the whole panel as changed so the next update sends every tile.
+ */
+void display_invalidate() {
+  _display_full_refresh = true;
+}
+
+/**
+ * Send the parts of the frame buffer that changed since the last update to the
+ * display. Tiles are compared against a shadow copy of what the panel shows and
+ * adjacent changed tiles on the same tile row are sent as one area. Frames
+ * without changes are skipped entirely.
+ *
+ * With DMA the changed tiles are queued and sent in the background while the
+ * next frame is rendered. If the previous frame is still being sent the update
+ * is deferred, the changes stay in the frame buffer until the next update.
+ *
+ * \return true if anything was sent to the display
+ */
+bool display_update() {
+  PROFILE_STAGE(PROFILE_DISPLAY_UPDATE);
+  uint32_t start       = micros();
+  U8G2     u8g2        = get_display();
+  uint8_t* buffer      = u8g2.getBufferPtr();
+  uint8_t  tile_width  = u8g2.getBufferTileWidth();
+  uint8_t  tile_height = u8g2.getBufferTileHeight();
+  uint32_t bytes       = 0;
+  bool     use_dma     = false;
+
+#ifdef DISPLAY_DMA
+  use_dma = (_display_dma_channel >= 0);
+  if (use_dma && poll_transfer() == DISPLAY_TRANSFER_BUSY) {
+    _display_frames_deferred++;
+    _display_frame_time = micros() - start;
+    return false;
+  }
+  _display_stream_length = 0;
+#endif
+
+  if ((uint32_t)tile_width * tile_height * DISPLAY_TILE_BYTES > sizeof(_shadow_buffer)) {
+    // Larger displays than the shadow buffer can hold get a full refresh.
+    u8g2.sendBuffer();
+    bytes   = (uint32_t)tile_width * tile_height * DISPLAY_TILE_BYTES + tile_height * DISPLAY_AREA_OVERHEAD;
+    use_dma = false;
+  } else {
+    for (uint8_t ty = 0; ty < tile_height; ty++) {
+      int16_t run_start = -1;
+      for (uint8_t tx = 0; tx <= tile_width; tx++) {
+        bool dirty = false;
+        if (tx < tile_width) {
+          size_t   offset = ((size_t)ty * tile_width + tx) * DISPLAY_TILE_BYTES;
+          uint8_t* tile   = buffer + offset;
+          dirty           = _display_full_refresh || memcmp(tile, _shadow_buffer + offset, DISPLAY_TILE_BYTES);
+          if (dirty) {
+            memcpy(_shadow_buffer + offset, tile, DISPLAY_TILE_BYTES);
+            if (run_start < 0) {
+              run_start = tx;
+            }
+          }
+        }
+        if (!dirty && run_start >= 0) {
+          uint32_t queued = 0;
+#ifdef DISPLAY_DMA
+          if (use_dma) {
+            queued = stream_run(u8g2, ty, run_start, tx - run_start,
+                                _shadow_buffer + ((size_t)ty * tile_width + run_start) * DISPLAY_TILE_BYTES);
+            bytes += queued;
+          }
+#endif
+          if (queued == 0) {
+            // Without DMA, or when the stream is full. The bus is free, the
+            // stream is only started once the whole frame is collected.
+            u8g2.updateDisplayArea(run_start, ty, tx - run_start, 1);
+            bytes += (tx - run_start) * DISPLAY_TILE_BYTES + DISPLAY_AREA_OVERHEAD;
+          }
+          run_start = -1;
+        }
+      }
+    }
+  }
+  _display_full_refresh = false;
+  _display_bytes_sent += bytes;
+
+#ifdef DISPLAY_DMA
+  if (use_dma && _display_stream_length > 0) {
+    start_transfer();
+  }
+#endif
+
+  if ((millis() - display_rate_timer) >= 1000) {
+    _display_bytes_per_second = _display_bytes_sent * 1000 / (millis() - display_rate_timer);
+    _display_bytes_sent       = 0;
+    display_rate_timer        = millis();
+  }
+
+  _display_frame_time = micros() - start;
+  return bytes > 0;
+}
+
+/**
+ * Wait for the background transfer to finish. Needed before talking to the
+ * display directly, for instance to change contrast or power save mode.
+ *
+ * \param timeout longest time to wait, in milliseconds
+ * \return true if the display is free
+ */
+bool display_wait(uint32_t timeout) {
+#ifdef DISPLAY_DMA
+  uint32_t start = millis();
+  while (poll_transfer() == DISPLAY_TRANSFER_BUSY) {
+    if ((millis() - start) >= timeout) {
+      return false;
+    }
+  }
+#endif
+  return true;
+}
+
+/**
+ * Status of the transfer to the display, one of display_transfer.
+ */
+uint8_t display_transfer_status() {
+#ifdef DISPLAY_DMA
+  return poll_transfer();
+#else
+  return DISPLAY_TRANSFER_IDLE;
+#endif
+}
+
+/**
+ * Number of updates put off because the previous frame was still being sent.
+ */
+uint32_t display_frames_deferred() {
+  return _display_frames_deferred;
+}
+
+/**
+ * Number of transfers aborted by the I2C controller.
+ */
+uint32_t display_transfer_errors() {
+  return _display_transfer_errors;
+}
+
+/**
+ * Bytes sent to the display per second, averaged over the last second.
+ */
+uint32_t display_bytes_per_second() {
+  return _display_bytes_per_second;
+}
+
+/**
+ * Time spent preparing the last frame, in microseconds. With DMA this does not
+ * include the transfer itself, which runs in the background.
+ */
+uint32_t display_frame_time() {
+  return _display_frame_time;
+}
@@ -14,6 +14,8 @@
 #include "configuration.h"
 #include "forecast_types.h"
 #include "network_time.h"
+#include "profile.h"
+#include "widgets.h"
 
 const pressure_change_t change_slp[9] PROGMEM = {
     {6.0f, "Rising Very Rapidly", 4}, {3.6f, "Rising Quickly", 3},    {1.6f, "Rising", 2},
@@ -128,35 +130,20 @@ pressure_change_t current_trend(float change) {
 /**
  * Tell if it's currently summer.
  */
-bool summer() {
-  time_t    now = time(nullptr);
-  struct tm local;
-  localtime_r(&now, &local);
+bool summer(const time_context_t& now) {
   // Summer is may through october
-  if (local.tm_mon >= 4 && local.tm_mon <= 9) {
+  if (now.local.tm_mon >= 4 && now.local.tm_mon <= 9) {
     return true;
   }
   return false;
 }
 
-/**
- * Tell if it's currently daytime.
- */
-bool day() {
-  time_t    now = time(nullptr);
-  struct tm local, gmt;
-  localtime_r(&now, &local);
-  gmtime_r(&now, &gmt);
-  sun().setCurrentDate(gmt.tm_year + 1900, gmt.tm_mon + 1, gmt.tm_mday);
-  int sunrise = static_cast<int>(sun().calcSunrise());
-  int sunset  = static_cast<int>(sun().calcSunset());
-  return ((local.tm_hour * 60 + local.tm_min >= sunrise) && (local.tm_hour * 60 + local.tm_min < sunset));
-}
-
 /**
  * Get a forecast based on the Zambretti algorithm.
+ *
+ * \param now the time of the current tick, for the season
  */
-zambretti_forecast_t get_forecast() {
+zambretti_forecast_t get_forecast(const time_context_t& now) {
   Config configuration = get_config();
   int    z             = 1;
   int    trend         = current_trend(pressure_trend()).baro_trend;
@@ -166,11 +153,11 @@ zambretti_forecast_t get_forecast() {
   if (trend > 0) {
     // For a rising barometer Z = 179-P*0.16
     z = int(179 - (20 * pressure) / 129);
-    z -= summer(); // Subtract one if it's summer
+    z -= summer(now); // Subtract one if it's summer
   } else if (trend < 0) {
     // For a falling barometer Z = 130-P*0.12
     z = int(130 - (10 * pressure) / 81);
-    z -= !summer(); // Subtract one if it's winter
+    z -= !summer(now); // Subtract one if it's winter
   } else {
     // For a steady barometer Z = 147-P*0.13
     z = int(147 - (50 * pressure) / 376);
@@ -190,14 +177,13 @@ zambretti_forecast_t get_forecast() {
 /**
  * Print an icon representing the current forecast on the OLED. Displays as a
  * little icon between the wireless indicators and the sunrise/sunset times.
+ *
+ * \param now the time of the current tick
  */
-void print_forecast_icon() {
-  zambretti_forecast_t forecast = get_forecast();
-  U8G2                 u8g2     = get_display();
-
-  u8g2.setFont(u8g2_font_waffle_t_all);
-  u8g2.drawGlyph(u8g2.getDisplayWidth() - (2 * u8g2.getMaxCharWidth()) - 1, u8g2.getDisplayHeight() - 1,
-                 forecast_icon(forecast.forecast, day()));
+void print_forecast_icon(const time_context_t& now) {
+  PROFILE_STAGE(PROFILE_PRINT_FORECAST_ICON);
+  zambretti_forecast_t forecast = get_forecast(now);
+  widget_set_glyph(WIDGET_FORECAST, forecast_icon(forecast.forecast, daytime(now)));
 }
 
 /**
@@ -0,0 +1,204 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "format.h"
+
+#include <Arduino.h>
+#include <time.h>
+
+#ifdef HEM_LOCALE_EN
+const char* weekdays[7] PROGMEM = {"Sunday", "Monday", "Tuesday", "Wednesday", "Thursday", "Friday", "Saturday"};
+const char* months[12] PROGMEM  = {"jan", "feb", "mar", "apr", "may", "jun", "jul", "aug", "sep", "oct", "nov", "dec"};
+#else
+const char* weekdays[7] PROGMEM = {"Söndag", "Måndag", "Tisdag", "Onsdag", "Torsdag", "Fredag", "Lördag"};
+const char* months[12] PROGMEM  = {"jan", "feb", "mar", "apr", "maj", "jun", "jul", "aug", "sep", "okt", "nov", "dec"};
+#endif
+
+const int32_t powers_of_ten[] = {1, 10, 100, 1000, 10000, 100000};
+
+/**
+ * Append text to a buffer without ever writing past its end. All the format
+ * functions below always leave the buffer terminated.
+ *
+ * \param buffer the buffer to write to
+ * \param size total size of the buffer
+ * \param length length of what is already in the buffer
+ * \param text the text to append
+ * \return the new length of the string in the buffer
+ */
+size_t format_append(char* buffer, size_t size, size_t length, const char* text) {
+  if (size == 0) {
+    return 0;
+  }
+  while (*text && length < size - 1) {
+    buffer[length++] = *text++;
+  }
+  buffer[length] = '\0';
+  return length;
+}
+
+/**
+ * Append a single character, same rules as format_append().
+ */
+size_t append_char(char* buffer, size_t size, size_t length, char c) {
+  if (length + 1 < size) {
+    buffer[length++] = c;
+    buffer[length]   = '\0';
+  }
+  return length;
+}
+
+/**
+ * Write the digits of a number, optionally padded to a width.
+ */
+size_t append_uint(char* buffer, size_t size, size_t length, uint32_t value, uint8_t width, char pad) {
+  char    digits[10];
+  uint8_t count = 0;
+  do {
+    digits[count++] = '0' + (value % 10);
+    value /= 10;
+  } while (value > 0);
+
+  while (width-- > count) {
+    length = append_char(buffer, size, length, pad);
+  }
+  while (count > 0) {
+    length = append_char(buffer, size, length, digits[--count]);
+  }
+  return length;
+}
+
+/**
+ * Format an integer, like "%*d" but without printf.
+ *
+ * \param width minimum width including the sign
+ * \param pad character to pad with, ' ' or '0'
+ */
+size_t format_int(char* buffer, size_t size, int32_t value, uint8_t width, char pad) {
+  size_t   length    = format_append(buffer, size, 0, "");
+  uint32_t magnitude = (value < 0 ? -(uint32_t)value : value);
+  if (value < 0) {
+    if (pad == '0') {
+      length = append_char(buffer, size, length, '-');
+    } else {
+      // The sign goes after space padding, "  -5" rather than "-  5".
+      uint32_t digits = 1;
+      for (uint32_t rest = magnitude / 10; rest > 0; rest /= 10) {
+        digits++;
+      }
+      while (width > digits + 1) {
+        length = append_char(buffer, size, length, ' ');
+        width--;
+      }
+      length = append_char(buffer, size, length, '-');
+    }
+    width = (width > 0 ? width - 1 : 0);
+  }
+  return append_uint(buffer, size, length, magnitude, width, pad);
+}
+
+/**
+ * Format a fixed point number.
+ *
+ * \param value the number multiplied by 10^decimals, -105 for -10.5
+ * \param decimals number of decimals in value, at most 5
+ */
+size_t format_fixed(char* buffer, size_t size, int32_t value, uint8_t decimals) {
+  if (decimals > 5) {
+    decimals = 5;
+  }
+  uint32_t magnitude = (value < 0 ? -(uint32_t)value : value);
+  size_t   length    = format_append(buffer, size, 0, (value < 0 ? "-" : ""));
+  length             = append_uint(buffer, size, length, magnitude / powers_of_ten[decimals], 0, '0');
+  if (decimals > 0) {
+    length = append_char(buffer, size, length, '.');
+    length = append_uint(buffer, size, length, magnitude % powers_of_ten[decimals], decimals, '0');
+  }
+  return length;
+}
+
+/**
+ * Format a temperature for the display, "-10.5°C".
+ *
+ * \param tenths the temperature in tenths of a degree Celsius
+ */
+size_t format_temperature(char* buffer, size_t size, int32_t tenths) {
+  size_t length = format_fixed(buffer, size, tenths, 1);
+  return format_append(buffer, size, length, FORMAT_DEGREE "C");
+}
+
+/**
+ * Format a percentage for the display, padded to three digits like " 45%".
+ */
+size_t format_percent(char* buffer, size_t size, int32_t percent) {
+  size_t length = format_int(buffer, size, percent, 3);
+  return format_append(buffer, size, length, "%");
+}
+
+/**
+ * Format a time of day, "07:05".
+ */
+size_t format_clock(char* buffer, size_t size, int hour, int minute) {
+  size_t length = format_int(buffer, size, hour, 2, '0');
+  length        = append_char(buffer, size, length, ':');
+  return append_uint(buffer, size, length, minute, 2, '0');
+}
+
+/**
+ * Format a date with localized names, "Lördag 7 okt 2023".
+ */
+size_t format_date(char* buffer, size_t size, const struct tm* date) {
+  size_t length = format_append(buffer, size, 0, weekday_name(date->tm_wday));
+  length        = append_char(buffer, size, length, ' ');
+  length        = append_uint(buffer, size, length, date->tm_mday, 0, '0');
+  length        = append_char(buffer, size, length, ' ');
+  length        = format_append(buffer, size, length, month_name(date->tm_mon));
+  length        = append_char(buffer, size, length, ' ');
+  return append_uint(buffer, size, length, date->tm_year + 1900, 4, ' ');
+}
+
+/**
+ * Convert a floating point value to fixed point, rounding to nearest.
+ */
+int32_t to_fixed(float value, uint8_t decimals) {
+  return lroundf(value * powers_of_ten[decimals > 5 ? 5 : decimals]);
+}
+
+const char* weekday_name(uint8_t weekday) {
+  return weekdays[weekday % 7];
+}
+
+const char* month_name(uint8_t month) {
+  return months[month % 12];
+}
+
+#ifdef HEM_BENCHMARK
+/**
+ * Compare formatting a temperature with sprintf and with format_temperature().
+ * Build with -DHEM_BENCHMARK and watch the serial output.
+ */
+void benchmark_format() {
+  char     buffer[FORMAT_TEMPERATURE_SIZE];
+  float    value  = -10.5f;
+  uint32_t rounds = 100;
+
+  uint32_t start = rp2040.getCycleCount();
+  for (uint32_t i = 0; i < rounds; i++) {
+    snprintf(buffer, sizeof(buffer), "%2.1f°C", value);
+  }
+  uint32_t sprintf_cycles = (rp2040.getCycleCount() - start) / rounds;
+
+  start = rp2040.getCycleCount();
+  for (uint32_t i = 0; i < rounds; i++) {
+    format_temperature(buffer, sizeof(buffer), to_fixed(value, 1));
+  }
+  uint32_t format_cycles = (rp2040.getCycleCount() - start) / rounds;
+
+  Serial.print(F("snprintf cycles per call: "));
+  Serial.println(sprintf_cycles);
+  Serial.print(F("format_temperature cycles per call: "));
+  Serial.println(format_cycles);
+}
+#endif
@@ -0,0 +1,387 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "history.h"
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <math.h>
+#include <pico/time.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "checksum.h"
+#include "common.h"
+#include "history_types.h"
+#include "logging.h"
+#include "ruuvi_types.h"
+
+static_assert(sizeof(history_segment_t) == HISTORY_SEGMENT_SIZE, "a segment must fill an erase block");
+
+// Sealed segments on flash, oldest first. The open segment is not included,
+// so together with it there are at most HISTORY_SEGMENTS files. At boot the
+// index holds every file, the newest one is taken out again if it is
+// continued.
+uint32_t _history_sequences[HISTORY_SEGMENTS];
+uint16_t _history_counts[HISTORY_SEGMENTS];
+uint8_t  _history_sealed = 0;
+
+// The segment being filled. Its file, if any, has the first _history_written
+// records.
+history_segment_t _history_open;
+uint16_t          _history_written    = 0;
+uint32_t          _history_written_at = 0;
+bool              _history_ready      = false;
+
+// Records are staged by the Bluetooth callback and moved into the open
+// segment by the history task, with interrupts off.
+history_record_t _history_staging[HISTORY_STAGING];
+volatile uint8_t _history_staged_head  = 0;
+volatile uint8_t _history_staged_count = 0;
+
+history_stats_t _history_stats = {0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+// Sealed segment kept open for reading, 0 if none.
+File     _history_reader;
+uint32_t _history_reader_sequence = 0;
+
+void history_segment_name(char* name, size_t size, uint32_t sequence) {
+  snprintf(name, size, HISTORY_DIRECTORY "/%08lx", (unsigned long)sequence);
+}
+
+/**
+ * CRC of a segment, over its header up to the CRC and its records.
+ */
+uint32_t history_segment_crc(const history_segment_t* segment) {
+  uint32_t crc = crc32(&segment->header, offsetof(history_segment_header_t, crc));
+  return crc32(segment->records, segment->header.count * sizeof(history_record_t), crc);
+}
+
+/**
+ * Read a segment file and check that it is whole.
+ *
+ * \return true if the segment is of the current version, as long as its
+ *         header says and its CRC matches
+ */
+bool history_load(uint32_t sequence, history_segment_t* segment) {
+  char name[32];
+  history_segment_name(name, sizeof(name), sequence);
+  File file = LittleFS.open(name, "r");
+  if (!file) {
+    return false;
+  }
+  size_t length = file.read((uint8_t*)segment, sizeof(history_segment_t));
+  file.close();
+  const history_segment_header_t& header = segment->header;
+  return (length >= sizeof(header) && header.magic == HISTORY_MAGIC && header.version == HISTORY_VERSION &&
+          header.sequence == sequence && header.count <= HISTORY_SEGMENT_RECORDS &&
+          length == sizeof(header) + header.count * sizeof(history_record_t) &&
+          header.crc == history_segment_crc(segment));
+}
+
+void history_remove(uint32_t sequence) {
+  if (_history_reader_sequence == sequence) {
+    _history_reader.close();
+    _history_reader_sequence = 0;
+  }
+  char name[32];
+  history_segment_name(name, sizeof(name), sequence);
+  LittleFS.remove(name);
+}
+
+/**
+ * Add a sealed segment to the index, removing the oldest segment if that
+ * makes too many.
+ */
+void history_index_add(uint32_t sequence, uint16_t count) {
+  uint8_t at = _history_sealed;
+  while (at > 0 && _history_sequences[at - 1] > sequence) {
+    at--;
+  }
+  if (_history_sealed == HISTORY_SEGMENTS) {
+    if (at == 0) {
+      // Older than everything kept.
+      history_remove(sequence);
+      return;
+    }
+    history_remove(_history_sequences[0]);
+    memmove(&_history_sequences[0], &_history_sequences[1], (at - 1) * sizeof(uint32_t));
+    memmove(&_history_counts[0], &_history_counts[1], (at - 1) * sizeof(uint16_t));
+    at--;
+  } else {
+    memmove(&_history_sequences[at + 1], &_history_sequences[at], (_history_sealed - at) * sizeof(uint32_t));
+    memmove(&_history_counts[at + 1], &_history_counts[at], (_history_sealed - at) * sizeof(uint16_t));
+    _history_sealed++;
+  }
+  _history_sequences[at] = sequence;
+  _history_counts[at]    = count;
+}
+
+/**
+ * Remove the oldest sealed segments until there is room for the open one.
+ */
+void history_trim() {
+  if (_history_sealed < HISTORY_SEGMENTS) {
+    return;
+  }
+  uint8_t excess = _history_sealed - (HISTORY_SEGMENTS - 1);
+  for (uint8_t i = 0; i < excess; i++) {
+    history_remove(_history_sequences[i]);
+  }
+  _history_sealed -= excess;
+  memmove(&_history_sequences[0], &_history_sequences[excess], _history_sealed * sizeof(uint32_t));
+  memmove(&_history_counts[0], &_history_counts[excess], _history_sealed * sizeof(uint16_t));
+}
+
+void history_start_segment(uint32_t sequence) {
+  memset((void*)&_history_open, 0, sizeof(_history_open));
+  _history_open.header.magic    = HISTORY_MAGIC;
+  _history_open.header.version  = HISTORY_VERSION;
+  _history_open.header.sequence = sequence;
+  _history_written              = 0;
+}
+
+/**
+ * Find the segments on flash, removing any that are damaged or too old, and
+ * continue the newest if it has room. A segment is replaced as a whole when it
+ * is written and LittleFS only commits a file once all of it is on flash, so a
+ * power cut leaves the previous version of the segment. The CRC catches
+ * anything else. Call once at boot, after the file system is mounted.
+ */
+void history_begin() {
+  LittleFS.mkdir(HISTORY_DIRECTORY);
+  uint8_t removed = 0;
+  Dir     dir     = LittleFS.openDir(HISTORY_DIRECTORY);
+  while (dir.next()) {
+    char*    end;
+    String   file     = dir.fileName();
+    uint32_t sequence = strtoul(file.c_str(), &end, 16);
+    if (*end == '\0' && sequence > 0 && history_load(sequence, &_history_open)) {
+      history_index_add(sequence, _history_open.header.count);
+    } else {
+      char name[64];
+      snprintf(name, sizeof(name), HISTORY_DIRECTORY "/%s", file.c_str());
+      LittleFS.remove(name);
+      removed++;
+    }
+  }
+
+  uint32_t newest = (_history_sealed > 0 ? _history_sequences[_history_sealed - 1] : 0);
+  if (_history_sealed > 0 && _history_counts[_history_sealed - 1] < HISTORY_SEGMENT_RECORDS &&
+      history_load(newest, &_history_open)) {
+    _history_sealed--;
+    _history_written = _history_open.header.count;
+  } else {
+    history_trim();
+    history_start_segment(newest + 1);
+  }
+  _history_written_at = millis();
+  _history_ready      = true;
+
+  Serial.print(F("History: "));
+  Serial.print(history_count());
+  Serial.print(F(" records in "));
+  Serial.print(_history_sealed + (_history_written > 0 ? 1 : 0));
+  Serial.print(F(" segments"));
+  if (removed > 0) {
+    Serial.print(F(", removed "));
+    Serial.print(removed);
+    Serial.print(F(" damaged"));
+  }
+  Serial.println();
+}
+
+/**
+ * Stage a reading to be logged. Called from the Bluetooth callback, the
+ * history task does the writing.
+ *
+ * \param device index of the device in the configuration
+ * \param reading the reading
+ * \param time when the reading was taken
+ */
+void history_log_reading(uint8_t device, const ruuvi_data_t& reading, time_t time) {
+  history_record_t record;
+  record.time        = time;
+  record.temperature = lroundf(reading.temperature * 100);
+  record.humidity    = lroundf(reading.humidity * 100);
+  record.pressure    = constrain((int32_t)reading.pressure - HISTORY_PRESSURE_BASE, 0, 0xffff);
+  record.device      = device;
+  record.reserved    = 0;
+
+  noInterrupts();
+  if (_history_staged_count < HISTORY_STAGING) {
+    _history_staging[(_history_staged_head + _history_staged_count) % HISTORY_STAGING] = record;
+    _history_staged_count++;
+  } else {
+    _history_stats.dropped++;
+  }
+  interrupts();
+}
+
+bool history_unstage(history_record_t* record) {
+  noInterrupts();
+  bool staged = (_history_staged_count > 0);
+  if (staged) {
+    *record              = _history_staging[_history_staged_head];
+    _history_staged_head = (_history_staged_head + 1) % HISTORY_STAGING;
+    _history_staged_count--;
+  }
+  interrupts();
+  return staged;
+}
+
+/**
+ * Write the open segment to its file, replacing what was written before.
+ *
+ * LittleFS writes a changed file to fresh blocks and then commits the new
+ * location to the directory, so a write programs the file rounded up to whole
+ * pages plus about a page of metadata. That estimate is what flash_bytes
+ * counts. Appending would cost the same, LittleFS copies a partly filled last
+ * block before it appends to it.
+ *
+ * \return true if the segment was written
+ */
+bool history_write_open() {
+  history_segment_header_t& header = _history_open.header;
+  header.crc                       = history_segment_crc(&_history_open);
+  size_t length                    = sizeof(header) + header.count * sizeof(history_record_t);
+
+  char name[32];
+  history_segment_name(name, sizeof(name), header.sequence);
+  uint32_t started = time_us_32();
+  File     file    = LittleFS.open(name, "w");
+  size_t   written = 0;
+  if (file) {
+    written = file.write((const uint8_t*)&_history_open, length);
+    file.close();
+  }
+  uint32_t duration   = time_us_32() - started;
+  _history_written_at = millis();
+  if (written != length) {
+    _history_stats.failures++;
+    return false;
+  }
+
+  _history_stats.writes++;
+  _history_stats.payload_bytes += (header.count - _history_written) * sizeof(history_record_t);
+  _history_stats.flash_bytes += (length + HISTORY_FLASH_PAGE - 1) / HISTORY_FLASH_PAGE * HISTORY_FLASH_PAGE;
+  _history_stats.flash_bytes += HISTORY_FLASH_PAGE;
+  _history_stats.last_duration = duration;
+  _history_stats.max_duration  = max(_history_stats.max_duration, duration);
+  _history_written             = header.count;
+
+  LOG(LOG_HISTORY_WRITE, header.sequence, header.count, duration,
+      (float)_history_stats.flash_bytes / _history_stats.payload_bytes, history_lifetime_years());
+  return true;
+}
+
+/**
+ * Write the full open segment and start the next one. A segment that could not
+ * be written is lost, the failure is counted.
+ */
+void history_seal() {
+  uint32_t sequence = _history_open.header.sequence;
+  if (history_write_open()) {
+    _history_stats.sealed++;
+    history_index_add(sequence, _history_open.header.count);
+    history_trim();
+  }
+  history_start_segment(sequence + 1);
+}
+
+/**
+ * Move staged records into the open segment. Full segments are written right
+ * away, a partly filled one once its oldest unwritten record has waited
+ * HISTORY_CHECKPOINT_INTERVAL. Run every minute by the task scheduler. While
+ * the file system is shared over USB, records stay staged.
+ */
+void history_service() {
+  if (!_history_ready || !is_filesystem_safe()) {
+    return;
+  }
+  history_record_t record;
+  while (history_unstage(&record)) {
+    if (_history_written == _history_open.header.count) {
+      // Nothing waiting to be written, the checkpoint interval starts now.
+      _history_written_at = millis();
+    }
+    _history_open.records[_history_open.header.count++] = record;
+    _history_stats.records++;
+    if (_history_open.header.count == HISTORY_SEGMENT_RECORDS) {
+      history_seal();
+    }
+  }
+  if (_history_open.header.count > _history_written && millis() - _history_written_at >= HISTORY_CHECKPOINT_INTERVAL) {
+    history_write_open();
+  }
+}
+
+/**
+ * \return the records in the log, written or not
+ */
+uint32_t history_count() {
+  uint32_t count = _history_open.header.count;
+  for (uint8_t i = 0; i < _history_sealed; i++) {
+    count += _history_counts[i];
+  }
+  return count;
+}
+
+/**
+ * Read a record of the log. Reading in order is cheap, the segment being read
+ * is kept open.
+ *
+ * \param index 0 for the oldest record
+ * \param record set to the record
+ * \return false if there are fewer records
+ */
+bool history_read(uint32_t index, history_record_t* record) {
+  for (uint8_t i = 0; i < _history_sealed; i++) {
+    if (index >= _history_counts[i]) {
+      index -= _history_counts[i];
+      continue;
+    }
+    if (_history_reader_sequence != _history_sequences[i]) {
+      char name[32];
+      history_segment_name(name, sizeof(name), _history_sequences[i]);
+      _history_reader.close();
+      _history_reader          = LittleFS.open(name, "r");
+      _history_reader_sequence = _history_sequences[i];
+    }
+    uint32_t offset = sizeof(history_segment_header_t) + index * sizeof(history_record_t);
+    return (_history_reader && _history_reader.seek(offset) &&
+            _history_reader.read((uint8_t*)record, sizeof(history_record_t)) == sizeof(history_record_t));
+  }
+  if (index >= _history_open.header.count) {
+    return false;
+  }
+  *record = _history_open.records[index];
+  return true;
+}
+
+const history_stats_t* history_stats() {
+  return &_history_stats;
+}
+
+/**
+ * Project how long the flash lasts if the history keeps being written at the
+ * rate since boot. LittleFS spreads its writes over the blocks that are free
+ * or hold the history, and every block written has to be erased first.
+ *
+ * \return years until those blocks reach HISTORY_FLASH_ENDURANCE erases, 0
+ *         before the first hour of writes
+ */
+uint32_t history_lifetime_years() {
+  uint32_t uptime = millis() / 1000;
+  FSInfo   info;
+  if (_history_stats.flash_bytes == 0 || uptime < 3600 || !LittleFS.info(info)) {
+    return 0;
+  }
+  float wear_bytes = (float)(info.totalBytes - info.usedBytes) + (_history_sealed + 1) * HISTORY_SEGMENT_SIZE;
+  float per_day    = _history_stats.flash_bytes * 86400.0f / uptime;
+  return lroundf(HISTORY_FLASH_ENDURANCE * wear_bytes / per_day / 365);
+}
@@ -0,0 +1,290 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "http_server.h"
+
+#include <Arduino.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "climate.h"
+#include "configuration.h"
+#include "configuration_types.h"
+#include "forecast.h"
+#include "memory_stats.h"
+#include "query.h"
+#include "query_types.h"
+#include "ruuvi.h"
+#include "ruuvi_types.h"
+#include "timekeeping.h"
+#include "uplink.h"
+#include "wireless.h"
+#include "zone_types.h"
+#include "zones.h"
+
+// The responses of the HTTP server, printed to any Print, apart from the
+// sockets so they can be tested on the host.
+
+/**
+ * Print a string with the quotes and backslashes escaped, which works for both
+ * JSON strings and Prometheus label values.
+ */
+void http_print_escaped(Print& out, const char* text) {
+  for (; *text != '\0'; text++) {
+    if (*text == '"' || *text == '\\') {
+      out.write('\\');
+    }
+    out.write(*text);
+  }
+}
+
+/**
+ * Print the labels of a sensor, {sensor="name",placement="indoor"}.
+ */
+void http_print_sensor_labels(Print& out, const ruuvi_device_t& device) {
+  out.print(F("{sensor=\""));
+  http_print_escaped(out, device.name.c_str());
+  out.print(F("\",placement=\""));
+  http_print_escaped(out, device.placement.c_str());
+  out.print(F("\"} "));
+}
+
+/**
+ * Print one Prometheus sample for every sensor that has a reading.
+ */
+void http_print_sensor_metric(Print& out, const __FlashStringHelper* name, const __FlashStringHelper* help,
+                              uint8_t field) {
+  const Config& config = get_config();
+  out.print(F("# HELP "));
+  out.print(name);
+  out.print(' ');
+  out.println(help);
+  out.print(F("# TYPE "));
+  out.print(name);
+  out.println(F(" gauge"));
+  for (uint8_t i = 0; i < ruuvi_device_count() && i < config.ruuvi.devices.size(); i++) {
+    ruuvi_data_t reading = ruuvi_reading(i);
+    if (reading.pressure == 0) {
+      continue;
+    }
+    out.print(name);
+    http_print_sensor_labels(out, config.ruuvi.devices[i]);
+    switch (field) {
+      case 0:
+        out.println(reading.temperature, 2);
+        break;
+      case 1:
+        out.println(reading.humidity, 2);
+        break;
+      case 2:
+        out.println(reading.pressure);
+        break;
+      default:
+        out.println((int32_t)(time_context().utc - ruuvi_reading_time(i)));
+        break;
+    }
+  }
+}
+
+/**
+ * Print a metric with a single sample.
+ */
+void http_print_metric(Print& out, const __FlashStringHelper* name, const __FlashStringHelper* type, int64_t value) {
+  out.print(F("# TYPE "));
+  out.print(name);
+  out.print(' ');
+  out.println(type);
+  out.print(name);
+  out.print(' ');
+  out.println((long long)value);
+}
+
+/**
+ * Write the current readings, zone averages, forecast and counters in the
+ * Prometheus text format. Everything is printed straight from where it is
+ * kept, nothing is built up in memory first.
+ */
+void http_write_metrics(Print& out) {
+  http_print_sensor_metric(out, F("hem_temperature_celsius"), F("Latest temperature of the sensor."), 0);
+  http_print_sensor_metric(out, F("hem_humidity_percent"), F("Latest relative humidity of the sensor."), 1);
+  http_print_sensor_metric(out, F("hem_pressure_pascals"), F("Latest air pressure of the sensor."), 2);
+  http_print_sensor_metric(out, F("hem_reading_age_seconds"), F("Seconds since the sensor was logged."), 3);
+
+  out.println(F("# TYPE hem_zone_temperature_celsius gauge"));
+  out.println(F("# TYPE hem_zone_humidity_percent gauge"));
+  update_zone_aggregates();
+  for (uint8_t zone = 0; zone < zone_count(); zone++) {
+    const zone_aggregate_t& aggregate = zone_aggregate(zone);
+    if (aggregate.sensors == 0) {
+      continue;
+    }
+    out.print(F("hem_zone_temperature_celsius{zone=\""));
+    http_print_escaped(out, zone_name(zone));
+    out.print(F("\"} "));
+    out.println(aggregate.temperature / 100.0f, 2);
+    out.print(F("hem_zone_humidity_percent{zone=\""));
+    http_print_escaped(out, zone_name(zone));
+    out.print(F("\"} "));
+    out.println(aggregate.humidity / 100.0f, 2);
+  }
+
+  out.println(F("# TYPE hem_pressure_trend gauge"));
+  out.print(F("hem_pressure_trend "));
+  out.println(pressure_trend(), 2);
+  if (average_pressure() > 0) {
+    zambretti_forecast_t forecast = get_forecast(time_context());
+    out.println(F("# TYPE hem_forecast_info gauge"));
+    out.print(F("hem_forecast_info{code=\""));
+    out.print(forecast.forecast);
+    out.print(F("\",description=\""));
+    http_print_escaped(out, forecast.description);
+    out.println(F("\"} 1"));
+  }
+
+  const memory_sample_t*         memory = memory_latest();
+  const wireless_window_stats_t* window = wireless_window_stats();
+  const uplink_stats_t*          uplink = uplink_stats();
+  http_print_metric(out, F("hem_uptime_seconds"), F("counter"), millis() / 1000);
+  if (memory != nullptr) {
+    http_print_metric(out, F("hem_heap_free_bytes"), F("gauge"), memory->heap_free);
+    http_print_metric(out, F("hem_heap_largest_block_bytes"), F("gauge"), memory->largest_block);
+  }
+  http_print_metric(out, F("hem_clock_drift_ppb"), F("gauge"), clock_drift());
+  http_print_metric(out, F("hem_wifi_windows_total"), F("counter"), window->windows);
+  http_print_metric(out, F("hem_wifi_windows_failed_total"), F("counter"), window->failed);
+  http_print_metric(out, F("hem_wifi_window_lost_milliseconds_total"), F("counter"), window->total_lost);
+  http_print_metric(out, F("hem_uplink_queued_total"), F("counter"), uplink->queued);
+  http_print_metric(out, F("hem_uplink_sent_total"), F("counter"), uplink->sent);
+  http_print_metric(out, F("hem_uplink_dropped_total"), F("counter"), uplink->dropped);
+  http_print_metric(out, F("hem_uplink_pending"), F("gauge"), uplink_pending());
+  http_print_metric(out, F("hem_http_requests_total"), F("counter"), http_server_requests());
+}
+
+/**
+ * Write the same as http_write_metrics() as one JSON object:
+ *
+ *   {"sensors":[{"name":..,"placement":..,"temperature":..,"humidity":..,"pressure":..,"age":..}],
+ *    "zones":{"bedroom":{"temperature":..,"humidity":..,"sensors":..,"outdoor":..}},
+ *    "forecast":{"code":..,"description":..,"trend":..},
+ *    "uptime":..,"heap_free":..,"clock_drift":..,"uplink_pending":..,"requests":..}
+ */
+void http_write_json(Print& out) {
+  const Config& config = get_config();
+  bool          first  = true;
+  out.print(F("{\"sensors\":["));
+  for (uint8_t i = 0; i < ruuvi_device_count() && i < config.ruuvi.devices.size(); i++) {
+    ruuvi_data_t reading = ruuvi_reading(i);
+    if (reading.pressure == 0) {
+      continue;
+    }
+    out.print(first ? F("{\"name\":\"") : F(",{\"name\":\""));
+    http_print_escaped(out, config.ruuvi.devices[i].name.c_str());
+    out.print(F("\",\"placement\":\""));
+    http_print_escaped(out, config.ruuvi.devices[i].placement.c_str());
+    out.print(F("\",\"temperature\":"));
+    out.print(reading.temperature, 2);
+    out.print(F(",\"humidity\":"));
+    out.print(reading.humidity, 2);
+    out.print(F(",\"pressure\":"));
+    out.print(reading.pressure);
+    out.print(F(",\"age\":"));
+    out.print((int32_t)(time_context().utc - ruuvi_reading_time(i)));
+    out.print('}');
+    first = false;
+  }
+
+  out.print(F("],\"zones\":{"));
+  first = true;
+  update_zone_aggregates();
+  for (uint8_t zone = 0; zone < zone_count(); zone++) {
+    const zone_aggregate_t& aggregate = zone_aggregate(zone);
+    if (aggregate.sensors == 0) {
+      continue;
+    }
+    out.print(first ? F("\"") : F(",\""));
+    http_print_escaped(out, zone_name(zone));
+    out.print(F("\":{\"temperature\":"));
+    out.print(aggregate.temperature / 100.0f, 2);
+    out.print(F(",\"humidity\":"));
+    out.print(aggregate.humidity / 100.0f, 2);
+    out.print(F(",\"sensors\":"));
+    out.print(aggregate.sensors);
+    out.print(F(",\"outdoor\":"));
+    out.print(zone_is_outdoor(zone) ? F("true") : F("false"));
+    out.print('}');
+    first = false;
+  }
+
+  out.print(F("},\"forecast\":{"));
+  if (average_pressure() > 0) {
+    zambretti_forecast_t forecast = get_forecast(time_context());
+    out.print(F("\"code\":\""));
+    out.print(forecast.forecast);
+    out.print(F("\",\"description\":\""));
+    http_print_escaped(out, forecast.description);
+    out.print(F("\","));
+  }
+  out.print(F("\"trend\":"));
+  out.print(pressure_trend(), 2);
+
+  const memory_sample_t* memory = memory_latest();
+  out.print(F("},\"uptime\":"));
+  out.print(millis() / 1000);
+  out.print(F(",\"heap_free\":"));
+  out.print(memory != nullptr ? memory->heap_free : 0);
+  out.print(F(",\"clock_drift\":"));
+  out.print(clock_drift());
+  out.print(F(",\"uplink_pending\":"));
+  out.print(uplink_pending());
+  out.print(F(",\"requests\":"));
+  out.print(http_server_requests());
+  out.println('}');
+}
+
+/**
+ * Write the minimum, average and maximum of each zone over the last hours as
+ * one JSON object:
+ *
+ *   {"hours":..,"zones":{"bedroom":{"minutes":..,"temperature":{"min":..,"avg":..,"max":..},"humidity":{..},
+ *    "pressure":..}}}
+ *
+ * \param hours length of the window, from 1 hour to a year
+ */
+void http_write_summary(Print& out, uint32_t hours) {
+  time_t now = time_context().utc;
+  hours      = constrain(hours, (uint32_t)1, (uint32_t)8760);
+  out.print(F("{\"hours\":"));
+  out.print(hours);
+  out.print(F(",\"zones\":{"));
+  bool first = true;
+  for (uint8_t zone = 0; zone < zone_count(); zone++) {
+    query_result_t result;
+    if (!query_zone(zone, now - hours * 3600, now, &result)) {
+      continue;
+    }
+    out.print(first ? F("\"") : F(",\""));
+    http_print_escaped(out, zone_name(zone));
+    out.print(F("\":{\"minutes\":"));
+    out.print(result.minutes);
+    out.print(F(",\"temperature\":{\"min\":"));
+    out.print(result.temperature_min, 2);
+    out.print(F(",\"avg\":"));
+    out.print(result.temperature, 2);
+    out.print(F(",\"max\":"));
+    out.print(result.temperature_max, 2);
+    out.print(F("},\"humidity\":{\"min\":"));
+    out.print(result.humidity_min, 1);
+    out.print(F(",\"avg\":"));
+    out.print(result.humidity, 1);
+    out.print(F(",\"max\":"));
+    out.print(result.humidity_max, 1);
+    out.print(F("},\"pressure\":"));
+    out.print(result.pressure, 0);
+    out.print('}');
+    first = false;
+  }
+  out.println(F("}}"));
+}
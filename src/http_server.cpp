@@ -0,0 +1,170 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "http_server.h"
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "configuration.h"
+#include "configuration_types.h"
+
+/**
+ * Gathers small writes into chunks before they go to the socket, so a
+ * response streamed value by value does not turn into one packet per value.
+ */
+class http_writer : public Print {
+public:
+  http_writer(Print& out) : _out(out), _length(0) {}
+  ~http_writer() {
+    flush();
+  }
+
+  size_t write(uint8_t byte) {
+    if (_length == sizeof(_chunk)) {
+      flush();
+    }
+    _chunk[_length++] = byte;
+    return 1;
+  }
+
+  size_t write(const uint8_t* buffer, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+      write(buffer[i]);
+    }
+    return size;
+  }
+
+  void flush() {
+    if (_length > 0) {
+      _out.write(_chunk, _length);
+      _length = 0;
+    }
+  }
+
+private:
+  Print&  _out;
+  uint8_t _chunk[HTTP_CHUNK_SIZE];
+  size_t  _length;
+};
+
+WiFiServer* _http_server = nullptr;
+WiFiClient  _http_client;
+bool        _http_client_active = false;
+uint32_t    _http_client_since  = 0;
+char        _http_request[HTTP_REQUEST_LINE];
+uint8_t     _http_request_length = 0;
+uint32_t    _http_requests       = 0;
+
+/**
+ * Answer the request line that was read, then close the connection.
+ */
+void http_respond() {
+  http_writer out(_http_client);
+  _http_requests++;
+  if (strncmp(_http_request, "GET /metrics ", 13) == 0) {
+    out.print(F("HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nConnection: close\r\n\r\n"));
+    http_write_metrics(out);
+  } else if (strncmp(_http_request, "GET / ", 6) == 0 || strncmp(_http_request, "GET /readings ", 14) == 0) {
+    out.print(F("HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nConnection: close\r\n\r\n"));
+    http_write_json(out);
+  } else if (strncmp(_http_request, "GET /summary", 12) == 0 &&
+             (_http_request[12] == ' ' || strncmp(_http_request + 12, "?hours=", 7) == 0)) {
+    out.print(F("HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nConnection: close\r\n\r\n"));
+    http_write_summary(out, _http_request[12] == '?' ? strtoul(_http_request + 19, nullptr, 10) : 24);
+  } else {
+    out.print(F("HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"));
+  }
+  out.flush();
+  // Drop what is left of the request, so closing does not reset the
+  // connection before the response is read.
+  while (_http_client.available() > 0) {
+    _http_client.read();
+  }
+  _http_client.stop();
+  _http_client_active = false;
+}
+
+/**
+ * Start listening, if a port is configured. Called when WiFi is up.
+ */
+void http_server_begin() {
+  if (!http_server_enabled() || _http_server != nullptr) {
+    return;
+  }
+  _http_server = new WiFiServer(get_config().http.port);
+  _http_server->begin();
+  Serial.print(F("HTTP server listening on port "));
+  Serial.println(get_config().http.port);
+}
+
+/**
+ * Stop listening, before WiFi goes down.
+ */
+void http_server_end() {
+  if (_http_server == nullptr) {
+    return;
+  }
+  if (_http_client_active) {
+    _http_client.stop();
+    _http_client_active = false;
+  }
+  _http_server->end();
+  delete _http_server;
+  _http_server = nullptr;
+}
+
+/**
+ * Serve at most one client at a time, taking one step per call and never
+ * waiting for the client. Others wait in the listen backlog until the current
+ * one is done. Called from the wireless state machine while WiFi is up.
+ */
+void http_server_poll() {
+  if (_http_server == nullptr) {
+    return;
+  }
+  if (!_http_client_active) {
+    _http_client = _http_server->accept();
+    if (!_http_client) {
+      return;
+    }
+    _http_client_active  = true;
+    _http_client_since   = millis();
+    _http_request_length = 0;
+  }
+
+  while (_http_client.available() > 0) {
+    char c = _http_client.read();
+    if (c == '\r' || c == '\n') {
+      _http_request[_http_request_length] = '\0';
+      http_respond();
+      return;
+    }
+    if (_http_request_length < sizeof(_http_request) - 1) {
+      _http_request[_http_request_length++] = c;
+    }
+  }
+  if (!_http_client.connected() || (millis() - _http_client_since) >= HTTP_REQUEST_TIMEOUT) {
+    _http_client.stop();
+    _http_client_active = false;
+  }
+}
+
+bool http_server_enabled() {
+  return get_config().http.port != 0;
+}
+
+/**
+ * \return milliseconds WiFi is kept up for the server in each window
+ */
+uint32_t http_server_listen_time() {
+  return min(get_config().http.listen, (uint16_t)HTTP_LISTEN_MAX) * 1000UL;
+}
+
+uint32_t http_server_requests() {
+  return _http_requests;
+}
@@ -0,0 +1,211 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "logging.h"
+
+#include <Arduino.h>
+#include <string.h>
+
+#include "log_messages.h"
+#include "telemetry.h"
+
+#define LOG_FORMAT(id, level, format) format,
+const char* const log_formats[LOG_ID_COUNT] PROGMEM = {LOG_MESSAGES(LOG_FORMAT)};
+#undef LOG_FORMAT
+
+// Records are id (1), argument count (1), millis() (4) and the arguments (4
+// each), written from the Bluetooth callback as well as the main loop.
+#define LOG_RECORD_HEADER 6
+
+uint8_t           _log_buffer[LOG_BUFFER_SIZE];
+volatile uint16_t _log_head    = 0; // Where the next record is written
+volatile uint16_t _log_used    = 0; // Bytes waiting to be drained
+volatile uint32_t _log_dropped = 0; // Records that did not fit since the last drain
+uint16_t          _log_sequence = 0;
+
+void log_copy_in(uint16_t at, const void* data, size_t length) {
+  const uint8_t* bytes = (const uint8_t*)data;
+  for (size_t i = 0; i < length; i++) {
+    _log_buffer[(at + i) % LOG_BUFFER_SIZE] = bytes[i];
+  }
+}
+
+void log_copy_out(uint16_t at, void* data, size_t length) {
+  uint8_t* bytes = (uint8_t*)data;
+  for (size_t i = 0; i < length; i++) {
+    bytes[i] = _log_buffer[(at + i) % LOG_BUFFER_SIZE];
+  }
+}
+
+/**
+ * Add a record to the ring buffer, called through LOG(). A record that does
+ * not fit is dropped and counted, the buffer is never waited on.
+ */
+void log_write(uint8_t id, const uint32_t* arguments, uint8_t count) {
+  uint8_t  header[LOG_RECORD_HEADER];
+  uint32_t now    = millis();
+  size_t   length = LOG_RECORD_HEADER + count * sizeof(uint32_t);
+  header[0]       = id;
+  header[1]       = count;
+  memcpy(&header[2], &now, sizeof(now));
+
+  noInterrupts();
+  if (_log_used + length > LOG_BUFFER_SIZE) {
+    _log_dropped++;
+  } else {
+    log_copy_in(_log_head, header, sizeof(header));
+    log_copy_in((_log_head + sizeof(header)) % LOG_BUFFER_SIZE, arguments, count * sizeof(uint32_t));
+    _log_head = (_log_head + length) % LOG_BUFFER_SIZE;
+    _log_used += length;
+  }
+  interrupts();
+}
+
+/**
+ * Print a record as text, [seconds.millis] followed by the formatted message.
+ * Supports the subset of printf described in log_messages.h.
+ */
+void log_print(Print& out, uint8_t id, uint32_t time, const uint32_t* arguments, uint8_t count) {
+  out.print('[');
+  out.print(time / 1000);
+  out.print('.');
+  out.print((time % 1000) / 100);
+  out.print((time % 100) / 10);
+  out.print(time % 10);
+  out.print(F("] "));
+
+  if (id >= LOG_ID_COUNT) {
+    out.print(F("unknown log message "));
+    out.println(id);
+    return;
+  }
+  uint8_t argument = 0;
+  for (const char* c = log_formats[id]; *c != '\0'; c++) {
+    if (*c != '%') {
+      out.print(*c);
+      continue;
+    }
+    c++;
+    uint8_t precision = 6;
+    if (*c == '.') {
+      precision = c[1] - '0';
+      c += 2;
+    }
+    if (*c == '%') {
+      out.print('%');
+      continue;
+    }
+    if (*c == '\0') {
+      break;
+    }
+    uint32_t value = (argument < count ? arguments[argument] : 0);
+    argument++;
+    switch (*c) {
+      case 'd':
+        out.print((int32_t)value);
+        break;
+      case 'u':
+        out.print(value);
+        break;
+      case 'x':
+        out.print(value, HEX);
+        break;
+      case 'c':
+        out.print((char)value);
+        break;
+      case 'f': {
+        float number;
+        memcpy(&number, &value, sizeof(number));
+        out.print(number, precision);
+        break;
+      }
+      default:
+        out.print('?');
+        break;
+    }
+  }
+  out.println();
+}
+
+/**
+ * Take the oldest record off the ring buffer.
+ *
+ * \return false if there was none
+ */
+bool log_take(uint8_t* id, uint32_t* time, uint32_t* arguments, uint8_t* count) {
+  noInterrupts();
+  if (_log_used == 0) {
+    interrupts();
+    return false;
+  }
+  uint16_t tail = (_log_head + LOG_BUFFER_SIZE - _log_used) % LOG_BUFFER_SIZE;
+  uint8_t  header[LOG_RECORD_HEADER];
+  log_copy_out(tail, header, sizeof(header));
+  *id    = header[0];
+  *count = min(header[1], (uint8_t)LOG_MAX_ARGUMENTS);
+  memcpy(time, &header[2], sizeof(*time));
+  log_copy_out((tail + sizeof(header)) % LOG_BUFFER_SIZE, arguments, *count * sizeof(uint32_t));
+  _log_used -= LOG_RECORD_HEADER + header[1] * sizeof(uint32_t);
+  interrupts();
+  return true;
+}
+
+/**
+ * Format and print a few records, or with HEM_LOG_BINARY send them as
+ * telemetry frames for tools/log_decode.py. Called when the scheduler is idle,
+ * and only takes records the USB buffer has room for.
+ */
+void log_drain() {
+  if (_log_dropped > 0 && _log_used + LOG_RECORD_HEADER + sizeof(uint32_t) <= LOG_BUFFER_SIZE) {
+    noInterrupts();
+    uint32_t dropped = _log_dropped;
+    _log_dropped     = 0;
+    interrupts();
+    log_record(LOG_DROPPED, dropped);
+  }
+
+  for (uint8_t i = 0; i < LOG_DRAIN_RECORDS && _log_used > 0; i++) {
+    if (!log_ready()) {
+      return;
+    }
+    uint8_t  id;
+    uint8_t  count;
+    uint32_t time;
+    uint32_t arguments[LOG_MAX_ARGUMENTS];
+    if (!log_take(&id, &time, arguments, &count)) {
+      return;
+    }
+#ifdef HEM_LOG_BINARY
+    uint8_t record[LOG_RECORD_HEADER + LOG_MAX_ARGUMENTS * sizeof(uint32_t)];
+    record[0] = id;
+    record[1] = count;
+    memcpy(&record[2], &time, sizeof(time));
+    memcpy(&record[LOG_RECORD_HEADER], arguments, count * sizeof(uint32_t));
+    telemetry_send(TELEMETRY_LOG, _log_sequence++, TELEMETRY_LAST, record,
+                   LOG_RECORD_HEADER + count * sizeof(uint32_t));
+#else
+    log_print(Serial, id, time, arguments, count);
+#endif
+  }
+}
+
+/**
+ * \return true if the USB serial port has room for a record now
+ */
+bool log_ready() {
+#ifdef HEM_LOG_BINARY
+  return telemetry_room();
+#else
+  // Room for a long line of text. Without a host the text is thrown away.
+  return !Serial || Serial.availableForWrite() >= 128;
+#endif
+}
+
+/**
+ * \return bytes of records waiting to be drained
+ */
+size_t log_pending() {
+  return _log_used;
+}
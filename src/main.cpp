@@ -7,7 +7,6 @@
 #include <BTstackLib.h>
 #include <LittleFS.h>
 #include <SPI.h>
-#include <SingleFileDrive.h>
 #include <U8g2lib.h>
 #include <Wire.h>
 #include <inttypes.h>
@@ -21,129 +20,79 @@
 #include <string>
 #include <vector>
 
+#include "boot.h"
 #include "climate.h"
 #include "common.h"
 #include "configuration.h"
 #include "configuration_types.h"
+#include "display.h"
 #include "forecast.h"
+#include "format.h"
+#include "memory_stats.h"
 #include "network_time.h"
 #include "ruuvi.h"
+#include "segments.h"
 #include "splash_logo.h"
 #include "system.h"
+#include "tasks.h"
+#include "widgets.h"
 #include "wireless.h"
 
-uint32_t display_timer = 0;
-
 U8G2_SH1107_64X128_F_HW_I2C u8g2(U8G2_R3);
 // U8G2_SSD1327_WS_128X128_F_HW_I2C u8g2(U8G2_R3);
 
-Config config;
-
 bool _filesystem_safe = true;
 
-void myPlugCB(uint32_t data) {
-  _filesystem_safe = false;
-}
-
-void myUnplugCB(uint32_t data) {
-  _filesystem_safe = true;
-}
-
-void myDeleteCB(uint32_t data) {
-  // Maybe LittleFS.remove("myfile.txt")?  or do nothing
-}
-
 /**
- * Main setup routine.
+ * Main setup routine. Only brings up the display and shows the splash, the
+ * rest of the boot runs from the task scheduler, see boot.cpp.
  */
 void setup() {
-  LittleFS.begin();
-  /* singleFileDrive.onPlug(myPlugCB);
-  singleFileDrive.onUnplug(myUnplugCB);
-  singleFileDrive.onDelete(myDeleteCB);
-  singleFileDrive.begin("config.json", "config.json"); */
+  memory_paint_stack();
 
   if (!Serial) {
     Serial.begin(115200);
   }
-  delay(10000);
-  load_config_file();
-  config = get_config();
-  setup_ruuvi_devices();
+#ifdef HEM_WAIT_FOR_SERIAL
+  // Give a serial monitor the chance to attach before anything is printed.
+  while (!Serial && millis() < 10000) {
+    delay(10);
+  }
+#endif
 
   u8g2.setI2CAddress(I2C_ADDRESS << 1);
   u8g2.begin();
   u8g2.enableUTF8Print();
+  display_begin();
   setup_backlight();
+#ifdef HEM_BENCHMARK
+  benchmark_segments();
+  benchmark_format();
+#endif
 
   u8g2.clearBuffer();
   u8g2.drawXBM((u8g2.getDisplayWidth() >> 1) - (splash_logo_width >> 1),
                (u8g2.getDisplayHeight() >> 1) - (splash_logo_height >> 1), splash_logo_width, splash_logo_height,
                splash_logo_bits);
-  u8g2.sendBuffer();
-
+  display_update();
   control_backlight();
-  delay(1000);
-
-  u8g2.clearBuffer();
-  u8g2.sendBuffer();
-
-  Serial.println(F("Connecting to WiFi..."));
-  connect_network();
-  Serial.println(F("WiFi connection configured."));
   // pir_init();
+
+  boot_begin();
+  setup_tasks();
 }
 
 /**
- * Main program loop.
+ * Main program loop. Everything runs as scheduled tasks, see tasks.cpp, and
+ * the CPU sleeps between them.
  */
 void loop() {
-  delay(250);
-
-  if (watchdog_running()) {
-    // Make sure we feed the watchdog if it's running.
-    feed_watchdog();
-  }
-
-  if (configuration_loaded()) {
-    control_wireless();
-  }
-
-  if (bluetooth_configured()) {
-    control_bluetooth_scanning();
-    // Once BLE is configured, also start the watchdog if not running.
-    if (!watchdog_running()) {
-      start_watchdog();
-    }
-  }
-
-  u8g2.setFont(u8g2_font_helvR08_tf);
-  u8g2.clearBuffer();
-
-  if (configured()) {
-    print_wifi_status();
-    print_time();
-  } else {
-    load_config_file();
-  }
-
-  if (configured() && bluetooth_configured()) {
-    print_bluetooth_status();
-    if (ruuvi_devices_configured()) {
-      process_pressure();
-      print_climate();
-      print_forecast_icon();
-    } else {
-      setup_ruuvi_devices();
-    }
-  }
-
-  u8g2.sendBuffer();
-  control_backlight();
+  run_tasks();
 }
 
 /*
 void setup1() {
+  memory_paint_stack();
   pinMode(LED_BUILTIN, OUTPUT);
 }
 
@@ -159,6 +108,14 @@ bool is_filesystem_safe() {
   return _filesystem_safe;
 }
 
+/**
+ * Hand the file system to the USB host, or take it back. Nothing but the USB
+ * drive may use it meanwhile.
+ */
+void set_filesystem_safe(bool safe) {
+  _filesystem_safe = safe;
+}
+
 U8G2 get_display() {
   return u8g2;
 }
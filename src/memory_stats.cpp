@@ -0,0 +1,339 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "memory_stats.h"
+
+#include <Arduino.h>
+#include <malloc.h>
+#include <stdlib.h>
+
+#include <new>
+
+#include "memory_types.h"
+
+#if __has_include(<lwip/stats.h>)
+#  include <lwip/stats.h>
+#endif
+
+// Stack regions of the two cores, from the linker script.
+extern "C" uint32_t __StackBottom[];
+extern "C" uint32_t __StackTop[];
+extern "C" uint32_t __StackOneBottom[];
+extern "C" uint32_t __StackOneTop[];
+
+bool _stack_painted[2] = {false, false};
+
+// Counted in operator new and delete. Allocations from the Bluetooth callback
+// can race with the main loop, so the counts are close rather than exact.
+volatile uint32_t _allocations         = 0;
+volatile uint32_t _live_allocations    = 0;
+uint32_t          _sampled_allocations = 0;
+uint32_t          _pass_start          = 0;
+uint16_t          _pass_allocations    = 0;
+
+memory_sample_t _memory_history[MEMORY_HISTORY];
+uint8_t         _memory_next  = 0;
+uint8_t         _memory_count = 0;
+
+/**
+ * Fill the unused part of the calling core's stack with a known pattern, so
+ * memory_stack_used() can tell how deep the stack has been. Call first thing
+ * in setup() on core 0 and in setup1() on core 1.
+ */
+void memory_paint_stack() {
+  uint8_t   core   = rp2040.cpuid();
+  uint32_t* bottom = (core == 0 ? __StackBottom : __StackOneBottom);
+  uint32_t* limit  = (uint32_t*)((uint8_t*)__builtin_frame_address(0) - MEMORY_STACK_MARGIN);
+
+  // An interrupt would push its frame right where we are painting.
+  noInterrupts();
+  for (uint32_t* word = bottom; word < limit; word++) {
+    *word = MEMORY_STACK_PAINT;
+  }
+  interrupts();
+  _stack_painted[core] = true;
+}
+
+/**
+ * Find the deepest the stack of a core has been since it was painted.
+ *
+ * \param core the core, 0 or 1
+ * \return stack used in bytes, 0 if the stack of the core was never painted
+ */
+uint32_t memory_stack_used(uint8_t core) {
+  if (core > 1 || !_stack_painted[core]) {
+    return 0;
+  }
+  uint32_t* word = (core == 0 ? __StackBottom : __StackOneBottom);
+  uint32_t* top  = (core == 0 ? __StackTop : __StackOneTop);
+  while (word < top && *word == MEMORY_STACK_PAINT) {
+    word++;
+  }
+  return (top - word) * sizeof(uint32_t);
+}
+
+/**
+ * Find the largest block that can be allocated right now by trying. A large
+ * gap between this and the free heap means the heap is fragmented. Takes
+ * about 18 allocations, which is nothing once a minute.
+ */
+uint32_t memory_largest_block() {
+  uint32_t low  = 0;
+  uint32_t high = rp2040.getFreeHeap();
+  while (low < high) {
+    uint32_t size  = (low + high + 1) / 2;
+    void*    block = malloc(size);
+    if (block != nullptr) {
+      free(block);
+      low = size;
+    } else {
+      high = size - 1;
+    }
+  }
+  return low;
+}
+
+uint32_t memory_allocations() {
+  return _allocations;
+}
+
+/**
+ * Mark the start of a render pass, to count the allocations made during it.
+ */
+void memory_pass_begin() {
+  _pass_start = _allocations;
+}
+
+void memory_pass_end() {
+  uint32_t allocations = _allocations - _pass_start;
+  if (allocations > _pass_allocations) {
+    _pass_allocations = (allocations > 0xffff ? 0xffff : allocations);
+  }
+}
+
+/**
+ * Take a sample of the heap and stacks and add it to the history.
+ */
+void memory_sample() {
+  memory_sample_t& sample = _memory_history[_memory_next];
+  uint32_t         total  = _allocations;
+
+  sample.time             = millis();
+  sample.heap_used        = rp2040.getUsedHeap();
+  sample.heap_free        = rp2040.getFreeHeap();
+  sample.largest_block    = memory_largest_block();
+  sample.allocations      = total - _sampled_allocations;
+  sample.live_allocations = _live_allocations;
+  sample.pass_allocations = _pass_allocations;
+  sample.stack_used[0]    = memory_stack_used(0);
+  sample.stack_used[1]    = memory_stack_used(1);
+#if defined(LWIP_STATS) && LWIP_STATS && MEM_STATS
+  sample.network_heap_used = lwip_stats.mem.used;
+#else
+  sample.network_heap_used = 0;
+#endif
+
+  _sampled_allocations = total;
+  _pass_allocations    = 0;
+  _memory_next         = (_memory_next + 1) % MEMORY_HISTORY;
+  if (_memory_count < MEMORY_HISTORY) {
+    _memory_count++;
+  }
+}
+
+/**
+ * \return the most recent sample, or nullptr before the first one
+ */
+const memory_sample_t* memory_latest() {
+  if (_memory_count == 0) {
+    return nullptr;
+  }
+  return &_memory_history[(_memory_next + MEMORY_HISTORY - 1) % MEMORY_HISTORY];
+}
+
+/**
+ * \return the oldest sample still in the history, or nullptr before the first
+ */
+const memory_sample_t* memory_oldest() {
+  if (_memory_count == 0) {
+    return nullptr;
+  }
+  return &_memory_history[(_memory_next + MEMORY_HISTORY - _memory_count) % MEMORY_HISTORY];
+}
+
+/**
+ * Print the latest sample and how the free heap moved over the history:
+ *
+ *   M heap=61234/142310 big=140288 frag=1% new=412 live=96 pass=7 stack=1320/0 net=0 low=139870 creep=-312
+ *
+ * frag is how much of the free heap cannot be had in one block, low the least
+ * free heap seen in the history and creep the change in free heap across it.
+ */
+void memory_print_summary() {
+  const memory_sample_t* latest = memory_latest();
+  const memory_sample_t* oldest = memory_oldest();
+  if (latest == nullptr) {
+    return;
+  }
+
+  uint32_t lowest = latest->heap_free;
+  for (uint8_t i = 0; i < _memory_count; i++) {
+    if (_memory_history[i].heap_free < lowest) {
+      lowest = _memory_history[i].heap_free;
+    }
+  }
+  uint32_t fragmentation =
+      (latest->heap_free > 0 ? 100 - (uint64_t)latest->largest_block * 100 / latest->heap_free : 0);
+
+  Serial.print(F("M heap="));
+  Serial.print(latest->heap_used);
+  Serial.print('/');
+  Serial.print(latest->heap_free);
+  Serial.print(F(" big="));
+  Serial.print(latest->largest_block);
+  Serial.print(F(" frag="));
+  Serial.print(fragmentation);
+  Serial.print(F("% new="));
+  Serial.print(latest->allocations);
+  Serial.print(F(" live="));
+  Serial.print(latest->live_allocations);
+  Serial.print(F(" pass="));
+  Serial.print(latest->pass_allocations);
+  Serial.print(F(" stack="));
+  Serial.print(latest->stack_used[0]);
+  Serial.print('/');
+  Serial.print(latest->stack_used[1]);
+  Serial.print(F(" net="));
+  Serial.print(latest->network_heap_used);
+  Serial.print(F(" low="));
+  Serial.print(lowest);
+  Serial.print(F(" creep="));
+  Serial.println((int32_t)(latest->heap_free - oldest->heap_free));
+}
+
+// Counting replacements for the global allocation functions. Everything in
+// the C++ code that allocates, the std::vector and std::string copies made in
+// the loop included, goes through these. All forms are replaced, so nothrow
+// and aligned allocations are counted as well.
+
+/**
+ * Allocate and count a block for operator new.
+ *
+ * \param alignment required alignment, 0 for what malloc() gives
+ * \return the block, nullptr if the heap is exhausted
+ */
+void* memory_allocate(size_t size, size_t alignment) {
+  size        = (size > 0 ? size : 1);
+  void* block = (alignment > 0 ? memalign(alignment, size) : malloc(size));
+  if (block != nullptr) {
+    _allocations++;
+    _live_allocations++;
+  }
+  return block;
+}
+
+void* memory_allocate_or_throw(size_t size, size_t alignment) {
+  void* block = memory_allocate(size, alignment);
+  if (block == nullptr) {
+#ifdef __EXCEPTIONS
+    throw std::bad_alloc();
+#else
+    abort();
+#endif
+  }
+  return block;
+}
+
+void memory_free(void* block) {
+  if (block != nullptr) {
+    _live_allocations--;
+    free(block);
+  }
+}
+
+void* operator new(size_t size) {
+  return memory_allocate_or_throw(size, 0);
+}
+
+void* operator new[](size_t size) {
+  return memory_allocate_or_throw(size, 0);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  return memory_allocate(size, 0);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+  return memory_allocate(size, 0);
+}
+
+void operator delete(void* block) noexcept {
+  memory_free(block);
+}
+
+void operator delete[](void* block) noexcept {
+  memory_free(block);
+}
+
+void operator delete(void* block, size_t size) noexcept {
+  memory_free(block);
+}
+
+void operator delete[](void* block, size_t size) noexcept {
+  memory_free(block);
+}
+
+void operator delete(void* block, const std::nothrow_t&) noexcept {
+  memory_free(block);
+}
+
+void operator delete[](void* block, const std::nothrow_t&) noexcept {
+  memory_free(block);
+}
+
+#ifdef __cpp_aligned_new
+// Only declared from C++17 on. Our own code is built as C++11, but libraries
+// built with a newer standard may still allocate over-aligned types.
+
+void* operator new(size_t size, std::align_val_t alignment) {
+  return memory_allocate_or_throw(size, (size_t)alignment);
+}
+
+void* operator new[](size_t size, std::align_val_t alignment) {
+  return memory_allocate_or_throw(size, (size_t)alignment);
+}
+
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+  return memory_allocate(size, (size_t)alignment);
+}
+
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+  return memory_allocate(size, (size_t)alignment);
+}
+
+void operator delete(void* block, std::align_val_t alignment) noexcept {
+  memory_free(block);
+}
+
+void operator delete[](void* block, std::align_val_t alignment) noexcept {
+  memory_free(block);
+}
+
+void operator delete(void* block, size_t size, std::align_val_t alignment) noexcept {
+  memory_free(block);
+}
+
+void operator delete[](void* block, size_t size, std::align_val_t alignment) noexcept {
+  memory_free(block);
+}
+
+void operator delete(void* block, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+  memory_free(block);
+}
+
+void operator delete[](void* block, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+  memory_free(block);
+}
+#endif
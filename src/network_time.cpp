@@ -7,6 +7,7 @@
 
 #include <U8g2lib.h>
 #include <WiFi.h>
+#include <WiFiUdp.h>
 #include <stdlib.h>
 #include <sunset.h>
 #include <sys/time.h>
@@ -18,140 +19,264 @@
 #include "common.h"
 #include "configuration.h"
 #include "configuration_types.h"
+#include "format.h"
+#include "network_time_types.h"
+#include "profile.h"
+#include "resolver.h"
+#include "resolver_types.h"
+#include "timekeeping.h"
+#include "widgets.h"
 #include "wireless.h"
 
-const char* weekdays[7] PROGMEM = {"Söndag", "Måndag", "Tisdag", "Onsdag", "Torsdag", "Fredag", "Lördag"};
-const char* months[12] PROGMEM  = {"jan", "feb", "mar", "apr", "maj", "jun", "jul", "aug", "sep", "okt", "nov", "dec"};
-
 bool _network_time_set      = false;
 bool _network_time_received = false;
+bool _timezone_set          = false;
+
+WiFiUDP      _ntp_udp;
+bool         _ntp_pending  = false;
+uint32_t     _ntp_sent     = 0;
+uint8_t      _ntp_attempts = 0;
+ntp_sample_t _ntp_last     = {0, 0, 0, 0};
+uint8_t      _ntp_server   = 0; // Server of the last request
+resolver_t   _ntp_servers[2];   // Addresses of NTP_SERVER1 and NTP_SERVER2, looked up once
 
 time_t _sunset_configured_time = 0;
+int    _sunrise_minute         = 0;
+int    _sunset_minute          = 0;
 SunSet _sun;
 
 /**
- * Configure the local clock using NTP from the network.
+ * The local clock in milliseconds since the epoch.
+ */
+int64_t local_time_ms() {
+  struct timeval now;
+  gettimeofday(&now, nullptr);
+  return (int64_t)now.tv_sec * 1000 + now.tv_usec / 1000;
+}
+
+/**
+ * Send an SNTP request, alternating between the two servers. The answer is
+ * picked up by ntp_poll(). The server names are looked up without waiting and
+ * the addresses kept, so nothing here blocks on DNS. Until either address is
+ * known nothing is sent, the next retry tries again.
+ */
+void ntp_request() {
+  uint8_t   packet[NTP_PACKET_SIZE];
+  IPAddress server;
+  memset(packet, 0, sizeof(packet));
+  packet[0] = 0x23; // No leap warning, version 4, client
+
+  // Both lookups are kept going, so the other server is ready if one fails.
+  const char* names[2] = {NTP_SERVER1, NTP_SERVER2};
+  uint8_t     choice   = _ntp_attempts++ & 1;
+  resolve(_ntp_servers[!choice], names[!choice], &server);
+  if (!resolve(_ntp_servers[choice], names[choice], &server)) {
+    choice = !choice;
+    if (!resolve(_ntp_servers[choice], names[choice], &server)) {
+      return;
+    }
+  }
+  _ntp_server = choice;
+
+  if (!_ntp_pending) {
+    _ntp_udp.begin(NTP_LOCAL_PORT);
+  }
+  _ntp_udp.beginPacket(server, 123);
+  _ntp_udp.write(packet, sizeof(packet));
+  _ntp_udp.endPacket();
+  _ntp_pending = true;
+  _ntp_sent    = millis();
+}
+
+uint32_t ntp_read_uint32(const uint8_t* bytes) {
+  return ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 8) | bytes[3];
+}
+
+/**
+ * Check for an answer to the last request, without waiting.
  *
- * \todo Show some of these Serial.print's on the OLED instead.
+ * \param sample filled in when an answer arrived
+ * \return true if there was an answer
  */
-void configure_network_time() {
-  if (!network_connected()) {
+bool ntp_poll(ntp_sample_t* sample) {
+  if (!_ntp_pending || _ntp_udp.parsePacket() < NTP_PACKET_SIZE) {
+    return false;
+  }
+  uint8_t packet[NTP_PACKET_SIZE];
+  _ntp_udp.readBytes(packet, sizeof(packet));
+  _ntp_udp.stop();
+  _ntp_pending = false;
+
+  // Transmit timestamp, seconds since 1900 and a 32 bit binary fraction.
+  uint32_t seconds  = ntp_read_uint32(&packet[40]);
+  uint32_t fraction = ntp_read_uint32(&packet[44]);
+  if (seconds == 0) {
+    return false;
+  }
+  sample->received   = millis();
+  sample->round_trip = min(sample->received - _ntp_sent, (uint32_t)0xffff);
+  sample->server     = ((int64_t)seconds - NTP_UNIX_OFFSET) * 1000 + (((uint64_t)fraction * 1000) >> 32);
+  sample->server += sample->round_trip / 2;
+  sample->offset = sample->server - local_time_ms();
+  return true;
+}
+
+/**
+ * Set up the timezone from the configuration, the first time the clock is set.
+ */
+void configure_timezone() {
+  if (_timezone_set) {
+    return;
+  }
+  const char* tz = lookup_posix_timezone_tz(get_config().timezone.c_str());
+  Serial.print(F("Setting up timezone: "));
+  Serial.println(tz);
+  setenv("TZ", tz, 1);
+  tzset();
+  _timezone_set = true;
+}
+
+/**
+ * Correct the local clock from an NTP answer, see clock_sync(). The first time
+ * also sets up the timezone. The sunrise and sunset calculation follows on the
+ * next clock tick, which sees the date change.
+ */
+void apply_network_time(const ntp_sample_t& sample) {
+  clock_sync(sample);
+  _ntp_last = sample;
+
+  if (_network_time_set) {
     return;
   }
+  configure_timezone();
+  time_t now = time(nullptr);
 
-  if (!NTP.running()) {
-    Serial.println(F("Setting up NTP..."));
-    NTP.begin(NTP_SERVER1, NTP_SERVER2);
-  } else {
-    Serial.println(F("NTP configured. Waiting for time from network."));
+  struct tm local;
+  char      date_string[FORMAT_DATE_SIZE];
+  char      time_string[FORMAT_CLOCK_SIZE];
+  localtime_r(&now, &local);
+  format_date(date_string, sizeof(date_string), &local);
+  format_clock(time_string, sizeof(time_string), local.tm_hour, local.tm_min);
+  Serial.print(F("Time set from network: "));
+  Serial.print(date_string);
+  Serial.print(' ');
+  Serial.println(time_string);
+  _network_time_received = true;
+  _network_time_set      = true;
+}
+
+/**
+ * Get the time from the network with SNTP. Sends a request, and another one
+ * every NTP_RETRY milliseconds until a server answers, but never waits for
+ * the answer. Called from the wireless state machine until it returns true.
+ *
+ * \return true once a fresh answer has been applied to the clock
+ */
+bool configure_network_time() {
+  if (!network_connected()) {
+    return false;
   }
 
-  if (NTP.running()) {
-    if (NTP.waitSet()) {
-      Serial.println(F("Processing NTP response..."));
-      _network_time_received = true;
-    } else {
-      Serial.println(F("Timeout waiting for network time, will wait for response."));
-      _network_time_received = false;
-    }
-    time_t now = time(nullptr);
-    if (now > 57600) {
-      Serial.println(F("NTP time response from network, processing."));
-      const char* tz = lookup_posix_timezone_tz(get_config().timezone.c_str());
-      Serial.print(F("Setting up timezone: "));
-      Serial.println(tz);
-      setenv("TZ", tz, 1);
-      tzset();
-
-      Serial.print(F("Time set from network: "));
-      Serial.print(asctime(localtime(&now)));
-      configure_sunset();
-      _network_time_set = true;
-    } else {
-      Serial.println(F("No good time from network yet, will try again."));
-      _network_time_set = false;
+  ntp_sample_t sample;
+  if (ntp_poll(&sample)) {
+    apply_network_time(sample);
+    return true;
+  }
+  if (!_ntp_pending || (millis() - _ntp_sent) >= NTP_RETRY) {
+    if (_ntp_pending) {
+      // No answer, the pool may have moved the server. Look it up again.
+      resolver_forget(_ntp_servers[_ntp_server]);
     }
+    ntp_request();
   }
+  return false;
 }
 
 /**
- * Display the time on the OLED.
- *
- * \param configuration the parsed config file
+ * Forget an unanswered request, when WiFi goes down before the answer.
  */
-void print_time() {
-  if (_network_time_set) {
-    Config    configuration = get_config();
-    U8G2      u8g2          = get_display();
-    time_t    now           = time(nullptr);
-    struct tm local;
-    localtime_r(&now, &local);
-
-    char sunrise_string[6];
-    char sunset_string[7];
-    char time_string[5];
-    char date_string[strlen(weekdays[local.tm_wday]) + strlen(months[local.tm_mon]) + (local.tm_mday > 9 ? 2 : 1) + 5];
-    uint8_t sunrise_str_offset = 0;
-
-    configure_sunset();
-    int sunrise = static_cast<int>(_sun.calcSunrise());
-    int sunset  = static_cast<int>(_sun.calcSunset());
-
-    u8g2.setFont(u8g2_font_helvR08_tf);
-    sprintf(date_string, "%s %d %s %4d", weekdays[local.tm_wday], local.tm_mday, months[local.tm_mon],
-            (local.tm_year + 1900));
-    u8g2.drawUTF8(0, u8g2.getMaxCharHeight(), date_string);
-    u8g2.setFont(u8g2_font_helvB08_tf);
-    sprintf(time_string, "%02d:%02d", local.tm_hour, local.tm_min);
-    u8g2.drawStr((u8g2.getDisplayWidth() - u8g2.getStrWidth(time_string)), u8g2.getMaxCharHeight(), time_string);
-
-    u8g2.setFont(u8g2_font_open_iconic_weather_1x_t);
-    // Sun icon
-    u8g2.drawGlyph(0, u8g2.getDisplayHeight() - 1, 0x45);
-    sunrise_str_offset += u8g2.getMaxCharWidth();
-
-    u8g2.setFont(u8g2_font_helvR08_tf);
-    sprintf(sunrise_string, "%02d:%02d ", (sunrise / 60) % 24, (sunrise % 60));
-    u8g2.drawStr(sunrise_str_offset, u8g2.getDisplayHeight() - 1, sunrise_string);
-    sunrise_str_offset += u8g2.getStrWidth(sunrise_string);
-    u8g2.setFont(u8g2_font_open_iconic_weather_1x_t);
-    // Moon icon
-    u8g2.drawGlyph(sunrise_str_offset, u8g2.getDisplayHeight() - 1, 0x42);
-    sunrise_str_offset += u8g2.getMaxCharWidth();
-
-    u8g2.setFont(u8g2_font_helvR08_tf);
-    sprintf(sunset_string, "%02d:%02d", (sunset / 60) % 24, (sunset % 60));
-    u8g2.drawStr(sunrise_str_offset, u8g2.getDisplayHeight() - 1, sunset_string);
+void cancel_network_time() {
+  if (_ntp_pending) {
+    _ntp_udp.stop();
+    _ntp_pending = false;
   }
 }
 
+const ntp_sample_t* last_ntp_sample() {
+  return (_ntp_last.server != 0 ? &_ntp_last : nullptr);
+}
+
 /**
- * Configure the SunSet library with current date and location.
+ * Display the time on the OLED. Text is only formatted when the minute, date
+ * or sunrise and sunset times change.
+ *
+ * \param now the time of the current tick
  */
-void configure_sunset() {
-  Config    configuration = get_config();
-  time_t    now           = time(nullptr);
-  struct tm gmt;
-  struct tm last_configured;
-  gmtime_r(&now, &gmt);
-  gmtime_r(&_sunset_configured_time, &last_configured);
-  if ((_sunset_configured_time < 57600) ||
-      ((last_configured.tm_year != gmt.tm_year) && (last_configured.tm_mon != gmt.tm_mon) &&
-       (last_configured.tm_mday != gmt.tm_mday))) {
-    Serial.print(F("SunSet Library setting current date:"));
-    Serial.printf("%d, %d, %d\n", gmt.tm_year + 1900, gmt.tm_mon + 1, gmt.tm_mday);
-    Serial.print(F("SunSet Library setting location:"));
-    Serial.printf("%.4f, %.4f, %.1f\n", configuration.location.latitude, configuration.location.longitude,
-                  configuration.location.tz_offset);
-    _sun.setCurrentDate(gmt.tm_year + 1900, gmt.tm_mon + 1, gmt.tm_mday);
-    _sun.setPosition(configuration.location.latitude, configuration.location.longitude,
-                     configuration.location.tz_offset);
-    _sunset_configured_time = now;
+void print_time(const time_context_t& now) {
+  PROFILE_STAGE(PROFILE_PRINT_TIME);
+  if (now.valid) {
+    if (widget_bind(WIDGET_DATE, (now.local.tm_year << 9) | now.yday)) {
+      char date_string[FORMAT_DATE_SIZE];
+      format_date(date_string, sizeof(date_string), &now.local);
+      widget_set_text(WIDGET_DATE, date_string);
+    }
+
+    if (widget_bind(WIDGET_CLOCK, now.minute)) {
+      char time_string[FORMAT_CLOCK_SIZE];
+      format_clock(time_string, sizeof(time_string), now.local.tm_hour, now.local.tm_min);
+      widget_set_text(WIDGET_CLOCK, time_string);
+    }
+
+    if (_sunset_configured_time != 0 && widget_bind(WIDGET_SUNRISE, _sunset_configured_time)) {
+      char sunrise_string[FORMAT_CLOCK_SIZE];
+      char sunset_string[FORMAT_CLOCK_SIZE];
+      format_clock(sunrise_string, sizeof(sunrise_string), (_sunrise_minute / 60) % 24, (_sunrise_minute % 60));
+      format_clock(sunset_string, sizeof(sunset_string), (_sunset_minute / 60) % 24, (_sunset_minute % 60));
+      widget_set_text(WIDGET_SUNRISE, sunrise_string);
+      widget_set_text(WIDGET_SUNSET, sunset_string);
+      widget_set_visible(WIDGET_SUNRISE_ICON, true);
+      widget_set_visible(WIDGET_SUNSET_ICON, true);
+    }
   }
 }
 
-SunSet sun() {
-  return _sun;
+/**
+ * Configure the SunSet library with the current date and location and work
+ * out sunrise and sunset. Run on every date change.
+ *
+ * \param now the time of the current tick
+ */
+void configure_sunset(const time_context_t& now) {
+  Config configuration = get_config();
+  char   number[FORMAT_INT_SIZE];
+  Serial.print(F("SunSet Library setting current date:"));
+  Serial.print(now.local.tm_year + 1900);
+  Serial.print(F(", "));
+  Serial.print(now.local.tm_mon + 1);
+  Serial.print(F(", "));
+  Serial.println(now.local.tm_mday);
+  Serial.print(F("SunSet Library setting location:"));
+  format_fixed(number, sizeof(number), to_fixed(configuration.location.latitude, 4), 4);
+  Serial.print(number);
+  Serial.print(F(", "));
+  format_fixed(number, sizeof(number), to_fixed(configuration.location.longitude, 4), 4);
+  Serial.print(number);
+  Serial.print(F(", "));
+  format_fixed(number, sizeof(number), to_fixed(configuration.location.tz_offset, 1), 1);
+  Serial.println(number);
+  _sun.setCurrentDate(now.local.tm_year + 1900, now.local.tm_mon + 1, now.local.tm_mday);
+  _sun.setPosition(configuration.location.latitude, configuration.location.longitude,
+                   configuration.location.tz_offset);
+  _sunrise_minute         = static_cast<int>(_sun.calcSunrise());
+  _sunset_minute          = static_cast<int>(_sun.calcSunset());
+  _sunset_configured_time = now.utc;
+}
+
+/**
+ * Tell if it's currently daytime, from the sunrise and sunset of the day.
+ */
+bool daytime(const time_context_t& now) {
+  return (now.minute >= _sunrise_minute && now.minute < _sunset_minute);
 }
 
 bool network_time_set() {
@@ -0,0 +1,145 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "pages.h"
+
+#include <Arduino.h>
+#include <U8g2lib.h>
+
+#include "climate.h"
+#include "common.h"
+#include "format.h"
+#include "sparkline.h"
+#include "tasks.h"
+#include "widgets.h"
+
+volatile bool _page_next_requested = false;
+uint8_t       _page                = 0;     // Climate pages first, then a graph page per series
+bool          _page_graph_drawn    = false; // The graph area holds a graph
+uint8_t       _page_drawn_series   = 0;
+uint32_t      _page_drawn_version  = 0;
+
+/**
+ * Move on to the next page at the next render. Safe to call from interrupts,
+ * the page timer and the PIR sensor both do.
+ */
+void page_next() {
+  _page_next_requested = true;
+  request_render();
+}
+
+uint8_t current_page() {
+  return _page;
+}
+
+/**
+ * \return the number of pages, which changes with the number of zones
+ */
+uint8_t page_count() {
+  return climate_page_count() + SPARKLINE_SERIES_COUNT;
+}
+
+bool page_has_data(uint8_t page) {
+  int16_t low;
+  int16_t high;
+  return page < climate_page_count() || sparkline_range(page - climate_page_count(), &low, &high);
+}
+
+/**
+ * Write the title of a graph page, the range of the last 24 hours:
+ * "24h -3.2..4.5°C" or "24h 1002..1015 hPa".
+ */
+void print_graph_title(uint8_t series) {
+  int16_t low;
+  int16_t high;
+  sparkline_range(series, &low, &high);
+  char   low_string[FORMAT_INT_SIZE];
+  char   high_string[FORMAT_INT_SIZE];
+  char   title[WIDGET_TEXT_SIZE];
+  size_t length;
+  if (series == SPARKLINE_TEMPERATURE) {
+    format_fixed(low_string, sizeof(low_string), low / 10, 1);
+    format_fixed(high_string, sizeof(high_string), high / 10, 1);
+  } else {
+    format_int(low_string, sizeof(low_string), low / 10);
+    format_int(high_string, sizeof(high_string), (high + 9) / 10);
+  }
+  length = format_append(title, sizeof(title), 0, "24h ");
+  length = format_append(title, sizeof(title), length, low_string);
+  length = format_append(title, sizeof(title), length, "..");
+  length = format_append(title, sizeof(title), length, high_string);
+  format_append(title, sizeof(title), length, (series == SPARKLINE_TEMPERATURE ? FORMAT_DEGREE "C" : " hPa"));
+  widget_set_text(WIDGET_GRAPH_TITLE, title);
+}
+
+/**
+ * Update the widgets of the page being shown, switching page first if that
+ * was asked for. A graph page hides the climate rows and shows its title in
+ * their place, the graph itself is drawn by draw_page().
+ */
+void print_page() {
+  if (_page_next_requested) {
+    _page_next_requested = false;
+    uint8_t pages = page_count();
+    for (uint8_t i = 1; i <= pages; i++) {
+      if (page_has_data((_page + i) % pages)) {
+        _page = (_page + i) % pages;
+        break;
+      }
+    }
+  }
+  if (_page >= page_count()) {
+    // Zones were set up again and there are fewer climate pages.
+    _page = 0;
+  }
+
+  uint8_t climate_pages = climate_page_count();
+  if (_page_graph_drawn && (_page < climate_pages || _page - climate_pages != _page_drawn_series)) {
+    // Clear the graph before the widgets are drawn over its area.
+    int16_t top;
+    uint8_t height;
+    U8G2    u8g2 = get_display();
+    widget_graph_area(&top, &height);
+    u8g2.setDrawColor(0);
+    u8g2.drawBox(0, top, u8g2.getDisplayWidth(), height);
+    u8g2.setDrawColor(1);
+    _page_graph_drawn = false;
+  }
+
+  if (_page < climate_pages) {
+    widget_set_visible(WIDGET_GRAPH_TITLE, false);
+    print_climate(_page);
+    return;
+  }
+  hide_climate();
+  print_graph_title(_page - climate_pages);
+}
+
+/**
+ * Draw the graph of the page being shown, once the widgets are rendered. The
+ * graph is only drawn again when the page or the sparklines changed, at most
+ * once a minute, so a page that stays up costs nothing.
+ */
+void draw_page() {
+  uint8_t climate_pages = climate_page_count();
+  if (_page < climate_pages) {
+    return;
+  }
+  uint8_t series = _page - climate_pages;
+  if (_page_graph_drawn && series == _page_drawn_series && sparkline_version() == _page_drawn_version) {
+    return;
+  }
+  int16_t top;
+  uint8_t height;
+  U8G2    u8g2 = get_display();
+  widget_graph_area(&top, &height);
+  u8g2.setDrawColor(0);
+  u8g2.drawBox(0, top, u8g2.getDisplayWidth(), height);
+  u8g2.setDrawColor(1);
+  draw_sparkline(u8g2, series, top, height);
+  _page_graph_drawn   = true;
+  _page_drawn_series  = series;
+  _page_drawn_version = sparkline_version();
+}
@@ -0,0 +1,89 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "profile.h"
+
+#include <Arduino.h>
+
+#include "breadcrumb.h"
+
+const char* profile_stage_names[PROFILE_STAGE_COUNT] PROGMEM = {
+    "wireless", "scanning", "wifi",    "time",    "bluetooth", "climate",  "forecast",
+    "pressure", "backlight", "advert", "widgets", "display",   "watchdog", "sparkline"};
+
+/**
+ * \return the name of a stage as used in the serial output, "loop" for
+ *         BREADCRUMB_IDLE
+ */
+const char* profile_stage_name(uint8_t stage) {
+  if (stage < PROFILE_STAGE_COUNT) {
+    return profile_stage_names[stage];
+  }
+  return (stage == BREADCRUMB_IDLE ? "loop" : "?");
+}
+
+#ifdef HEM_PROFILE
+volatile uint32_t _profile_histogram[PROFILE_STAGE_COUNT][PROFILE_BUCKETS];
+volatile uint32_t _profile_max[PROFILE_STAGE_COUNT];
+
+/**
+ * Count a duration in the histogram for a stage. Kept short since it runs in
+ * the Bluetooth callback too.
+ *
+ * \param stage one of the profile_stage values
+ * \param duration how long the stage took in microseconds
+ */
+void profile_record(uint8_t stage, uint32_t duration) {
+  uint8_t bucket = (duration == 0 ? 0 : 32 - __builtin_clz(duration));
+  if (bucket >= PROFILE_BUCKETS) {
+    bucket = PROFILE_BUCKETS - 1;
+  }
+  _profile_histogram[stage][bucket]++;
+  if (duration > _profile_max[stage]) {
+    _profile_max[stage] = duration;
+  }
+}
+
+/**
+ * Print the histograms over serial, one line per stage that ran since the last
+ * dump:
+ *
+ *   P time max=412 0,0,0,0,0,0,0,0,12,3,0,0,0,0,0,0
+ *
+ * Counts are in bucket order, bucket n holding durations below 2^n us. The
+ * histograms keep counting, the max values start over after each dump.
+ */
+void profile_dump() {
+  for (uint8_t stage = 0; stage < PROFILE_STAGE_COUNT; stage++) {
+    if (_profile_max[stage] == 0) {
+      continue;
+    }
+    Serial.print(F("P "));
+    Serial.print(profile_stage_name(stage));
+    Serial.print(F(" max="));
+    Serial.print(_profile_max[stage]);
+    for (uint8_t bucket = 0; bucket < PROFILE_BUCKETS; bucket++) {
+      Serial.print(bucket == 0 ? ' ' : ',');
+      Serial.print(_profile_histogram[stage][bucket]);
+    }
+    Serial.println();
+    _profile_max[stage] = 0;
+  }
+}
+
+/**
+ * Copy the histogram of a stage, for the telemetry protocol.
+ *
+ * \param stage one of the profile_stage values
+ * \param max set to the longest duration since the last dump
+ * \param buckets PROFILE_BUCKETS counts
+ */
+void profile_histogram(uint8_t stage, uint32_t* max, uint32_t* buckets) {
+  *max = _profile_max[stage];
+  for (uint8_t bucket = 0; bucket < PROFILE_BUCKETS; bucket++) {
+    buckets[bucket] = _profile_histogram[stage][bucket];
+  }
+}
+#endif
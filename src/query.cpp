@@ -0,0 +1,354 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "query.h"
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "common.h"
+#include "query_tree.h"
+#include "query_types.h"
+#include "rollup.h"
+#include "rollup_types.h"
+#include "ruuvi.h"
+#include "timekeeping.h"
+#include "timekeeping_types.h"
+
+// A window is split over the rollup tiers and the tree of days, which is the
+// level after the last tier.
+#define QUERY_TREE_LEVEL ROLLUP_TIER_COUNT
+#define QUERY_DAY_SECONDS 86400
+
+const uint32_t query_kept_buckets[ROLLUP_TIER_COUNT] = {ROLLUP_MINUTES, ROLLUP_QUARTERS, ROLLUP_HOURS};
+
+// Tree file kept open for reading, -1 if none.
+File     _query_tree;
+int8_t   _query_tree_device = -1;
+uint16_t _query_tree_newest = 0; // Newest finished day in the open tree, 0 if none
+// Nodes changed by the days being added.
+query_batch_t _query_batch;
+
+void query_add_record(query_summary_t& summary, const rollup_record_t& record) {
+  query_summary_t part;
+  part.temperature_sum = (int64_t)record.temperature * record.samples;
+  part.pressure_sum    = (int64_t)record.pressure * record.samples;
+  part.humidity_sum    = (uint32_t)record.humidity * record.samples;
+  part.minutes         = record.samples;
+  part.temperature_min = record.temperature_min;
+  part.temperature_max = record.temperature_max;
+  part.humidity_min    = record.humidity_min;
+  part.humidity_max    = record.humidity_max;
+  query_combine(summary, part);
+}
+
+void query_add_minute(query_summary_t& summary, const rollup_minute_t& sample) {
+  uint8_t         humidity = min((sample.humidity + 25) / 50, 0xff);
+  query_summary_t part;
+  part.temperature_sum = sample.temperature;
+  part.pressure_sum    = sample.pressure;
+  part.humidity_sum    = humidity;
+  part.minutes         = 1;
+  part.temperature_min = sample.temperature;
+  part.temperature_max = sample.temperature;
+  part.humidity_min    = humidity;
+  part.humidity_max    = humidity;
+  query_combine(summary, part);
+}
+
+void query_tree_close() {
+  if (_query_tree_device >= 0) {
+    _query_tree.close();
+    _query_tree_device = -1;
+  }
+}
+
+void query_tree_name(char* name, size_t size, uint8_t device) {
+  snprintf(name, size, ROLLUP_DIRECTORY "/t%u", device);
+}
+
+/**
+ * Open the tree file of a sensor for reading.
+ *
+ * \return false if there is no tree yet, or a foreign file
+ */
+bool query_tree_open(uint8_t device) {
+  if (_query_tree_device == device) {
+    return true;
+  }
+  query_tree_close();
+
+  char name[32];
+  query_tree_name(name, sizeof(name), device);
+  _query_tree_newest = 0;
+  if (!LittleFS.exists(name)) {
+    return false;
+  }
+  _query_tree = LittleFS.open(name, "r");
+  query_summary_t header;
+  if (!_query_tree || _query_tree.read((uint8_t*)&header, sizeof(header)) != sizeof(header) ||
+      header.minutes != QUERY_TREE_MAGIC) {
+    _query_tree.close();
+    return false;
+  }
+  _query_tree_device = device;
+  _query_tree_newest = header.day;
+  return true;
+}
+
+/**
+ * Read a node of the open tree. With no tree open, there is nothing to read.
+ */
+bool query_read_node(uint16_t node, query_summary_t* summary) {
+  return _query_tree_device >= 0 && _query_tree.seek(node * sizeof(query_summary_t)) &&
+         _query_tree.read((uint8_t*)summary, sizeof(query_summary_t)) == sizeof(query_summary_t);
+}
+
+/**
+ * Write the tree of a sensor with the nodes of the batch in place, in one
+ * pass to a new file that then replaces the old one. The tree as it was must
+ * be open, if there is one. Writing the file front to back keeps LittleFS from
+ * copying the rest of it on every node, and the rename makes the days added
+ * stick even if the monitor resets right after.
+ */
+bool query_tree_write(uint8_t device) {
+  char name[32];
+  char temporary[36];
+  query_tree_name(name, sizeof(name), device);
+  snprintf(temporary, sizeof(temporary), "%s.new", name);
+
+  File file    = LittleFS.open(temporary, "w");
+  bool written = (bool)file;
+  for (uint16_t node = 0; written && node < QUERY_TREE_NODES; node++) {
+    const query_summary_t* changed = query_batch_node(_query_batch, node);
+    query_summary_t        kept;
+    if (changed == nullptr && !query_read_node(node, &kept)) {
+      query_empty(kept);
+    }
+    written = (file.write((const uint8_t*)(changed != nullptr ? changed : &kept), sizeof(kept)) == sizeof(kept));
+  }
+  file.close();
+  query_tree_close();
+  if (!written || !LittleFS.rename(temporary, name)) {
+    LittleFS.remove(temporary);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Sum up a day from the hourly tier.
+ */
+void query_day(uint8_t device, uint32_t day, query_summary_t& summary) {
+  rollup_record_t record;
+  for (uint32_t hour = day * 24; hour < (day + 1) * 24; hour++) {
+    if (rollup_read(ROLLUP_HOUR, device, hour, &record)) {
+      query_add_record(summary, record);
+    }
+  }
+}
+
+/**
+ * Combine whole days, from the tree as far as it goes. Days the tree does not
+ * have yet are summed from the hourly tier.
+ */
+void query_days(uint8_t device, uint32_t from, uint32_t to, query_summary_t& summary) {
+  if (query_tree_open(device) && _query_tree_newest > 0) {
+    uint32_t oldest = (_query_tree_newest + 1 > QUERY_DAYS ? _query_tree_newest + 1 - QUERY_DAYS : 0);
+    uint32_t first  = max(from, oldest);
+    uint32_t last   = min(to, (uint32_t)_query_tree_newest + 1);
+    if (first < last) {
+      // The days are a ring of leaves, so the range may wrap around.
+      uint16_t first_leaf = first % QUERY_DAYS;
+      uint16_t last_leaf  = last % QUERY_DAYS;
+      if (first_leaf < last_leaf) {
+        query_tree_leaves(first_leaf, last_leaf, &query_read_node, summary);
+      } else {
+        query_tree_leaves(first_leaf, QUERY_DAYS, &query_read_node, summary);
+        query_tree_leaves(0, last_leaf, &query_read_node, summary);
+      }
+    }
+    from = max(from, (uint32_t)_query_tree_newest + 1);
+  }
+  for (uint32_t day = from; day < to; day++) {
+    query_day(device, day, summary);
+  }
+}
+
+uint32_t query_level_seconds(uint8_t level) {
+  return (level == QUERY_TREE_LEVEL ? QUERY_DAY_SECONDS : rollup_bucket_seconds(level));
+}
+
+/**
+ * \return true if a rollup tier still keeps a bucket
+ */
+bool query_kept(uint8_t level, uint32_t bucket, const time_context_t& now) {
+  return bucket + query_kept_buckets[level] > now.utc / rollup_bucket_seconds(level);
+}
+
+void query_buckets(uint8_t device, uint8_t level, uint32_t from, uint32_t to, query_summary_t& summary) {
+  for (uint32_t bucket = from; bucket < to; bucket++) {
+    if (level == ROLLUP_MINUTE) {
+      rollup_minute_t sample;
+      if (rollup_read_minute(device, bucket, &sample)) {
+        query_add_minute(summary, sample);
+      }
+    } else {
+      rollup_record_t record;
+      if (rollup_read(level, device, bucket, &record)) {
+        query_add_record(summary, record);
+      }
+    }
+  }
+}
+
+/**
+ * Combine the buckets of a level from first up to, not including, last. The
+ * ragged ends are read at this level and the whole buckets of the next level
+ * in between are left to it, so a window of any length takes at most 14
+ * minutes, 3 quarters and 23 hours at each end and two walks down the tree.
+ * If the tier no longer keeps the start of the window, the start is widened to
+ * a whole bucket of the next level.
+ */
+void query_collect(uint8_t device, uint8_t level, uint32_t from, uint32_t to, const time_context_t& now,
+                   query_summary_t& summary) {
+  if (from >= to) {
+    return;
+  }
+  if (level == QUERY_TREE_LEVEL) {
+    query_days(device, from, to, summary);
+    return;
+  }
+
+  uint32_t ratio      = query_level_seconds(level + 1) / query_level_seconds(level);
+  uint32_t inner_from = (from + ratio - 1) / ratio;
+  uint32_t inner_to   = to / ratio;
+  if (!query_kept(level, from, now)) {
+    inner_from = from / ratio;
+    inner_to   = max(inner_to, inner_from + 1);
+  } else if (inner_from >= inner_to) {
+    query_buckets(device, level, from, to, summary);
+    return;
+  } else {
+    query_buckets(device, level, from, inner_from * ratio, summary);
+  }
+  query_buckets(device, level, inner_to * ratio, to, summary);
+  query_collect(device, level + 1, inner_from, inner_to, now, summary);
+}
+
+void query_finish(const query_summary_t& summary, query_result_t* result) {
+  memset(result, 0, sizeof(query_result_t));
+  result->minutes = summary.minutes;
+  if (summary.minutes == 0) {
+    return;
+  }
+  result->temperature_min = summary.temperature_min / 100.0f;
+  result->temperature     = (float)summary.temperature_sum / summary.minutes / 100.0f;
+  result->temperature_max = summary.temperature_max / 100.0f;
+  result->humidity_min    = summary.humidity_min / 2.0f;
+  result->humidity        = (float)summary.humidity_sum / summary.minutes / 2.0f;
+  result->humidity_max    = summary.humidity_max / 2.0f;
+  result->pressure        = (float)summary.pressure_sum / summary.minutes + ROLLUP_PRESSURE_BASE;
+}
+
+/**
+ * Find the minimum, average and maximum of a sensor over a window. The window
+ * is rounded out to whole minutes and ends now at the latest.
+ *
+ * \param device index of the device in the configuration
+ * \param from start of the window, seconds since the epoch
+ * \param to end of the window, not included
+ * \return false if nothing was sampled in the window, or the USB drive has the
+ *         file system
+ */
+bool query_window(uint8_t device, time_t from, time_t to, query_result_t* result) {
+  const time_context_t& now = time_context();
+  query_summary_t       summary;
+  query_empty(summary);
+  if (now.valid && device < ROLLUP_DEVICES && is_filesystem_safe()) {
+    to = min(to, now.utc);
+    query_collect(device, ROLLUP_MINUTE, from / 60, (to + 59) / 60, now, summary);
+  }
+  query_finish(summary, result);
+  return summary.minutes > 0;
+}
+
+/**
+ * Like query_window(), over all sensors of a zone that are rolled up.
+ */
+bool query_zone(uint8_t zone, time_t from, time_t to, query_result_t* result) {
+  const time_context_t& now = time_context();
+  query_summary_t       summary;
+  query_empty(summary);
+  if (now.valid && ruuvi_devices_configured() && is_filesystem_safe()) {
+    to = min(to, now.utc);
+    for (uint8_t device = 0; device < ruuvi_device_count() && device < ROLLUP_DEVICES; device++) {
+      if (ruuvi_zone(device) == zone) {
+        query_collect(device, ROLLUP_MINUTE, from / 60, (to + 59) / 60, now, summary);
+      }
+    }
+  }
+  query_finish(summary, result);
+  return summary.minutes > 0;
+}
+
+/**
+ * Add the days that finished since the last run to the tree of each sensor.
+ * The days are summed from the hourly tier into a batch of changed nodes, and
+ * the tree is then written out once. After the monitor was off, up to a year
+ * of days is caught up, at most QUERY_DAYS_PER_RUN per sensor and run, and no
+ * more once the run took QUERY_RUN_TIME. Days that had no readings are left
+ * out while their leaf is empty already. Run by the task scheduler when the
+ * UTC date changes, and again until it returns false.
+ *
+ * \return true if there are days left to add
+ */
+bool query_service() {
+  const time_context_t& now = time_context();
+  if (!now.valid || !ruuvi_devices_configured()) {
+    return false;
+  }
+  if (!is_filesystem_safe()) {
+    return true;
+  }
+  uint32_t started = millis();
+  uint16_t today   = now.utc / QUERY_DAY_SECONDS;
+  bool     more    = false;
+  for (uint8_t device = 0; device < ruuvi_device_count() && device < ROLLUP_DEVICES; device++) {
+    query_tree_open(device);
+    if (_query_tree_newest + 1 >= today) {
+      continue;
+    }
+    if (millis() - started >= QUERY_RUN_TIME) {
+      more = true;
+      break;
+    }
+    uint16_t first = max(_query_tree_newest + 1, today - QUERY_DAYS + 1);
+    uint16_t last  = min(today, (uint16_t)(first + QUERY_DAYS_PER_RUN));
+    uint16_t day   = first;
+    query_batch_begin(_query_batch);
+    for (; day < last && (day == first || millis() - started < QUERY_RUN_TIME); day++) {
+      query_summary_t leaf;
+      query_summary_t kept;
+      query_empty(leaf);
+      query_day(device, day, leaf);
+      if (leaf.minutes == 0 && (!query_read_node(QUERY_DAYS + day % QUERY_DAYS, &kept) || kept.minutes == 0)) {
+        continue;
+      }
+      if (!query_batch_set_day(_query_batch, day, leaf)) {
+        break;
+      }
+    }
+    query_batch_finish(_query_batch, day - 1, &query_read_node);
+    // If the tree cannot be written, the days are tried again tomorrow.
+    if (query_tree_write(device)) {
+      more = more || day < today;
+    }
+  }
+  return more;
+}
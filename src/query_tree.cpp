@@ -0,0 +1,163 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "query_tree.h"
+
+#include <Arduino.h>
+#include <string.h>
+
+#include "query_types.h"
+
+// Only the tree itself lives here, away from the file system, so that it
+// builds and can be benchmarked on the host as well.
+
+static_assert(sizeof(query_summary_t) == 32, "tree files assume 32 byte nodes");
+
+void query_empty(query_summary_t& summary) {
+  memset((void*)&summary, 0, sizeof(summary));
+  summary.temperature_min = INT16_MAX;
+  summary.temperature_max = INT16_MIN;
+  summary.humidity_min    = 0xff;
+  summary.humidity_max    = 0;
+}
+
+/**
+ * Add the totals of one summary to another.
+ */
+void query_combine(query_summary_t& into, const query_summary_t& from) {
+  if (from.minutes == 0) {
+    return;
+  }
+  into.temperature_sum += from.temperature_sum;
+  into.pressure_sum += from.pressure_sum;
+  into.humidity_sum += from.humidity_sum;
+  into.minutes += from.minutes;
+  into.temperature_min = (from.temperature_min < into.temperature_min ? from.temperature_min : into.temperature_min);
+  into.temperature_max = (from.temperature_max > into.temperature_max ? from.temperature_max : into.temperature_max);
+  into.humidity_min    = (from.humidity_min < into.humidity_min ? from.humidity_min : into.humidity_min);
+  into.humidity_max    = (from.humidity_max > into.humidity_max ? from.humidity_max : into.humidity_max);
+}
+
+/**
+ * Combine the leaves from first up to, not including, last.
+ */
+void query_tree_leaves(uint16_t first, uint16_t last, query_node_reader_t read, query_summary_t& summary) {
+  query_summary_t node;
+  for (first += QUERY_DAYS, last += QUERY_DAYS; first < last; first /= 2, last /= 2) {
+    if ((first & 1) && read(first++, &node)) {
+      query_combine(summary, node);
+    }
+    if ((last & 1) && read(--last, &node)) {
+      query_combine(summary, node);
+    }
+  }
+}
+
+/**
+ * Find a node in a batch, by a linear search until the batch is finished.
+ *
+ * \return the index of the node in the batch, or -1
+ */
+int16_t query_batch_find(const query_batch_t& batch, uint16_t node) {
+  for (uint16_t i = 0; i < batch.count; i++) {
+    if (batch.nodes[i] == node) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+void query_batch_begin(query_batch_t& batch) {
+  batch.count = 0;
+}
+
+/**
+ * Put the summary of a day in its leaf and note the nodes above it, which
+ * query_batch_finish() works out.
+ *
+ * \return false if the batch has no room left for the day
+ */
+bool query_batch_set_day(query_batch_t& batch, uint16_t day, const query_summary_t& leaf) {
+  // Room for the leaf, the nodes above it and the header.
+  if (batch.count + QUERY_TREE_HEIGHT + 1 > QUERY_BATCH_NODES) {
+    return false;
+  }
+  uint16_t node = QUERY_DAYS + day % QUERY_DAYS;
+  int16_t  i    = query_batch_find(batch, node);
+  if (i < 0) {
+    i              = batch.count++;
+    batch.nodes[i] = node;
+  }
+  batch.summaries[i]     = leaf;
+  batch.summaries[i].day = day;
+  for (node /= 2; node > 0 && query_batch_find(batch, node) < 0; node /= 2) {
+    batch.nodes[batch.count++] = node;
+  }
+  return true;
+}
+
+/**
+ * Sort the batch by node and work out the nodes above the leaves, children
+ * before their parents. Children that are not in the batch are read from the
+ * tree as it was. The header is added with the newest day.
+ */
+void query_batch_finish(query_batch_t& batch, uint16_t newest, query_node_reader_t read) {
+  query_summary_t& header = batch.summaries[batch.count];
+  memset((void*)&header, 0, sizeof(header));
+  header.minutes             = QUERY_TREE_MAGIC;
+  header.day                 = newest;
+  batch.nodes[batch.count++] = 0;
+
+  for (uint16_t i = 1; i < batch.count; i++) {
+    uint16_t        node    = batch.nodes[i];
+    query_summary_t summary = batch.summaries[i];
+    uint16_t        j       = i;
+    for (; j > 0 && batch.nodes[j - 1] > node; j--) {
+      batch.nodes[j]     = batch.nodes[j - 1];
+      batch.summaries[j] = batch.summaries[j - 1];
+    }
+    batch.nodes[j]     = node;
+    batch.summaries[j] = summary;
+  }
+
+  // Children have higher numbers than their parent.
+  for (uint16_t i = batch.count; i > 1; i--) {
+    uint16_t node = batch.nodes[i - 1];
+    if (node >= QUERY_DAYS) {
+      continue;
+    }
+    query_summary_t& parent = batch.summaries[i - 1];
+    query_empty(parent);
+    for (uint16_t child = 2 * node; child <= 2 * node + 1; child++) {
+      const query_summary_t* changed = query_batch_node(batch, child);
+      query_summary_t        kept;
+      if (changed != nullptr) {
+        query_combine(parent, *changed);
+      } else if (read(child, &kept)) {
+        query_combine(parent, kept);
+      }
+    }
+  }
+}
+
+/**
+ * Find a node in a finished batch.
+ *
+ * \return the new contents of the node, or nullptr if the batch leaves it as
+ *         it was
+ */
+const query_summary_t* query_batch_node(const query_batch_t& batch, uint16_t node) {
+  uint16_t low  = 0;
+  uint16_t high = batch.count;
+  while (low < high) {
+    uint16_t middle = (low + high) / 2;
+    if (batch.nodes[middle] < node) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return (low < batch.count && batch.nodes[low] == node ? &batch.summaries[low] : nullptr);
+}
@@ -0,0 +1,75 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "resolver.h"
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <lwip/dns.h>
+#include <lwip/ip_addr.h>
+
+#include "resolver_types.h"
+
+void resolver_store(resolver_t& entry, const ip_addr_t* address) {
+  entry.address[0] = ip4_addr1(ip_2_ip4(address));
+  entry.address[1] = ip4_addr2(ip_2_ip4(address));
+  entry.address[2] = ip4_addr3(ip_2_ip4(address));
+  entry.address[3] = ip4_addr4(ip_2_ip4(address));
+  entry.state      = RESOLVER_RESOLVED;
+}
+
+/**
+ * Called by lwIP when a lookup finishes, with nullptr if the name did not
+ * resolve.
+ */
+void resolver_found(const char* name, const ip_addr_t* address, void* argument) {
+  resolver_t& entry = *(resolver_t*)argument;
+  if (address == nullptr || !IP_IS_V4(address)) {
+    entry.state = RESOLVER_UNRESOLVED;
+    return;
+  }
+  resolver_store(entry, address);
+}
+
+/**
+ * Look up a host name without waiting. The first call starts the lookup, the
+ * answer is cached and handed out by the calls after it. Literal addresses
+ * resolve at once.
+ *
+ * \param entry the cache for this host, kept by the caller
+ * \param address set to the address once it is known
+ * \return true if the address is known
+ */
+bool resolve(resolver_t& entry, const char* host, IPAddress* address) {
+  if (entry.state == RESOLVER_PENDING && (millis() - entry.started) >= RESOLVER_TIMEOUT) {
+    entry.state = RESOLVER_UNRESOLVED;
+  }
+  if (entry.state == RESOLVER_UNRESOLVED) {
+    ip_addr_t found;
+    entry.state   = RESOLVER_PENDING;
+    entry.started = millis();
+    err_t error   = dns_gethostbyname(host, &found, &resolver_found, &entry);
+    if (error == ERR_OK) {
+      resolver_store(entry, &found);
+    } else if (error != ERR_INPROGRESS) {
+      entry.state = RESOLVER_UNRESOLVED;
+    }
+  }
+  if (entry.state != RESOLVER_RESOLVED) {
+    return false;
+  }
+  *address = IPAddress(entry.address[0], entry.address[1], entry.address[2], entry.address[3]);
+  return true;
+}
+
+/**
+ * Drop a cached address, so the next resolve() looks the name up again. Used
+ * when the host stops answering, it may have moved.
+ */
+void resolver_forget(resolver_t& entry) {
+  if (entry.state == RESOLVER_RESOLVED) {
+    entry.state = RESOLVER_UNRESOLVED;
+  }
+}
@@ -0,0 +1,396 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "rollup.h"
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <math.h>
+#include <pico/time.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "common.h"
+#include "rollup_types.h"
+#include "ruuvi.h"
+#include "ruuvi_types.h"
+#include "timekeeping.h"
+#include "timekeeping_types.h"
+#include "warm_state_types.h"
+
+static_assert(sizeof(rollup_minute_t) == 8 && sizeof(rollup_record_t) == 14, "the storage sizes assume packed slots");
+static_assert(ROLLUP_FILES_PER_DEVICE == 43, "the storage sizes in rollup.h are out of date");
+
+const uint32_t rollup_bucket_lengths[ROLLUP_TIER_COUNT] = {60, 900, 3600};
+const uint16_t rollup_slots[ROLLUP_TIER_COUNT]          = {ROLLUP_MINUTES, ROLLUP_QUARTERS, ROLLUP_HOURS};
+const char     rollup_tier_letters[ROLLUP_TIER_COUNT]   = {'m', 'q', 'h'};
+
+// Buckets being filled, for the quarter and hour tiers, so indexed by tier - 1.
+rollup_accumulator_t _rollup_open[ROLLUP_DEVICES][ROLLUP_TIER_COUNT - 1];
+
+rollup_pending_t _rollup_pending[ROLLUP_PENDING];
+uint16_t         _rollup_pending_count = 0;
+bool             _rollup_flush_due     = false;
+
+rollup_stats_t _rollup_stats = {0, 0, 0, 0, 0, 0, 0};
+
+// Tier file being written and tier file being read, -1 if none.
+File    _rollup_writer;
+int32_t _rollup_writer_id = -1;
+File    _rollup_reader;
+int32_t _rollup_reader_id = -1;
+
+/**
+ * Print the storage the tiers will take, and the sensors that are configured
+ * but not rolled up. Tier files are created as they are first written. Call
+ * once at boot, after the file system is mounted and the sensors are set up.
+ */
+void rollup_begin() {
+  LittleFS.mkdir(ROLLUP_DIRECTORY);
+  Serial.print(F("Rollups: "));
+  Serial.print(ROLLUP_DEVICES);
+  Serial.print(F(" sensors, "));
+  Serial.print(ROLLUP_STORAGE_SIZE / 1024);
+  Serial.println(F(" KB when full"));
+  if (ruuvi_device_count() > ROLLUP_DEVICES) {
+    Serial.print(F("Rollups: not keeping "));
+    Serial.print(ruuvi_device_count() - ROLLUP_DEVICES);
+    Serial.print(F(" of "));
+    Serial.print(ruuvi_device_count());
+    Serial.println(F(" sensors, only the first ones fit"));
+  }
+}
+
+/**
+ * Put the buckets being filled and the records waiting for a flush into a
+ * snapshot.
+ */
+void save_rollup_state(warm_state_t* state) {
+  rollup_state_t& saved = state->rollup;
+  saved.devices         = ruuvi_device_count();
+  saved.pending_count   = _rollup_pending_count;
+  memcpy(saved.open, _rollup_open, sizeof(saved.open));
+  memcpy(saved.pending, _rollup_pending, _rollup_pending_count * sizeof(rollup_pending_t));
+}
+
+/**
+ * Take up the buckets and records of a snapshot, so a restart only loses the
+ * minutes since it was taken. Buckets that ended meanwhile are closed on the
+ * next sample. Skipped if the configured sensors changed since the snapshot
+ * was taken.
+ */
+void restore_rollup_state(const warm_state_t* state) {
+  const rollup_state_t& saved = state->rollup;
+  if (saved.devices == 0 || saved.devices != ruuvi_device_count() || saved.pending_count > ROLLUP_PENDING) {
+    return;
+  }
+  memcpy(_rollup_open, saved.open, sizeof(_rollup_open));
+  memcpy(_rollup_pending, saved.pending, saved.pending_count * sizeof(rollup_pending_t));
+  _rollup_pending_count = saved.pending_count;
+  _rollup_flush_due     = (_rollup_pending_count > ROLLUP_PENDING * 3 / 4);
+  for (uint16_t i = 0; i < _rollup_pending_count; i++) {
+    if (_rollup_pending[i].tier == ROLLUP_HOUR) {
+      _rollup_flush_due = true;
+    }
+  }
+}
+
+uint32_t rollup_bucket_seconds(uint8_t tier) {
+  return rollup_bucket_lengths[tier];
+}
+
+size_t rollup_record_size(uint8_t tier) {
+  return (tier == ROLLUP_MINUTE ? sizeof(rollup_minute_t) : sizeof(rollup_record_t));
+}
+
+/**
+ * Work out which file of a tier holds the slot of a bucket, and where.
+ *
+ * \return an id for the file, used to name it and to tell files apart
+ */
+int32_t rollup_locate(uint8_t tier, uint8_t device, uint32_t bucket, uint32_t* offset) {
+  uint32_t slot     = bucket % rollup_slots[tier];
+  uint32_t per_file = ROLLUP_FILE_SIZE / rollup_record_size(tier);
+  *offset           = (slot % per_file) * rollup_record_size(tier);
+  return ((int32_t)tier << 16) | ((int32_t)device << 8) | (slot / per_file);
+}
+
+void rollup_file_name(char* name, size_t size, int32_t id) {
+  snprintf(name, size, ROLLUP_DIRECTORY "/%c%u-%02u", rollup_tier_letters[id >> 16], (unsigned)((id >> 8) & 0xff),
+           (unsigned)(id & 0xff));
+}
+
+/**
+ * Turn the totals of a bucket into a record.
+ */
+void rollup_make_record(const rollup_accumulator_t& open, rollup_record_t* record) {
+  record->tag             = ROLLUP_TAG(open.bucket);
+  record->temperature_min = open.temperature_min;
+  record->temperature     = lroundf((float)open.temperature_sum / open.samples);
+  record->temperature_max = open.temperature_max;
+  record->pressure        = (open.pressure_sum + open.samples / 2) / open.samples;
+  record->humidity_min    = min((open.humidity_min + 25) / 50, 0xff);
+  record->humidity        = min((open.humidity_sum / open.samples + 25) / 50, (uint32_t)0xff);
+  record->humidity_max    = min((open.humidity_max + 25) / 50, 0xff);
+  record->samples         = min(open.samples, (uint16_t)0xff);
+}
+
+void rollup_queue(uint8_t tier, uint8_t device, uint32_t bucket, const void* record) {
+  if (_rollup_pending_count == ROLLUP_PENDING) {
+    _rollup_stats.dropped++;
+    return;
+  }
+  rollup_pending_t& pending = _rollup_pending[_rollup_pending_count++];
+  pending.bucket            = bucket;
+  pending.tier              = tier;
+  pending.device            = device;
+  memcpy(&pending.record, record, rollup_record_size(tier));
+  // Flush once an hour is done, or before the queue fills up.
+  if (tier == ROLLUP_HOUR || _rollup_pending_count > ROLLUP_PENDING * 3 / 4) {
+    _rollup_flush_due = true;
+  }
+}
+
+/**
+ * Add a sample to the totals of a bucket.
+ */
+void rollup_add(rollup_accumulator_t& open, uint32_t bucket, const rollup_minute_t& sample) {
+  if (open.samples == 0) {
+    open.bucket          = bucket;
+    open.temperature_min = sample.temperature;
+    open.temperature_max = sample.temperature;
+    open.humidity_min    = sample.humidity;
+    open.humidity_max    = sample.humidity;
+    open.temperature_sum = 0;
+    open.humidity_sum    = 0;
+    open.pressure_sum    = 0;
+  }
+  open.samples++;
+  open.temperature_min = min(open.temperature_min, sample.temperature);
+  open.temperature_max = max(open.temperature_max, sample.temperature);
+  open.humidity_min    = min(open.humidity_min, sample.humidity);
+  open.humidity_max    = max(open.humidity_max, sample.humidity);
+  open.temperature_sum += sample.temperature;
+  open.humidity_sum += sample.humidity;
+  open.pressure_sum += sample.pressure;
+}
+
+/**
+ * Take the one-minute sample of each sensor and fold it into the quarter and
+ * hour totals. Buckets that ended are closed first and their records queued,
+ * whether the sensor is still heard from or not. Only readings heard in the
+ * last five minutes are sampled, those of sensors beyond the first
+ * ROLLUP_DEVICES are counted as skipped. Called by the clock task on every new
+ * minute.
+ */
+void rollup_sample(const time_context_t& now) {
+  if (!now.valid || !ruuvi_devices_configured()) {
+    return;
+  }
+  uint8_t devices = min(ruuvi_device_count(), (uint8_t)ROLLUP_DEVICES);
+  for (uint8_t device = devices; device < ruuvi_device_count(); device++) {
+    uint32_t heard_at = ruuvi_heard_at(device);
+    if (heard_at != 0 && millis() - heard_at <= ROLLUP_STALE_AFTER) {
+      _rollup_stats.skipped++;
+    }
+  }
+  for (uint8_t device = 0; device < devices; device++) {
+    for (uint8_t tier = ROLLUP_QUARTER; tier < ROLLUP_TIER_COUNT; tier++) {
+      rollup_accumulator_t& open = _rollup_open[device][tier - 1];
+      if (open.samples > 0 && open.bucket != now.utc / rollup_bucket_lengths[tier]) {
+        rollup_record_t record;
+        rollup_make_record(open, &record);
+        rollup_queue(tier, device, open.bucket, &record);
+        open.samples = 0;
+      }
+    }
+
+    uint32_t heard_at = ruuvi_heard_at(device);
+    if (heard_at == 0 || millis() - heard_at > ROLLUP_STALE_AFTER) {
+      continue;
+    }
+    ruuvi_data_t    reading = ruuvi_reading(device);
+    uint32_t        minute  = now.utc / 60;
+    rollup_minute_t sample;
+    sample.tag         = ROLLUP_TAG(minute);
+    sample.temperature = lroundf(reading.temperature * 100);
+    sample.humidity    = lroundf(reading.humidity * 100);
+    sample.pressure    = constrain((int32_t)reading.pressure - ROLLUP_PRESSURE_BASE, 0, 0xffff);
+    rollup_queue(ROLLUP_MINUTE, device, minute, &sample);
+    for (uint8_t tier = ROLLUP_QUARTER; tier < ROLLUP_TIER_COUNT; tier++) {
+      rollup_add(_rollup_open[device][tier - 1], now.utc / rollup_bucket_lengths[tier], sample);
+    }
+    _rollup_stats.samples++;
+  }
+}
+
+void rollup_close_writer() {
+  if (_rollup_writer_id >= 0) {
+    _rollup_writer.close();
+    _rollup_writer_id = -1;
+    _rollup_stats.writes++;
+  }
+}
+
+/**
+ * Open a tier file for writing, creating it with every slot empty if it does
+ * not exist yet.
+ */
+bool rollup_open_writer(int32_t id) {
+  if (id == _rollup_writer_id) {
+    return true;
+  }
+  rollup_close_writer();
+  if (id == _rollup_reader_id) {
+    _rollup_reader.close();
+    _rollup_reader_id = -1;
+  }
+
+  char name[32];
+  rollup_file_name(name, sizeof(name), id);
+  if (!LittleFS.exists(name)) {
+    uint8_t empty[256];
+    memset(empty, 0, sizeof(empty));
+    File file = LittleFS.open(name, "w");
+    for (uint16_t written = 0; file && written < ROLLUP_FILE_SIZE; written += sizeof(empty)) {
+      file.write(empty, sizeof(empty));
+    }
+    file.close();
+  }
+  _rollup_writer = LittleFS.open(name, "r+");
+  if (!_rollup_writer) {
+    return false;
+  }
+  _rollup_writer_id = id;
+  return true;
+}
+
+/**
+ * Write the queued records into their slots, a tier and a sensor at a time so
+ * each file is only written once. LittleFS copies a file block on the first
+ * write to it and commits the copy on close, so a power cut mid-flush leaves
+ * each file either as it was or with all of its records.
+ */
+void rollup_flush() {
+  uint32_t started = time_us_32();
+  for (uint8_t tier = 0; tier < ROLLUP_TIER_COUNT; tier++) {
+    for (uint8_t device = 0; device < ROLLUP_DEVICES; device++) {
+      for (uint16_t i = 0; i < _rollup_pending_count; i++) {
+        const rollup_pending_t& pending = _rollup_pending[i];
+        if (pending.tier != tier || pending.device != device) {
+          continue;
+        }
+        uint32_t offset;
+        int32_t  id = rollup_locate(tier, device, pending.bucket, &offset);
+        if (!rollup_open_writer(id) || !_rollup_writer.seek(offset) ||
+            _rollup_writer.write((const uint8_t*)&pending.record, rollup_record_size(tier)) !=
+                rollup_record_size(tier)) {
+          _rollup_stats.failures++;
+          continue;
+        }
+        _rollup_stats.records++;
+      }
+    }
+  }
+  rollup_close_writer();
+  _rollup_pending_count       = 0;
+  _rollup_flush_due           = false;
+  _rollup_stats.last_duration = time_us_32() - started;
+}
+
+/**
+ * Write the queued records once an hour was closed. Run every minute by the
+ * task scheduler. While the file system is shared over USB, records wait.
+ */
+void rollup_service() {
+  if (_rollup_flush_due && is_filesystem_safe()) {
+    rollup_flush();
+  }
+}
+
+/**
+ * Find a record that has not been written yet.
+ */
+const rollup_pending_t* rollup_find_pending(uint8_t tier, uint8_t device, uint32_t bucket) {
+  for (uint16_t i = _rollup_pending_count; i > 0; i--) {
+    const rollup_pending_t& pending = _rollup_pending[i - 1];
+    if (pending.tier == tier && pending.device == device && pending.bucket == bucket) {
+      return &pending;
+    }
+  }
+  return nullptr;
+}
+
+/**
+ * Read a slot of a tier file into record, which is rollup_record_size(tier)
+ * bytes.
+ *
+ * \return false if the file could not be read or the slot holds another bucket
+ */
+bool rollup_read_slot(uint8_t tier, uint8_t device, uint32_t bucket, void* record) {
+  const rollup_pending_t* pending = rollup_find_pending(tier, device, bucket);
+  if (pending != nullptr) {
+    memcpy(record, &pending->record, rollup_record_size(tier));
+    return true;
+  }
+
+  uint32_t offset;
+  int32_t  id = rollup_locate(tier, device, bucket, &offset);
+  if (id != _rollup_reader_id) {
+    char name[32];
+    rollup_file_name(name, sizeof(name), id);
+    _rollup_reader.close();
+    _rollup_reader_id = -1;
+    if (!LittleFS.exists(name)) {
+      return false;
+    }
+    _rollup_reader = LittleFS.open(name, "r");
+    if (!_rollup_reader) {
+      return false;
+    }
+    _rollup_reader_id = id;
+  }
+  uint16_t tag;
+  if (!_rollup_reader.seek(offset) ||
+      _rollup_reader.read((uint8_t*)record, rollup_record_size(tier)) != rollup_record_size(tier)) {
+    return false;
+  }
+  memcpy(&tag, record, sizeof(tag));
+  return tag == ROLLUP_TAG(bucket);
+}
+
+/**
+ * Read the one-minute sample of a sensor.
+ *
+ * \param minute seconds since the epoch over 60
+ * \return false if the sensor was not sampled that minute or the minute is
+ *         no longer kept
+ */
+bool rollup_read_minute(uint8_t device, uint32_t minute, rollup_minute_t* sample) {
+  return device < ROLLUP_DEVICES && rollup_read_slot(ROLLUP_MINUTE, device, minute, sample);
+}
+
+/**
+ * Read the 15-minute or hourly record of a sensor. The bucket being filled is
+ * read from its running totals.
+ *
+ * \param bucket seconds since the epoch over rollup_bucket_seconds(tier)
+ * \return false if nothing was sampled in the bucket or it is no longer kept
+ */
+bool rollup_read(uint8_t tier, uint8_t device, uint32_t bucket, rollup_record_t* record) {
+  if (tier == ROLLUP_MINUTE || tier >= ROLLUP_TIER_COUNT || device >= ROLLUP_DEVICES) {
+    return false;
+  }
+  const rollup_accumulator_t& open = _rollup_open[device][tier - 1];
+  if (open.samples > 0 && open.bucket == bucket) {
+    rollup_make_record(open, record);
+    return true;
+  }
+  return rollup_read_slot(tier, device, bucket, record);
+}
+
+const rollup_stats_t* rollup_stats() {
+  return &_rollup_stats;
+}
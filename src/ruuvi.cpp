@@ -12,14 +12,20 @@
 #include <string>
 #include <vector>
 
+#include "boot.h"
 #include "common.h"
 #include "configuration.h"
 #include "ruuvi_types.h"
+#include "tasks.h"
+#include "warm_state_types.h"
+#include "zone_types.h"
+#include "zones.h"
 
 std::vector<BD_ADDR>      _ruuvi_devices;
-std::vector<uint8_t>      _ruuvi_outdoor_sensor;
+std::vector<uint8_t>      _ruuvi_zone;
 std::vector<ruuvi_data_t> _ruuvi_readings;
 std::vector<time_t>       _ruuvi_reading_time;
+std::vector<uint32_t>     _ruuvi_heard_at;
 
 bool _ruuvi_devices_configured = false;
 
@@ -29,17 +35,24 @@ void setup_ruuvi_devices() {
   if (configured()) {
     size_t devices = configuration.ruuvi.devices.size();
 
+    zones_clear();
     for (size_t i = 0; i < devices; i++) {
       ruuvi_data_t ruuvi_entry;
+      uint8_t      zone = zone_intern(configuration.ruuvi.devices[i].placement.c_str());
+      if (zone == ZONE_NONE) {
+        Serial.print(F("Too many zones, not averaging "));
+        Serial.println(configuration.ruuvi.devices[i].name.c_str());
+      }
       _ruuvi_devices.push_back(configuration.ruuvi.devices[i].addr);
-      _ruuvi_outdoor_sensor.push_back(
-          !strcmp("outdoor", configuration.ruuvi.devices[i].placement.c_str()));
+      _ruuvi_zone.push_back(zone);
       _ruuvi_readings.push_back(ruuvi_entry);
       _ruuvi_reading_time.push_back(time(nullptr));
+      _ruuvi_heard_at.push_back(0);
     }
     _ruuvi_devices.shrink_to_fit();
     _ruuvi_reading_time.shrink_to_fit();
-    _ruuvi_outdoor_sensor.shrink_to_fit();
+    _ruuvi_heard_at.shrink_to_fit();
+    _ruuvi_zone.shrink_to_fit();
     _ruuvi_readings.shrink_to_fit();
     _ruuvi_devices_configured = true;
   }
@@ -69,16 +82,61 @@ bool ruuvi_devices_configured() {
   return _ruuvi_devices_configured;
 }
 
-std::vector<uint8_t> ruuvi_outdoor_sensor() {
-  return _ruuvi_outdoor_sensor;
-}
-
 std::vector<ruuvi_data_t> ruuvi_readings() {
   return _ruuvi_readings;
 }
 
+uint8_t ruuvi_device_count() {
+  return _ruuvi_readings.size();
+}
+
+/**
+ * \return the zone of a device, ZONE_NONE if it is not in any
+ */
+uint8_t ruuvi_zone(uint8_t i) {
+  return _ruuvi_zone[i];
+}
+
+bool ruuvi_is_outdoor(uint8_t i) {
+  return zone_is_outdoor(_ruuvi_zone[i]);
+}
+
+/**
+ * Get the latest reading from one device without copying the whole table.
+ * The reading is copied with interrupts off, as the Bluetooth callback may be
+ * storing a new one.
+ */
+ruuvi_data_t ruuvi_reading(uint8_t i) {
+  noInterrupts();
+  ruuvi_data_t reading = _ruuvi_readings[i];
+  interrupts();
+  return reading;
+}
+
+time_t ruuvi_reading_time(uint8_t i) {
+  return _ruuvi_reading_time[i];
+}
+
+/**
+ * \return millis() when the device was last heard from, 0 if it was not heard
+ *         from since boot
+ */
+uint32_t ruuvi_heard_at(uint8_t i) {
+  return _ruuvi_heard_at[i];
+}
+
+/**
+ * Store the latest reading from a device. Called from the Bluetooth callback,
+ * asks for the display to be updated when something shown on it changed.
+ */
 void store_ruuvi_reading(uint8_t i, ruuvi_data_t rdata) {
+  bool changed = (_ruuvi_readings[i].temperature != rdata.temperature || _ruuvi_readings[i].humidity != rdata.humidity);
   _ruuvi_readings[i] = rdata;
+  _ruuvi_heard_at[i] = max(millis(), (unsigned long)1);
+  boot_first_reading();
+  if (changed) {
+    request_render();
+  }
 }
 
 std::vector<time_t> ruuvi_reading_times() {
@@ -88,3 +146,29 @@ std::vector<time_t> ruuvi_reading_times() {
 void store_ruuvi_reading_time(size_t i, time_t time) {
   _ruuvi_reading_time[i] = time;
 }
+
+/**
+ * Copy the latest readings into a snapshot.
+ */
+void save_ruuvi_state(warm_state_t* state) {
+  state->device_count = min(_ruuvi_readings.size(), (size_t)WARM_STATE_DEVICES);
+  for (uint8_t i = 0; i < state->device_count; i++) {
+    state->readings[i]      = _ruuvi_readings[i];
+    state->reading_times[i] = _ruuvi_reading_time[i];
+  }
+}
+
+/**
+ * Show the readings from a snapshot until the sensors are heard from again.
+ * Skipped if the configured sensors changed since the snapshot was taken.
+ */
+void restore_ruuvi_state(const warm_state_t* state) {
+  if (state->device_count == 0 || state->device_count != _ruuvi_readings.size()) {
+    return;
+  }
+  for (uint8_t i = 0; i < state->device_count; i++) {
+    _ruuvi_readings[i]     = state->readings[i];
+    _ruuvi_reading_time[i] = state->reading_times[i];
+  }
+  request_render();
+}
@@ -0,0 +1,147 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "segments.h"
+
+#include <Arduino.h>
+#include <U8g2lib.h>
+
+#include "common.h"
+#include "segments_glyphs.h"
+
+/**
+ * Find the pre-rasterized glyph for a code point.
+ */
+const segments_glyph_t* find_segments_glyph(uint16_t encoding) {
+  for (uint8_t i = 0; i < sizeof(segments_glyphs) / sizeof(segments_glyph_t); i++) {
+    if (segments_glyphs[i].encoding == encoding) {
+      return &segments_glyphs[i];
+    }
+  }
+  return nullptr;
+}
+
+/**
+ * Look up the glyphs for a UTF-8 string.
+ *
+ * \return the number of glyphs, or -1 if the string has anything without a
+ *         pre-rasterized glyph
+ */
+int8_t decode_segments(const char* text, const segments_glyph_t** glyphs) {
+  int8_t count = 0;
+  while (*text) {
+    uint8_t  c        = *text++;
+    uint16_t encoding = c;
+    if ((c & 0xe0) == 0xc0 && (*text & 0xc0) == 0x80) {
+      encoding = ((c & 0x1f) << 6) | (*text++ & 0x3f);
+    } else if (c & 0x80) {
+      return -1;
+    }
+    if (count >= SEGMENTS_MAX_GLYPHS) {
+      return -1;
+    }
+    glyphs[count] = find_segments_glyph(encoding);
+    if (glyphs[count] == nullptr) {
+      return -1;
+    }
+    count++;
+  }
+  return count;
+}
+
+/**
+ * Measure a string the way u8g2 does, the last glyph only counts for its ink.
+ *
+ * \return false if the string cannot be drawn with the pre-rasterized glyphs
+ */
+bool segments_width(const char* text, uint16_t* width) {
+  const segments_glyph_t* glyphs[SEGMENTS_MAX_GLYPHS];
+  int8_t                  count = decode_segments(text, glyphs);
+  if (count < 0) {
+    return false;
+  }
+  *width = 0;
+  for (int8_t i = 0; i < count; i++) {
+    *width += (i == count - 1 ? glyphs[i]->ink_width : glyphs[i]->advance);
+  }
+  return true;
+}
+
+/**
+ * Draw a string with the pre-rasterized glyphs, straight into the frame
+ * buffer. Only works with the display turned with U8G2_R3, where a row of a
+ * glyph is a run of bits across at most three tile rows of the buffer.
+ *
+ * \param x left edge of the string
+ * \param y baseline of the string
+ * \return false if nothing was drawn, draw with drawUTF8() instead
+ */
+bool draw_segments(U8G2& u8g2, int16_t x, int16_t y, const char* text) {
+  const segments_glyph_t* glyphs[SEGMENTS_MAX_GLYPHS];
+  int8_t                  count = decode_segments(text, glyphs);
+  if (count < 0 || u8g2.getU8g2()->cb != U8G2_R3) {
+    return false;
+  }
+
+  uint8_t* buffer  = u8g2.getBufferPtr();
+  int16_t  columns = u8g2.getBufferTileWidth() * 8;
+  int16_t  pages   = u8g2.getBufferTileHeight();
+  int16_t  top     = y - SEGMENTS_GLYPH_ROWS;
+
+  for (int8_t i = 0; i < count; i++) {
+    // Bit 0 of a row ends up at this position down the physical display.
+    int16_t base = pages * 8 - SEGMENTS_GLYPH_ROWS - x;
+    for (uint8_t r = 0; r < SEGMENTS_GLYPH_ROWS; r++) {
+      int16_t  column = top + r;
+      uint32_t bits   = glyphs[i]->rows[r];
+      if (bits == 0 || column < 0 || column >= columns) {
+        continue;
+      }
+      int16_t start = base;
+      if (start < 0) {
+        bits >>= -start;
+        start = 0;
+      }
+      bits <<= (start & 7);
+      for (int16_t page = start >> 3; bits && page < pages; page++, bits >>= 8) {
+        buffer[page * columns + column] |= bits & 0xff;
+      }
+    }
+    x += glyphs[i]->advance;
+  }
+  return true;
+}
+
+#ifdef HEM_BENCHMARK
+/**
+ * Compare drawing a temperature with u8g2 and with the pre-rasterized glyphs.
+ * Build with -DHEM_BENCHMARK and watch the serial output.
+ */
+void benchmark_segments() {
+  const char* text   = "-10.5°C";
+  U8G2        u8g2   = get_display();
+  uint32_t    rounds = 100;
+
+  u8g2.setFont(font_segments_12x17);
+  u8g2.setFontMode(1);
+  uint32_t start = rp2040.getCycleCount();
+  for (uint32_t i = 0; i < rounds; i++) {
+    u8g2.drawUTF8(20, 40, text);
+  }
+  uint32_t u8g2_cycles = (rp2040.getCycleCount() - start) / rounds;
+
+  start = rp2040.getCycleCount();
+  for (uint32_t i = 0; i < rounds; i++) {
+    draw_segments(u8g2, 20, 40, text);
+  }
+  uint32_t segments_cycles = (rp2040.getCycleCount() - start) / rounds;
+  u8g2.clearBuffer();
+
+  Serial.print(F("drawUTF8 cycles per call: "));
+  Serial.println(u8g2_cycles);
+  Serial.print(F("draw_segments cycles per call: "));
+  Serial.println(segments_cycles);
+}
+#endif
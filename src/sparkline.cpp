@@ -0,0 +1,211 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "sparkline.h"
+
+#include <Arduino.h>
+#include <U8g2lib.h>
+#include <string.h>
+
+#include "common.h"
+#include "profile.h"
+#include "rollup.h"
+#include "rollup_types.h"
+#include "ruuvi.h"
+#include "ruuvi_types.h"
+#include "sparkline_types.h"
+#include "timekeeping_types.h"
+
+// Ring of the last 24 hours, a column is found from its number alone.
+sparkline_column_t _sparkline_columns[SPARKLINE_COLUMNS];
+uint32_t           _sparkline_newest                      = 0; // Newest column, 0 before the clock is set
+uint32_t           _sparkline_backfill                    = 0; // Next column to fill from the rollups, 0 when done
+uint32_t           _sparkline_version                     = 0;
+bool               _sparkline_has_range                   = false;
+int16_t            _sparkline_low[SPARKLINE_SERIES_COUNT]  = {0};
+int16_t            _sparkline_high[SPARKLINE_SERIES_COUNT] = {0};
+
+static_assert(SPARKLINE_SERIES_COUNT == 2, "sparkline_column_t holds two series");
+
+bool sparkline_shown(const sparkline_column_t& slot) {
+  return slot.column != 0 && slot.column + SPARKLINE_COLUMNS > _sparkline_newest;
+}
+
+void sparkline_extend(const int16_t* low, const int16_t* high) {
+  for (uint8_t series = 0; series < SPARKLINE_SERIES_COUNT; series++) {
+    if (!_sparkline_has_range || low[series] < _sparkline_low[series]) {
+      _sparkline_low[series] = low[series];
+    }
+    if (!_sparkline_has_range || high[series] > _sparkline_high[series]) {
+      _sparkline_high[series] = high[series];
+    }
+  }
+  _sparkline_has_range = true;
+}
+
+/**
+ * Move the right edge of the sparklines to a new column. The range is worked
+ * out again from the columns still shown, which only happens when a column
+ * drops out, every 11 minutes and 15 seconds.
+ */
+void sparkline_advance(uint32_t column) {
+  if (column <= _sparkline_newest) {
+    return;
+  }
+  _sparkline_newest    = column;
+  _sparkline_has_range = false;
+  for (uint8_t i = 0; i < SPARKLINE_COLUMNS; i++) {
+    if (sparkline_shown(_sparkline_columns[i])) {
+      sparkline_extend(_sparkline_columns[i].min, _sparkline_columns[i].max);
+    }
+  }
+  _sparkline_version++;
+}
+
+/**
+ * Take a value of each series into the minimum and maximum of a column. Only
+ * widens the range, so it is kept up to date without another pass.
+ */
+void sparkline_add(uint32_t column, const int16_t* values) {
+  sparkline_column_t& slot = _sparkline_columns[column % SPARKLINE_COLUMNS];
+  if (column > _sparkline_newest || column + SPARKLINE_COLUMNS <= _sparkline_newest) {
+    return;
+  }
+  if (slot.column != column) {
+    slot.column = column;
+    memcpy(slot.min, values, sizeof(slot.min));
+    memcpy(slot.max, values, sizeof(slot.max));
+  } else {
+    for (uint8_t series = 0; series < SPARKLINE_SERIES_COUNT; series++) {
+      slot.min[series] = min(slot.min[series], values[series]);
+      slot.max[series] = max(slot.max[series], values[series]);
+    }
+  }
+  sparkline_extend(values, values);
+  _sparkline_version++;
+}
+
+/**
+ * Add the outdoor average of the latest readings to the sparklines. Sensors
+ * not heard from in the last five minutes are left out, as for the rollups.
+ * Called by the clock task on every new minute.
+ */
+void sparkline_sample(const time_context_t& now) {
+  if (!now.valid || !ruuvi_devices_configured()) {
+    return;
+  }
+  uint32_t column = now.utc / SPARKLINE_COLUMN_SECONDS;
+  if (_sparkline_newest == 0) {
+    // Fill in the day before the first sample from the minute rollups.
+    _sparkline_backfill = column;
+  }
+  sparkline_advance(column);
+
+  int32_t temperature = 0;
+  int32_t pressure    = 0;
+  uint8_t count       = 0;
+  for (uint8_t i = 0; i < ruuvi_device_count(); i++) {
+    uint32_t heard_at = ruuvi_heard_at(i);
+    if (!ruuvi_is_outdoor(i) || heard_at == 0 || millis() - heard_at > ROLLUP_STALE_AFTER) {
+      continue;
+    }
+    ruuvi_data_t reading = ruuvi_reading(i);
+    temperature += lroundf(reading.temperature * 100);
+    pressure += reading.pressure;
+    count++;
+  }
+  if (count > 0) {
+    int16_t values[SPARKLINE_SERIES_COUNT] = {(int16_t)(temperature / count), (int16_t)(pressure / count / 10)};
+    sparkline_add(column, values);
+  }
+}
+
+/**
+ * Fill the columns from before the first sample, newest first, from the
+ * minute rollups of the outdoor sensors among the first ROLLUP_DEVICES. A few
+ * columns are done per run, so a boot does not hold up the other tasks. Run
+ * every minute by the task scheduler.
+ */
+void sparkline_service() {
+  if (!is_filesystem_safe()) {
+    return;
+  }
+  uint8_t devices = min(ruuvi_device_count(), (uint8_t)ROLLUP_DEVICES);
+  for (uint8_t i = 0; i < SPARKLINE_BACKFILL_COLUMNS && _sparkline_backfill > 0; i++) {
+    uint32_t column = _sparkline_backfill;
+    if (column + SPARKLINE_COLUMNS <= _sparkline_newest) {
+      _sparkline_backfill = 0;
+      break;
+    }
+    uint32_t first = (column * SPARKLINE_COLUMN_SECONDS + 59) / 60;
+    uint32_t last  = ((column + 1) * SPARKLINE_COLUMN_SECONDS + 59) / 60;
+    for (uint32_t minute = first; minute < last; minute++) {
+      int32_t temperature = 0;
+      int32_t pressure    = 0;
+      uint8_t count       = 0;
+      for (uint8_t device = 0; device < devices; device++) {
+        rollup_minute_t sample;
+        if (ruuvi_is_outdoor(device) && rollup_read_minute(device, minute, &sample)) {
+          temperature += sample.temperature;
+          pressure += sample.pressure + ROLLUP_PRESSURE_BASE;
+          count++;
+        }
+      }
+      if (count > 0) {
+        int16_t values[SPARKLINE_SERIES_COUNT] = {(int16_t)(temperature / count), (int16_t)(pressure / count / 10)};
+        sparkline_add(column, values);
+      }
+    }
+    _sparkline_backfill--;
+  }
+}
+
+/**
+ * \return false if there is nothing to draw yet
+ */
+bool sparkline_range(uint8_t series, int16_t* low, int16_t* high) {
+  if (!_sparkline_has_range || series >= SPARKLINE_SERIES_COUNT) {
+    return false;
+  }
+  *low  = _sparkline_low[series];
+  *high = _sparkline_high[series];
+  return true;
+}
+
+/**
+ * \return a number that changes whenever the sparklines would look different
+ */
+uint32_t sparkline_version() {
+  return _sparkline_version;
+}
+
+/**
+ * Draw a series across the full width of the display, the oldest column to
+ * the left, in one pass over the columns. Each column is a vertical line from
+ * its minimum to its maximum, scaled to the range of the whole day.
+ *
+ * \param y top edge of the graph
+ * \param height height of the graph in pixels
+ */
+void draw_sparkline(U8G2& u8g2, uint8_t series, int16_t y, uint8_t height) {
+  PROFILE_STAGE(PROFILE_DRAW_SPARKLINE);
+  int16_t low;
+  int16_t high;
+  if (!sparkline_range(series, &low, &high) || height < 2) {
+    return;
+  }
+  int32_t span   = max(high - low, 1);
+  int16_t bottom = y + height - 1;
+  for (uint8_t x = 0; x < SPARKLINE_COLUMNS; x++) {
+    uint32_t                  column = _sparkline_newest + 1 - SPARKLINE_COLUMNS + x;
+    const sparkline_column_t& slot   = _sparkline_columns[column % SPARKLINE_COLUMNS];
+    if (slot.column != column) {
+      continue;
+    }
+    int16_t top = bottom - (int32_t)(slot.max[series] - low) * (height - 1) / span;
+    int16_t end = bottom - (int32_t)(slot.min[series] - low) * (height - 1) / span;
+    u8g2.drawVLine(x, top, end - top + 1);
+  }
+}
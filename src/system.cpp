@@ -9,17 +9,21 @@
 #include <common.h>
 #include <inttypes.h>
 
+#include "breadcrumb.h"
 #include "common.h"
+#include "display.h"
+#include "pages.h"
+#include "profile.h"
 
 uint8_t   _ambient_light    = 255;
 uint16_t  adc_min           = 0; // Set this one to something else if you want.
 uint16_t  adc_max           = 1023;
-uint32_t  light_timer       = 0;
 uint32_t  powersave_timer   = 0;
 bool      backlight_on      = true;
 PinStatus _pir_state        = PinStatus::LOW;
-uint32_t  watchdog_timer    = 0;
 bool      _watchdog_running = false;
+uint8_t   _contrast_sent    = 0;  // Contrast last sent to the display, 0 if none
+int8_t    _power_save_sent  = -1; // Power save mode last sent to the display, -1 if none
 /**
  * Reads a LDR connected between pins PIN_LDR_PWR and PIN_LDR. Stores the
  * reading as an unsigned 8 bit integer.
@@ -59,21 +63,35 @@ void check_ambient_light() {
 
 /**
  * Controls the backlight level of the OLED screen. Reads the current ambient
- * light level and sets the display backlight accordingly.
+ * light level and sets the display backlight accordingly. Only changes are
+ * sent to the display. Run once a second by the task scheduler.
  */
 void control_backlight() {
-  if ((millis() - light_timer) < 1000) {
+  PROFILE_STAGE(PROFILE_CONTROL_BACKLIGHT);
+  check_ambient_light();
+  int8_t power_save = _power_save_sent;
+  if (backlight_on) {
+    power_save = 0;
+  } else if ((millis() - powersave_timer) >= 20000) {
+    power_save = 1;
+  }
+  if (power_save == _power_save_sent && _ambient_light == _contrast_sent) {
+    return;
+  }
+  // Commands must not be mixed into a frame that is still being sent. If the
+  // frame takes too long, the commands wait for the next run.
+  if (!display_wait()) {
     return;
   }
   U8G2 u8g2 = get_display();
-  if (backlight_on) {
-    u8g2.setPowerSave(0);
-  } else if (!backlight_on && ((millis() - powersave_timer) >= 20000)) {
-    u8g2.setPowerSave(1);
+  if (power_save != _power_save_sent) {
+    u8g2.setPowerSave(power_save);
+    _power_save_sent = power_save;
+  }
+  if (_ambient_light != _contrast_sent) {
+    u8g2.setContrast(_ambient_light);
+    _contrast_sent = _ambient_light;
   }
-  check_ambient_light();
-  light_timer = millis();
-  u8g2.setContrast(_ambient_light);
 }
 
 /**
@@ -87,8 +105,6 @@ void setup_backlight() {
 #else
   pinMode(PIN_LDR_PWR, PinMode::OUTPUT);
 #endif
-
-  light_timer = millis();
 }
 
 void pir_triggered() {
@@ -97,6 +113,7 @@ void pir_triggered() {
     // backlight_on = true;
     if (millis() - powersave_timer >= 1000) {
       powersave_timer = millis();
+      page_next();
     }
   } else if (_pir_state == PinStatus::LOW || _pir_state == PinStatus::FALLING) {
     // backlight_on = false;
@@ -122,16 +139,17 @@ void pir_deinit() {
 }
 
 void start_watchdog() {
-  watchdog_timer = millis();
   rp2040.wdt_begin(8000);
   _watchdog_running = true;
 }
 
+/**
+ * Reset the watchdog, run every five seconds by the task scheduler. The uptime
+ * in the breadcrumb is updated at the same time.
+ */
 void feed_watchdog() {
-  if ((millis() - watchdog_timer) >= 5000) {
-    rp2040.wdt_reset();
-    watchdog_timer = millis();
-  }
+  rp2040.wdt_reset();
+  breadcrumb_uptime(millis() / 1000);
 }
 
 bool watchdog_running() {
@@ -0,0 +1,352 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#define _TASK_SLEEP_ON_IDLE_RUN
+#include "tasks.h"
+
+#include <Arduino.h>
+#include <TaskScheduler.h>
+#include <pico/time.h>
+#include <time.h>
+
+#include "boot.h"
+#include "breadcrumb.h"
+#include "climate.h"
+#include "common.h"
+#include "configuration.h"
+#include "display.h"
+#include "forecast.h"
+#include "history.h"
+#include "logging.h"
+#include "memory_stats.h"
+#include "network_time.h"
+#include "pages.h"
+#include "profile.h"
+#include "query.h"
+#include "rollup.h"
+#include "ruuvi.h"
+#include "sparkline.h"
+#include "system.h"
+#include "telemetry.h"
+#include "timekeeping.h"
+#include "usb_drive.h"
+#include "warm_state.h"
+#include "widgets.h"
+#include "wireless.h"
+
+void boot_callback();
+void wireless_callback();
+void scanning_callback();
+void render_callback();
+void pressure_callback();
+void backlight_callback();
+void watchdog_callback();
+void memory_callback();
+void warm_state_callback();
+void clock_callback();
+void telemetry_callback();
+void history_callback();
+void days_callback();
+void page_callback();
+#ifdef HEM_PROFILE
+void profile_callback();
+#endif
+
+Scheduler scheduler;
+
+Task boot_task(TASK_PERIOD_BOOT * TASK_MILLISECOND, TASK_FOREVER, &boot_callback, &scheduler, false);
+Task wireless_task(TASK_PERIOD_WIRELESS * TASK_MILLISECOND, TASK_FOREVER, &wireless_callback, &scheduler, false);
+Task scanning_task(TASK_PERIOD_SCANNING * TASK_MILLISECOND, TASK_FOREVER, &scanning_callback, &scheduler, false);
+Task render_task(TASK_MINUTE, TASK_FOREVER, &render_callback, &scheduler, false);
+Task pressure_task(TASK_PERIOD_PRESSURE * TASK_MILLISECOND, TASK_FOREVER, &pressure_callback, &scheduler, false);
+Task backlight_task(TASK_PERIOD_BACKLIGHT * TASK_MILLISECOND, TASK_FOREVER, &backlight_callback, &scheduler, false);
+Task watchdog_task(TASK_PERIOD_WATCHDOG * TASK_MILLISECOND, TASK_FOREVER, &watchdog_callback, &scheduler, false);
+Task memory_task(TASK_PERIOD_MEMORY * TASK_MILLISECOND, TASK_FOREVER, &memory_callback, &scheduler, false);
+Task warm_state_task(TASK_PERIOD_WARM_STATE * TASK_MILLISECOND, TASK_FOREVER, &warm_state_callback, &scheduler,
+                     false);
+Task clock_task(CLOCK_ADJUST_INTERVAL * TASK_MILLISECOND, TASK_FOREVER, &clock_callback, &scheduler, false);
+Task telemetry_task(TASK_PERIOD_TELEMETRY * TASK_MILLISECOND, TASK_FOREVER, &telemetry_callback, &scheduler, false);
+Task history_task(TASK_PERIOD_HISTORY * TASK_MILLISECOND, TASK_FOREVER, &history_callback, &scheduler, false);
+Task days_task(TASK_PERIOD_DAYS * TASK_MILLISECOND, TASK_FOREVER, &days_callback, &scheduler, false);
+Task page_task(TASK_PERIOD_PAGE * TASK_MILLISECOND, TASK_FOREVER, &page_callback, &scheduler, false);
+#ifdef HEM_PROFILE
+Task profile_task(PROFILE_DUMP_INTERVAL * TASK_MILLISECOND, TASK_FOREVER, &profile_callback, &scheduler, false);
+#endif
+
+Task* scheduled_tasks[] = {&boot_task,       &wireless_task,  &scanning_task,  &render_task,
+                           &pressure_task,   &backlight_task, &watchdog_task,  &memory_task,
+                           &warm_state_task, &clock_task,     &telemetry_task, &history_task,
+                           &days_task,       &page_task,
+#ifdef HEM_PROFILE
+                           &profile_task
+#endif
+};
+
+volatile bool _render_requested = false;
+
+/**
+ * Step through the boot phases, starting the tasks each phase makes possible.
+ * Once the radio is handed over it only waits for the first reading, to print
+ * the boot metrics.
+ */
+void boot_callback() {
+  switch (boot_step()) {
+    case BOOT_SCREEN:
+      render_task.enable();
+      break;
+    case BOOT_RADIO:
+      wireless_task.enable();
+      scanning_task.enable();
+      boot_task.setInterval(TASK_SECOND);
+      break;
+    case BOOT_DONE:
+      boot_task.disable();
+      break;
+  }
+}
+
+/**
+ * Bring the wireless hardware to the state the system needs.
+ */
+void wireless_callback() {
+  if (configuration_loaded()) {
+    control_wireless();
+  }
+}
+
+/**
+ * Toggle Bluetooth scanning, and start the watchdog once Bluetooth is up.
+ */
+void scanning_callback() {
+  if (bluetooth_configured()) {
+    control_bluetooth_scanning();
+    if (!watchdog_running()) {
+      start_watchdog();
+      watchdog_task.enableIfNot();
+    }
+  }
+}
+
+/**
+ * Update the widgets from current values and send what changed to the
+ * display. Runs when something requests it, the clock task does on every new
+ * minute.
+ */
+void render_callback() {
+  _render_requested = false;
+  memory_pass_begin();
+
+  const time_context_t& now = time_context();
+  if (configured()) {
+    print_wifi_status();
+    print_time(now);
+  } else {
+    load_config_file();
+  }
+
+  if (configured() && bluetooth_configured()) {
+    print_bluetooth_status();
+  }
+  if (configured() && ruuvi_devices_configured()) {
+    // Readings restored at boot are shown before Bluetooth is up.
+    print_page();
+    print_forecast_icon(now);
+  } else if (configured() && bluetooth_configured()) {
+    setup_ruuvi_devices();
+  }
+
+  render_widgets();
+  if (configured() && ruuvi_devices_configured()) {
+    draw_page();
+  }
+  uint32_t deferred = display_frames_deferred();
+  display_update();
+  memory_pass_end();
+
+  if (display_frames_deferred() != deferred) {
+    // The previous frame was still being sent, try again shortly.
+    render_task.delay(20 * TASK_MILLISECOND);
+  } else if (now.valid) {
+    // The clock task asks for a render on every new minute.
+    render_task.delay(TASK_MINUTE);
+  } else {
+    render_task.delay(TASK_SECOND);
+  }
+}
+
+void pressure_callback() {
+  if (configured() && bluetooth_configured() && ruuvi_devices_configured()) {
+    process_pressure();
+  }
+  // Keeps the samples a trend interval apart instead of on the task period.
+  pressure_task.delay(pressure_sample_delay());
+}
+
+void backlight_callback() {
+  control_backlight();
+}
+
+void watchdog_callback() {
+  if (watchdog_running()) {
+    feed_watchdog();
+  }
+#ifdef HEM_PROFILE
+  // Time between feeds, how close the loop came to a watchdog reset.
+  static uint32_t last_feed = 0;
+  uint32_t        now       = time_us_32();
+  if (last_feed != 0) {
+    profile_record(PROFILE_WATCHDOG_INTERVAL, now - last_feed);
+  }
+  last_feed = now;
+#endif
+}
+
+/**
+ * Sample heap and stack use and print the rolling summary.
+ */
+void memory_callback() {
+  memory_sample();
+  memory_print_summary();
+  breadcrumb_heap(memory_latest()->heap_free, memory_latest()->largest_block);
+}
+
+/**
+ * Keep the clock disciplined and work out the time for everything else to
+ * share. Date and minute changes are handled here, so they fire exactly once.
+ */
+void clock_callback() {
+  clock_adjust();
+  const time_context_t& now = time_tick();
+  if (now.date_changed) {
+    configure_sunset(now);
+  }
+  if (now.utc_changed) {
+    days_task.enableIfNot();
+  }
+  if (now.minute_changed) {
+    rollup_sample(now);
+    sparkline_sample(now);
+    request_render();
+  }
+}
+
+/**
+ * Answer telemetry requests from the host, polling faster while a response is
+ * being sent. The USB drive is handed over to the host from here as well.
+ */
+void telemetry_callback() {
+  bool busy = telemetry_poll();
+#ifdef HEM_USB_DRIVE
+  usb_drive_service();
+#endif
+  telemetry_task.setInterval((busy ? TASK_PERIOD_TELEMETRY_BUSY : TASK_PERIOD_TELEMETRY) * TASK_MILLISECOND);
+}
+
+/**
+ * Write out the reading history and the rollups when they are due, and keep
+ * the sparklines up to date with them.
+ */
+void history_callback() {
+  history_service();
+  rollup_service();
+  sparkline_service();
+}
+
+/**
+ * Add the days that ended to the query trees. Started by the clock task when
+ * the UTC date changes, including when the clock is first set, and stopped
+ * once every tree has caught up.
+ */
+void days_callback() {
+  if (!query_service()) {
+    days_task.disable();
+  }
+}
+
+/**
+ * Show the next page of the display.
+ */
+void page_callback() {
+  if (ruuvi_devices_configured()) {
+    page_next();
+  }
+}
+
+void warm_state_callback() {
+  if (ruuvi_devices_configured()) {
+    save_warm_state();
+  }
+}
+
+#ifdef HEM_PROFILE
+void profile_callback() {
+  profile_dump();
+}
+#endif
+
+/**
+ * Called by the scheduler when a pass had nothing to run. Drains some of the
+ * deferred log, then sleeps in WFE until the next task is due, an interrupt
+ * fires or something signals an event.
+ */
+void idle_callback(unsigned long duration) {
+  if (_render_requested) {
+    render_task.forceNextIteration();
+    return;
+  }
+  log_drain();
+  // Come back soon if the log could not be drained all at once, but not while
+  // the port is full, the host may not be reading it at all.
+  long sleep = (log_pending() > 0 && log_ready() ? 1 : TASK_MAX_SLEEP);
+  for (uint8_t i = 0; i < sizeof(scheduled_tasks) / sizeof(Task*); i++) {
+    if (scheduled_tasks[i]->isEnabled()) {
+      long until = scheduler.timeUntilNextIteration(*scheduled_tasks[i]);
+      if (until >= 0 && until < sleep) {
+        sleep = until;
+      }
+    }
+  }
+  if (sleep > 0) {
+    best_effort_wfe_or_timeout(make_timeout_time_ms(sleep));
+  }
+}
+
+/**
+ * Set up the scheduled tasks, replacing the fixed delay loop.
+ */
+void setup_tasks() {
+  scheduler.setSleepMethod(&idle_callback);
+  scheduler.allowSleep(true);
+  // The display and radio tasks are started by the boot sequence, the
+  // watchdog task when the watchdog is started.
+  boot_task.enable();
+  pressure_task.enable();
+  backlight_task.enable();
+  memory_task.enable();
+  warm_state_task.enable();
+  clock_task.enable();
+  telemetry_task.enable();
+  history_task.enable();
+  page_task.enable();
+#ifdef HEM_PROFILE
+  profile_task.enable();
+#endif
+}
+
+/**
+ * Run whatever is due, called from loop().
+ */
+void run_tasks() {
+  scheduler.execute();
+}
+
+/**
+ * Ask for the display to be updated as soon as possible. Safe to call from
+ * interrupts and the Bluetooth callbacks.
+ */
+void request_render() {
+  _render_requested = true;
+  __sev();
+}
@@ -0,0 +1,312 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "telemetry.h"
+
+#include <Arduino.h>
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+#include "checksum.h"
+#include "common.h"
+#include "history.h"
+#include "history_types.h"
+#include "http_server.h"
+#include "memory_stats.h"
+#include "profile.h"
+#include "ruuvi.h"
+#include "ruuvi_types.h"
+#include "timekeeping.h"
+#include "uplink.h"
+#include "uplink_types.h"
+#include "wireless.h"
+
+// A request is COBS encoded too, so it is at most one byte longer.
+uint8_t  _telemetry_request[TELEMETRY_REQUEST_SIZE + 4 + 1];
+uint8_t  _telemetry_request_length = 0;
+bool     _telemetry_overflow       = false;
+uint8_t  _telemetry_command        = TELEMETRY_COMMAND_COUNT; // The response being sent, if any
+uint16_t _telemetry_item           = 0;                       // Next item of the response
+uint16_t _telemetry_frame          = 0;                       // Frames of the response sent so far
+
+/**
+ * Encode a frame with Consistent Overhead Byte Stuffing, so it has no zero
+ * bytes, and put a zero before and after it. The leading zero ends any text
+ * printed before the frame, so the host can tell the two apart.
+ *
+ * \return the encoded length, at most length + length / 254 + 3
+ */
+size_t telemetry_cobs_encode(const uint8_t* data, size_t length, uint8_t* out) {
+  size_t  written = 0;
+  size_t  code_at = 1;
+  uint8_t code    = 1;
+  out[written++]  = 0;
+  written++;
+  for (size_t i = 0; i < length; i++) {
+    if (data[i] != 0) {
+      out[written++] = data[i];
+      code++;
+    }
+    if (data[i] == 0 || code == 0xff) {
+      out[code_at] = code;
+      code         = 1;
+      code_at      = written++;
+    }
+  }
+  out[code_at]   = code;
+  out[written++] = 0;
+  return written;
+}
+
+/**
+ * Undo the COBS encoding of a request, in place.
+ *
+ * \return the decoded length, 0 if the encoding is broken
+ */
+size_t telemetry_cobs_decode(uint8_t* data, size_t length) {
+  size_t read    = 0;
+  size_t written = 0;
+  while (read < length) {
+    uint8_t code = data[read++];
+    if (code == 0 || read + code - 1 > length) {
+      return 0;
+    }
+    for (uint8_t i = 1; i < code; i++) {
+      data[written++] = data[read++];
+    }
+    if (code != 0xff && read < length) {
+      data[written++] = 0;
+    }
+  }
+  return written;
+}
+
+uint8_t* telemetry_put_uint16(uint8_t* out, uint16_t value) {
+  memcpy(out, &value, sizeof(value));
+  return out + sizeof(value);
+}
+
+uint8_t* telemetry_put_uint32(uint8_t* out, uint32_t value) {
+  memcpy(out, &value, sizeof(value));
+  return out + sizeof(value);
+}
+
+/**
+ * Encode one item of a response. Numbers are little endian.
+ *
+ *   readings: device (1), outdoor (1), temperature in 0.01 C (2), humidity
+ *             in 0.01 % (2), pressure in Pa (4), age in s (4)
+ *   counters: uptime in s, free heap, largest block, clock drift in ppb,
+ *             WiFi windows, failed windows, ms of scanning lost, readings
+ *             queued, sent, dropped and pending, HTTP requests (4 each)
+ *   profile:  stage (1), max in us (4), PROFILE_BUCKETS counts (4 each)
+ *   history:  time (4), pressure in Pa (4), temperature (2), humidity (2),
+ *             device (1), from the history log
+ *
+ * \param command the request being answered
+ * \param item which item
+ * \param out where to put it
+ * \return the length of the item, 0 if there is no such item
+ */
+size_t telemetry_item(uint8_t command, uint16_t item, uint8_t* out) {
+  uint8_t* start = out;
+  switch (command) {
+    case TELEMETRY_READINGS: {
+      if (item >= ruuvi_device_count()) {
+        return 0;
+      }
+      ruuvi_data_t reading = ruuvi_reading(item);
+      uint32_t     age     = (reading.pressure == 0 ? 0xffffffff : time_context().utc - ruuvi_reading_time(item));
+      *out++               = item;
+      *out++               = ruuvi_is_outdoor(item);
+      out                  = telemetry_put_uint16(out, (int16_t)lroundf(reading.temperature * 100));
+      out                  = telemetry_put_uint16(out, lroundf(reading.humidity * 100));
+      out                  = telemetry_put_uint32(out, reading.pressure);
+      out                  = telemetry_put_uint32(out, age);
+      break;
+    }
+
+    case TELEMETRY_COUNTERS: {
+      if (item > 0) {
+        return 0;
+      }
+      const memory_sample_t*         memory = memory_latest();
+      const wireless_window_stats_t* window = wireless_window_stats();
+      const uplink_stats_t*          uplink = uplink_stats();
+
+      out = telemetry_put_uint32(out, millis() / 1000);
+      out = telemetry_put_uint32(out, memory != nullptr ? memory->heap_free : 0);
+      out = telemetry_put_uint32(out, memory != nullptr ? memory->largest_block : 0);
+      out = telemetry_put_uint32(out, clock_drift());
+      out = telemetry_put_uint32(out, window->windows);
+      out = telemetry_put_uint32(out, window->failed);
+      out = telemetry_put_uint32(out, window->total_lost);
+      out = telemetry_put_uint32(out, uplink->queued);
+      out = telemetry_put_uint32(out, uplink->sent);
+      out = telemetry_put_uint32(out, uplink->dropped);
+      out = telemetry_put_uint32(out, uplink_pending());
+      out = telemetry_put_uint32(out, http_server_requests());
+      break;
+    }
+
+#ifdef HEM_PROFILE
+    case TELEMETRY_PROFILE: {
+      if (item >= PROFILE_STAGE_COUNT) {
+        return 0;
+      }
+      uint32_t max;
+      uint32_t buckets[PROFILE_BUCKETS];
+      profile_histogram(item, &max, buckets);
+      *out++ = item;
+      out    = telemetry_put_uint32(out, max);
+      for (uint8_t bucket = 0; bucket < PROFILE_BUCKETS; bucket++) {
+        out = telemetry_put_uint32(out, buckets[bucket]);
+      }
+      break;
+    }
+#endif
+
+    case TELEMETRY_HISTORY: {
+      history_record_t record;
+      // While the USB drive has the file system, the history is read from there.
+      if (!is_filesystem_safe() || !history_read(item, &record)) {
+        return 0;
+      }
+      out    = telemetry_put_uint32(out, record.time);
+      out    = telemetry_put_uint32(out, record.pressure + HISTORY_PRESSURE_BASE);
+      out    = telemetry_put_uint16(out, record.temperature);
+      out    = telemetry_put_uint16(out, record.humidity);
+      *out++ = record.device;
+      break;
+    }
+
+    default:
+      return 0;
+  }
+  return out - start;
+}
+
+/**
+ * \return true if the USB buffer has room for a whole frame
+ */
+bool telemetry_room() {
+  return Serial.availableForWrite() >= TELEMETRY_ENCODED_SIZE;
+}
+
+/**
+ * Put a header and a CRC-32 around a body and send it as one COBS frame.
+ * Nothing is sent if the USB buffer does not have room for the whole frame.
+ *
+ * \param type the response type, TELEMETRY_ERROR or TELEMETRY_LOG
+ * \param number frame number within the response
+ * \param flags TELEMETRY_LAST or 0
+ * \param body the items, at most TELEMETRY_FRAME_SIZE less header and CRC
+ * \return true if the frame was sent
+ */
+bool telemetry_send(uint8_t type, uint16_t number, uint8_t flags, const uint8_t* body, size_t length) {
+  uint8_t frame[TELEMETRY_FRAME_SIZE];
+  uint8_t encoded[TELEMETRY_ENCODED_SIZE];
+  if (!telemetry_room() || length > TELEMETRY_FRAME_SIZE - TELEMETRY_HEADER_SIZE - 4) {
+    return false;
+  }
+  frame[0] = type;
+  telemetry_put_uint16(frame + 1, number);
+  frame[3] = flags;
+  memcpy(frame + TELEMETRY_HEADER_SIZE, body, length);
+  uint8_t* out = telemetry_put_uint32(frame + TELEMETRY_HEADER_SIZE + length,
+                                      crc32(frame, TELEMETRY_HEADER_SIZE + length));
+  Serial.write(encoded, telemetry_cobs_encode(frame, out - frame, encoded));
+  return true;
+}
+
+/**
+ * Send the next frame of the current response, with as many items as fit.
+ * Waits for a later call if the USB buffer is full, so the main loop never
+ * waits for the host.
+ */
+void telemetry_send_frame() {
+  if (!Serial) {
+    // Nobody is listening any more.
+    _telemetry_command = TELEMETRY_COMMAND_COUNT;
+    return;
+  }
+  if (!telemetry_room()) {
+    return;
+  }
+
+  uint8_t body[TELEMETRY_FRAME_SIZE - TELEMETRY_HEADER_SIZE - 4];
+  uint8_t item[TELEMETRY_ITEM_SIZE];
+  size_t  used = 0;
+  size_t  length;
+  while ((length = telemetry_item(_telemetry_command, _telemetry_item, item)) > 0) {
+    if (used + length > sizeof(body)) {
+      break;
+    }
+    memcpy(body + used, item, length);
+    used += length;
+    _telemetry_item++;
+  }
+  bool    last = (length == 0);
+  uint8_t type = (_telemetry_command == TELEMETRY_ERROR ? TELEMETRY_ERROR : _telemetry_command | TELEMETRY_RESPONSE);
+  telemetry_send(type, _telemetry_frame++, last ? TELEMETRY_LAST : 0, body, used);
+
+  if (last) {
+    _telemetry_command = TELEMETRY_COMMAND_COUNT;
+  }
+}
+
+/**
+ * Start answering a request that arrived whole. A broken request, or one
+ * that cannot be answered, gets an empty error frame.
+ */
+void telemetry_request() {
+  size_t length = telemetry_cobs_decode(_telemetry_request, _telemetry_request_length);
+  if (length < 5) {
+    return;
+  }
+  uint32_t crc;
+  memcpy(&crc, _telemetry_request + length - 4, sizeof(crc));
+  uint8_t command = _telemetry_request[0];
+  if (crc != crc32(_telemetry_request, length - 4) || command >= TELEMETRY_COMMAND_COUNT) {
+    command = TELEMETRY_ERROR;
+  }
+#ifndef HEM_PROFILE
+  if (command == TELEMETRY_PROFILE) {
+    command = TELEMETRY_ERROR;
+  }
+#endif
+  _telemetry_command = command;
+  _telemetry_item    = 0;
+  _telemetry_frame   = 0;
+}
+
+/**
+ * Read what the host sent and send the next frame of a response, if any.
+ * Never waits. Run by the task scheduler.
+ *
+ * \return true while a response is being sent, so the caller can poll faster
+ */
+bool telemetry_poll() {
+  while (_telemetry_command == TELEMETRY_COMMAND_COUNT && Serial.available() > 0) {
+    uint8_t byte = Serial.read();
+    if (byte == 0) {
+      if (_telemetry_request_length > 0 && !_telemetry_overflow) {
+        telemetry_request();
+      }
+      _telemetry_request_length = 0;
+      _telemetry_overflow       = false;
+    } else if (_telemetry_request_length < sizeof(_telemetry_request)) {
+      _telemetry_request[_telemetry_request_length++] = byte;
+    } else {
+      _telemetry_overflow = true;
+    }
+  }
+
+  if (_telemetry_command != TELEMETRY_COMMAND_COUNT) {
+    telemetry_send_frame();
+  }
+  return _telemetry_command != TELEMETRY_COMMAND_COUNT;
+}
@@ -0,0 +1,232 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "timekeeping.h"
+
+#include <Arduino.h>
+#include <pico/time.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include "network_time_types.h"
+#include "timekeeping_types.h"
+
+// Drift estimates beyond this are treated as bad samples, parts per billion.
+#define CLOCK_DRIFT_MAX 500000
+// Smallest drift error assumed when spacing syncs, parts per billion.
+#define CLOCK_DRIFT_FLOOR 100
+
+bool     _clock_synced      = false;
+bool     _clock_seeded      = false; // Set from a snapshot, until the first sync
+uint8_t  _clock_samples     = 0; // Syncs since the clock was last stepped
+uint32_t _clock_last_sync   = 0; // millis() of the last sync
+int64_t  _clock_drift       = 0; // Parts per billion, positive if the local clock is slow
+int64_t  _clock_drift_error = 0; // How much the last sync moved the estimate
+int64_t  _clock_slew        = 0; // Microseconds of offset still to slew away
+int64_t  _clock_fraction    = 0; // Drift correction not applied yet, in billionths of a microsecond
+uint64_t _clock_adjusted    = 0; // time_us_64() of the last adjustment
+
+time_context_t _time_context;
+
+clock_offset_t _clock_history[CLOCK_HISTORY];
+uint8_t        _clock_next  = 0;
+uint8_t        _clock_count = 0;
+
+/**
+ * Move the local clock.
+ *
+ * \param microseconds how far, positive moves it forward
+ */
+void clock_shift(int64_t microseconds) {
+  struct timeval now;
+  gettimeofday(&now, nullptr);
+  int64_t time = (int64_t)now.tv_sec * 1000000 + now.tv_usec + microseconds;
+  now.tv_sec   = time / 1000000;
+  now.tv_usec  = time % 1000000;
+  settimeofday(&now, nullptr);
+}
+
+/**
+ * Correct the local clock from an NTP answer. The first answer, and any that
+ * is far off, sets the clock outright. After that the offset is slewed away
+ * and used to refine the drift estimate: whatever offset built up since the
+ * last sync, beyond what was still being slewed, is drift the estimate missed.
+ * A step is not taken as a drift sample, an offset that large is something
+ * else, and the estimate is refined again from the next sync on.
+ */
+void clock_sync(const ntp_sample_t& sample) {
+  bool    step     = (!_clock_synced || llabs(sample.offset) > CLOCK_STEP_THRESHOLD);
+  int64_t interval = (int64_t)(uint32_t)(sample.received - _clock_last_sync);
+
+  if (_clock_synced && !step && interval > 0) {
+    int64_t unexplained = sample.offset * 1000 - _clock_slew;
+    _clock_drift_error  = unexplained * 1000000 / interval;
+    // Trust the first estimate fully, later ones move it halfway.
+    _clock_drift += (_clock_samples > 1 ? _clock_drift_error / 2 : _clock_drift_error);
+    _clock_drift = constrain(_clock_drift, (int64_t)-CLOCK_DRIFT_MAX, (int64_t)CLOCK_DRIFT_MAX);
+  }
+
+  if (step) {
+    // The local clock has moved on as much as the server time since the
+    // answer arrived, so the offset still holds. Whatever was still to be
+    // slewed is part of the offset, and the syncs before the step say
+    // nothing about the drift from here on, so the next sync starts over.
+    clock_shift(sample.offset * 1000);
+    _clock_slew     = 0;
+    _clock_fraction = 0;
+    _clock_samples  = 0;
+    _clock_adjusted = time_us_64();
+  } else {
+    _clock_slew = sample.offset * 1000;
+  }
+  _clock_samples   = min(_clock_samples + 1, 255);
+  _clock_last_sync = sample.received;
+  _clock_synced    = true;
+
+  clock_offset_t& entry = _clock_history[_clock_next];
+  entry.time            = time(nullptr);
+  entry.offset          = constrain(sample.offset, (int64_t)INT32_MIN, (int64_t)INT32_MAX);
+  entry.drift           = _clock_drift;
+  entry.stepped         = step;
+  _clock_next           = (_clock_next + 1) % CLOCK_HISTORY;
+  if (_clock_count < CLOCK_HISTORY) {
+    _clock_count++;
+  }
+
+  Serial.print(step ? F("Clock stepped by ") : F("Clock slewing by "));
+  Serial.print(entry.offset);
+  Serial.print(F(" ms, drift "));
+  Serial.print(entry.drift);
+  Serial.print(F(" ppb, next sync in "));
+  Serial.print(clock_sync_interval() / 60000);
+  Serial.println(F(" min"));
+}
+
+/**
+ * Apply the drift correction and a slice of any remaining offset. Run every
+ * second by the task scheduler, so the clock never jumps by more than half a
+ * millisecond between syncs.
+ */
+void clock_adjust() {
+  uint64_t now     = time_us_64();
+  int64_t  elapsed = now - _clock_adjusted;
+  _clock_adjusted  = now;
+  if (!_clock_synced) {
+    return;
+  }
+
+  _clock_fraction += elapsed * _clock_drift;
+  int64_t limit = elapsed * CLOCK_SLEW_PPM / 1000000;
+  int64_t slew  = constrain(_clock_slew, -limit, limit);
+  _clock_slew -= slew;
+
+  int64_t correction = _clock_fraction / 1000000000 + slew;
+  _clock_fraction %= 1000000000;
+  if (correction != 0) {
+    clock_shift(correction);
+  }
+}
+
+/**
+ * Set the clock from a time restored at boot, so timestamps can be had before
+ * the first NTP answer. The clock counts as valid but not synced, and the
+ * first sync steps it, as if it was never set.
+ */
+void clock_seed(time_t utc) {
+  if (_clock_synced) {
+    return;
+  }
+  struct timeval now;
+  now.tv_sec  = utc;
+  now.tv_usec = 0;
+  settimeofday(&now, nullptr);
+  _clock_seeded = true;
+}
+
+bool clock_synced() {
+  return _clock_synced;
+}
+
+/**
+ * \return the drift estimate in parts per billion, positive if the local
+ *         clock runs slow
+ */
+int32_t clock_drift() {
+  return _clock_drift;
+}
+
+/**
+ * Work out how long the clock can run before it is likely to be off by more
+ * than CLOCK_TARGET_ERROR, from how much the last sync had to correct the
+ * drift estimate.
+ *
+ * \return milliseconds until the next sync
+ */
+uint32_t clock_sync_interval() {
+  if (_clock_samples < 2) {
+    return CLOCK_SYNC_MIN;
+  }
+  int64_t  error    = max((int64_t)llabs(_clock_drift_error) / 2, (int64_t)CLOCK_DRIFT_FLOOR);
+  uint64_t interval = (uint64_t)CLOCK_TARGET_ERROR * 1000000000 / error;
+  return constrain(interval, (uint64_t)CLOCK_SYNC_MIN, (uint64_t)CLOCK_SYNC_MAX);
+}
+
+uint8_t clock_offset_count() {
+  return _clock_count;
+}
+
+/**
+ * Look up a past sync.
+ *
+ * \param age 0 for the latest sync, 1 for the one before and so on
+ * \return the sync, or nullptr if the history does not go back that far
+ */
+const clock_offset_t* clock_offset_history(uint8_t age) {
+  if (age >= _clock_count) {
+    return nullptr;
+  }
+  return &_clock_history[(_clock_next + CLOCK_HISTORY - 1 - age) % CLOCK_HISTORY];
+}
+
+/**
+ * Work out the time for this tick, converting to local time and UTC only when
+ * the second has changed. Run by the clock task right after clock_adjust(), so
+ * everything in one tick sees the same time.
+ *
+ * \return the updated context
+ */
+const time_context_t& time_tick() {
+  time_context_t next = _time_context;
+  next.utc            = time(nullptr);
+  next.valid          = (_clock_synced || _clock_seeded);
+  next.synced         = _clock_synced;
+  next.date_changed   = false;
+  next.utc_changed    = false;
+  next.minute_changed = false;
+
+  if (next.valid && (next.utc != _time_context.utc || !_time_context.valid)) {
+    localtime_r(&next.utc, &next.local);
+    gmtime_r(&next.utc, &next.gmt);
+    next.yday           = next.local.tm_yday;
+    next.minute         = next.local.tm_hour * 60 + next.local.tm_min;
+    next.date_changed   = (!_time_context.valid || next.yday != _time_context.yday ||
+                         next.local.tm_year != _time_context.local.tm_year);
+    next.utc_changed    = (!_time_context.valid || next.utc / 86400 != _time_context.utc / 86400);
+    next.minute_changed = (next.date_changed || next.minute != _time_context.minute);
+  }
+
+  // The Bluetooth callbacks read the context from interrupt context.
+  noInterrupts();
+  _time_context = next;
+  interrupts();
+  return _time_context;
+}
+
+/**
+ * \return the time as of the latest clock tick
+ */
+const time_context_t& time_context() {
+  return _time_context;
+}
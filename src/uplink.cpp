@@ -0,0 +1,447 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "uplink.h"
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <lwip/ip_addr.h>
+#include <lwip/pbuf.h>
+#include <lwip/tcp.h>
+#include <math.h>
+#include <pico/cyw43_arch.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "checksum.h"
+#include "configuration.h"
+#include "configuration_types.h"
+#include "resolver.h"
+#include "resolver_types.h"
+#include "ruuvi_types.h"
+#include "uplink_types.h"
+
+// Steps of a flush.
+enum uplink_state { UPLINK_IDLE = 0, UPLINK_CONNECTING, UPLINK_WAITING };
+
+// The queue is filled from the Bluetooth callback and emptied from the
+// wireless task, so both ends are moved with interrupts off.
+uplink_reading_t  _uplink_queue[UPLINK_QUEUE_SIZE];
+volatile uint16_t _uplink_head     = 0;
+volatile uint16_t _uplink_count    = 0;
+volatile uint16_t _uplink_inflight = 0; // Readings in the frame waiting for an answer
+
+uint8_t        _uplink_state         = UPLINK_IDLE;
+uint16_t       _uplink_sequence      = 0;
+uint32_t       _uplink_started       = 0; // millis() when the flush started, 0 if none is running
+uint32_t       _uplink_step_at       = 0; // millis() when the connection was started or the frame sent
+uint32_t       _uplink_bytes         = 0; // Bytes sent in this flush
+uint32_t       _uplink_frame_bytes   = 0; // Bytes sent for the frame in flight
+uint32_t       _uplink_flushed       = 0; // Readings acknowledged in this flush
+uplink_stats_t _uplink_stats         = {0, 0, 0, 0, 0, 0, 0, 0, 0};
+uint32_t       _uplink_reported_drop = 0; // Dropped readings already reported
+uint8_t        _uplink_frame[UPLINK_FRAME_SIZE];
+resolver_t     _uplink_host; // Address of the collector, looked up once
+
+// The connection is raw lwIP, so nothing waits for the collector. The lwIP
+// callbacks only fill in these, the wireless task acts on them.
+struct tcp_pcb*  _uplink_pcb           = nullptr;
+volatile bool    _uplink_connected     = false;
+volatile bool    _uplink_closed        = false; // The connection failed or the collector closed it
+char             _uplink_status[16];
+volatile uint8_t _uplink_status_length = 0;
+
+/**
+ * Add a reading to the queue, dropping the oldest reading if it is full.
+ *
+ * \param device index of the device in the configuration
+ * \param reading the reading
+ * \param time when the reading was taken
+ */
+void uplink_queue_reading(uint8_t device, const ruuvi_data_t& reading, time_t time) {
+  if (device >= UPLINK_DEVICES) {
+    return;
+  }
+  uplink_reading_t entry;
+  entry.time        = time;
+  entry.pressure    = reading.pressure;
+  entry.temperature = lroundf(reading.temperature * 100);
+  entry.humidity    = lroundf(reading.humidity * 100);
+  entry.device      = device;
+
+  noInterrupts();
+  _uplink_queue[_uplink_head] = entry;
+  _uplink_head                = (_uplink_head + 1) % UPLINK_QUEUE_SIZE;
+  if (_uplink_count < UPLINK_QUEUE_SIZE) {
+    _uplink_count++;
+  } else {
+    // The oldest reading was overwritten, and it may have been in flight.
+    _uplink_stats.dropped++;
+    if (_uplink_inflight > 0) {
+      _uplink_inflight--;
+    }
+  }
+  _uplink_stats.queued++;
+  interrupts();
+}
+
+/**
+ * Append an unsigned LEB128 varint.
+ */
+uint8_t* uplink_put_varint(uint8_t* out, uint32_t value) {
+  while (value >= 0x80) {
+    *out++ = (value & 0x7f) | 0x80;
+    value >>= 7;
+  }
+  *out++ = value;
+  return out;
+}
+
+/**
+ * Append a signed varint, zigzag encoded so small negative numbers stay short.
+ */
+uint8_t* uplink_put_signed(uint8_t* out, int32_t value) {
+  return uplink_put_varint(out, ((uint32_t)value << 1) ^ (uint32_t)(value >> 31));
+}
+
+/**
+ * Encode the oldest queued readings into a frame:
+ *
+ *   magic (2) | version (1) | count (1) | sequence (2) | base time (4)
+ *   count times: device (1) | time, temperature, humidity, pressure as deltas
+ *   CRC-32 of everything before it (4)
+ *
+ * Numbers are little endian. The time is a delta to the previous reading in
+ * the frame, starting from the base time. The values are deltas to the
+ * previous reading of the same device in the frame, starting from zero. All
+ * deltas are zigzag varints, so a reading typically takes 6-8 bytes instead of
+ * the 16 it takes in the queue.
+ *
+ * \param frame buffer of UPLINK_FRAME_SIZE bytes
+ * \param count set to the number of readings in the frame
+ * \return the length of the frame
+ */
+size_t uplink_encode(uint8_t* frame, uint16_t* count) {
+  uplink_reading_t previous[UPLINK_DEVICES];
+  memset(previous, 0, sizeof(previous));
+
+  noInterrupts();
+  uint16_t readings = min(_uplink_count, (uint16_t)UPLINK_FRAME_READINGS);
+  uint16_t first    = (_uplink_head + UPLINK_QUEUE_SIZE - _uplink_count) % UPLINK_QUEUE_SIZE;
+  uint32_t base     = _uplink_queue[first].time;
+  interrupts();
+
+  uint8_t* out = frame;
+  *out++       = UPLINK_FRAME_MAGIC & 0xff;
+  *out++       = UPLINK_FRAME_MAGIC >> 8;
+  *out++       = UPLINK_FRAME_VERSION;
+  *out++       = readings;
+  *out++       = _uplink_sequence & 0xff;
+  *out++       = _uplink_sequence >> 8;
+  memcpy(out, &base, sizeof(base));
+  out += sizeof(base);
+
+  uint32_t time = base;
+  for (uint16_t i = 0; i < readings; i++) {
+    noInterrupts();
+    uplink_reading_t reading = _uplink_queue[(first + i) % UPLINK_QUEUE_SIZE];
+    interrupts();
+    uplink_reading_t& last = previous[reading.device];
+
+    *out++ = reading.device;
+    out    = uplink_put_signed(out, reading.time - time);
+    out    = uplink_put_signed(out, reading.temperature - last.temperature);
+    out    = uplink_put_signed(out, (int32_t)reading.humidity - last.humidity);
+    out    = uplink_put_signed(out, reading.pressure - last.pressure);
+    time   = reading.time;
+    last   = reading;
+  }
+
+  uint32_t crc = crc32(frame, out - frame);
+  memcpy(out, &crc, sizeof(crc));
+  out += sizeof(crc);
+  *count = readings;
+  return out - frame;
+}
+
+/**
+ * Called by lwIP once the collector accepted the connection.
+ */
+err_t uplink_on_connect(void* argument, struct tcp_pcb* pcb, err_t error) {
+  _uplink_connected = true;
+  return ERR_OK;
+}
+
+/**
+ * Called by lwIP with data from the collector, or nullptr once it closed the
+ * connection. Only the status line is kept.
+ */
+err_t uplink_on_receive(void* argument, struct tcp_pcb* pcb, struct pbuf* data, err_t error) {
+  if (data == nullptr) {
+    _uplink_closed = true;
+    return ERR_OK;
+  }
+  uint8_t length = _uplink_status_length;
+  if (length < sizeof(_uplink_status) - 1) {
+    length += pbuf_copy_partial(data, _uplink_status + length, sizeof(_uplink_status) - 1 - length, 0);
+    _uplink_status_length = length;
+  }
+  tcp_recved(pcb, data->tot_len);
+  pbuf_free(data);
+  return ERR_OK;
+}
+
+/**
+ * Called by lwIP when the connection failed or was reset. lwIP has freed the
+ * connection already.
+ */
+void uplink_on_error(void* argument, err_t error) {
+  _uplink_pcb    = nullptr;
+  _uplink_closed = true;
+}
+
+void uplink_close() {
+  cyw43_arch_lwip_begin();
+  if (_uplink_pcb != nullptr) {
+    tcp_arg(_uplink_pcb, nullptr);
+    tcp_recv(_uplink_pcb, nullptr);
+    tcp_err(_uplink_pcb, nullptr);
+    if (tcp_close(_uplink_pcb) != ERR_OK) {
+      tcp_abort(_uplink_pcb);
+    }
+    _uplink_pcb = nullptr;
+  }
+  cyw43_arch_lwip_end();
+}
+
+/**
+ * Note a frame that was not acknowledged. Its readings stay queued for the
+ * next window.
+ */
+void uplink_fail(const __FlashStringHelper* reason) {
+  Serial.print(F("Uplink: "));
+  Serial.println(reason);
+  uplink_close();
+  _uplink_inflight = 0;
+  _uplink_state    = UPLINK_IDLE;
+  _uplink_stats.failures++;
+}
+
+/**
+ * Print how the flush went, and how many bytes each reading cost on the wire.
+ */
+void uplink_report() {
+  _uplink_stats.last_bytes    = _uplink_bytes;
+  _uplink_stats.last_readings = _uplink_flushed;
+  _uplink_stats.last_duration = millis() - _uplink_started;
+  _uplink_started             = 0;
+  if (_uplink_stats.dropped != _uplink_reported_drop) {
+    Serial.print(F("Uplink: the queue was full, "));
+    Serial.print(_uplink_stats.dropped - _uplink_reported_drop);
+    Serial.println(F(" readings were dropped since the last flush."));
+    _uplink_reported_drop = _uplink_stats.dropped;
+  }
+  if (_uplink_flushed == 0) {
+    return;
+  }
+  Serial.print(F("Uplink: sent "));
+  Serial.print(_uplink_flushed);
+  Serial.print(F(" readings in "));
+  Serial.print(_uplink_bytes);
+  Serial.print(F(" bytes, "));
+  Serial.print((float)_uplink_bytes / _uplink_flushed, 1);
+  Serial.print(F(" bytes per reading, "));
+  Serial.print(_uplink_stats.last_duration);
+  Serial.println(F(" ms."));
+}
+
+/**
+ * Start connecting to the collector, once its address is known. The address
+ * is looked up without waiting and kept for the next frames.
+ *
+ * \return false if the connection could not be started, true while the
+ *         lookup or the connection is under way
+ */
+bool uplink_connect() {
+  const Config& config = get_config();
+  IPAddress     address;
+  if (_uplink_pcb != nullptr || !resolve(_uplink_host, config.uplink.host.c_str(), &address)) {
+    return true;
+  }
+  ip_addr_t collector;
+  IP_ADDR4(&collector, address[0], address[1], address[2], address[3]);
+
+  cyw43_arch_lwip_begin();
+  _uplink_pcb = tcp_new_ip_type(IPADDR_TYPE_V4);
+  if (_uplink_pcb != nullptr) {
+    tcp_arg(_uplink_pcb, nullptr);
+    tcp_recv(_uplink_pcb, &uplink_on_receive);
+    tcp_err(_uplink_pcb, &uplink_on_error);
+    if (tcp_connect(_uplink_pcb, &collector, config.uplink.port, &uplink_on_connect) != ERR_OK) {
+      tcp_abort(_uplink_pcb);
+      _uplink_pcb = nullptr;
+    }
+  }
+  cyw43_arch_lwip_end();
+  return _uplink_pcb != nullptr;
+}
+
+/**
+ * Send one frame to the collector as an HTTP POST, on the connection that was
+ * just made. The frame is copied into the lwIP send buffer, so this does not
+ * wait either.
+ *
+ * \return true if the frame was sent and an answer can be waited for
+ */
+bool uplink_send() {
+  const Config& config   = get_config();
+  uint16_t      readings = 0;
+  size_t        length   = uplink_encode(_uplink_frame, &readings);
+
+  char   header[192];
+  size_t header_length = snprintf(header, sizeof(header),
+                                  "POST %s HTTP/1.1\r\nHost: %s\r\nContent-Type: application/octet-stream\r\n"
+                                  "Content-Length: %u\r\nConnection: close\r\n\r\n",
+                                  config.uplink.path.c_str(), config.uplink.host.c_str(), (unsigned)length);
+  header_length = min(header_length, sizeof(header) - 1);
+
+  cyw43_arch_lwip_begin();
+  bool written = (_uplink_pcb != nullptr && tcp_sndbuf(_uplink_pcb) >= header_length + length &&
+                  tcp_write(_uplink_pcb, header, header_length, TCP_WRITE_FLAG_COPY) == ERR_OK &&
+                  tcp_write(_uplink_pcb, _uplink_frame, length, TCP_WRITE_FLAG_COPY) == ERR_OK &&
+                  tcp_output(_uplink_pcb) == ERR_OK);
+  cyw43_arch_lwip_end();
+  if (!written) {
+    uplink_fail(F("could not send the frame."));
+    return false;
+  }
+  _uplink_inflight    = readings;
+  _uplink_frame_bytes = header_length + length;
+  _uplink_step_at     = millis();
+  _uplink_state       = UPLINK_WAITING;
+  _uplink_bytes += _uplink_frame_bytes;
+  return true;
+}
+
+/**
+ * Drop the readings of an acknowledged frame from the queue.
+ */
+void uplink_acknowledge() {
+  noInterrupts();
+  uint16_t readings = _uplink_inflight;
+  _uplink_count -= readings;
+  _uplink_inflight = 0;
+  interrupts();
+
+  uplink_close();
+  _uplink_state = UPLINK_IDLE;
+  _uplink_sequence++;
+  _uplink_flushed += readings;
+  _uplink_stats.sent += readings;
+  _uplink_stats.frames++;
+  _uplink_stats.bytes += _uplink_frame_bytes;
+}
+
+/**
+ * Send the queued readings to the collector, one frame per connection. Never
+ * waits: each call looks at how the lookup, the connection or the answer is
+ * getting on and takes the next step. Called from the wireless state machine
+ * while WiFi is up, until it returns true.
+ *
+ * \return true when the queue is empty or the collector did not answer
+ */
+bool uplink_flush() {
+  if (!uplink_configured()) {
+    return true;
+  }
+  if (_uplink_started == 0) {
+    _uplink_started = millis();
+    _uplink_flushed = 0;
+    _uplink_bytes   = 0;
+  }
+
+  switch (_uplink_state) {
+    case UPLINK_IDLE:
+      if (_uplink_count == 0) {
+        uplink_report();
+        return true;
+      }
+      _uplink_connected     = false;
+      _uplink_closed        = false;
+      _uplink_status_length = 0;
+      _uplink_step_at       = millis();
+      _uplink_state         = UPLINK_CONNECTING;
+      // Fall through.
+
+    case UPLINK_CONNECTING:
+      if (_uplink_connected) {
+        if (uplink_send()) {
+          return false;
+        }
+      } else if (_uplink_closed || (millis() - _uplink_step_at) >= UPLINK_CONNECT_TIMEOUT) {
+        // The collector may have moved, look it up again next time.
+        resolver_forget(_uplink_host);
+        uplink_fail(F("could not connect to the collector."));
+      } else if (!uplink_connect()) {
+        uplink_fail(F("could not connect to the collector."));
+      } else {
+        return false;
+      }
+      uplink_report();
+      return true;
+
+    case UPLINK_WAITING:
+      // Only the status line matters, "HTTP/1.1 204 No Content".
+      if (_uplink_status_length >= 12) {
+        _uplink_status[_uplink_status_length] = '\0';
+        if (_uplink_status[9] == '2') {
+          uplink_acknowledge();
+          return false;
+        }
+        uplink_fail(F("the collector refused the frame."));
+      } else if (!_uplink_closed && (millis() - _uplink_step_at) < UPLINK_RESPONSE_TIMEOUT) {
+        return false;
+      } else {
+        uplink_fail(F("no answer from the collector."));
+      }
+      uplink_report();
+      return true;
+
+    default:
+      return true;
+  }
+}
+
+/**
+ * Give up on a flush, when WiFi goes down in the middle of it.
+ */
+void uplink_cancel() {
+  if (_uplink_state != UPLINK_IDLE) {
+    uplink_fail(F("WiFi went down during the flush."));
+  }
+  if (_uplink_started != 0) {
+    uplink_report();
+  }
+}
+
+bool uplink_configured() {
+  return get_config().uplink.host.length() > 0;
+}
+
+/**
+ * \return true if the queue is filling up and should be sent before the next
+ *         window is due
+ */
+bool uplink_backlogged() {
+  return uplink_configured() && _uplink_count >= UPLINK_HIGH_WATER;
+}
+
+uint16_t uplink_pending() {
+  return _uplink_count;
+}
+
+const uplink_stats_t* uplink_stats() {
+  return &_uplink_stats;
+}
@@ -0,0 +1,471 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "usb_drive.h"
+
+#include <Arduino.h>
+
+#ifdef HEM_USB_DRIVE
+#  include <string.h>
+#  include <time.h>
+#  include <tusb.h>
+
+#  include "boot.h"
+#  include "common.h"
+#  include "format.h"
+#  include "history.h"
+#  include "history_types.h"
+#  include "rollup.h"
+#  include "rollup_types.h"
+#  include "ruuvi.h"
+#  include "timekeeping.h"
+#  include "timekeeping_types.h"
+#  include "usb_drive_types.h"
+
+static_assert(sizeof(usb_drive_entry_t) == 32, "FAT directory entries are 32 bytes");
+static_assert(sizeof(USB_DRIVE_CSV_HEADER) - 1 < USB_DRIVE_SECTOR_SIZE, "the header fits in the first sector");
+static_assert((USB_DRIVE_CLUSTERS + 2) * 3 / 2 <= USB_DRIVE_FAT_SECTORS * USB_DRIVE_SECTOR_SIZE, "FAT too small");
+
+enum usb_drive_file_id { USB_DRIVE_HISTORY = 0, USB_DRIVE_FILE_COUNT };
+
+// Start of the boot sector, up to the file system type. The rest is zero but
+// for the signature at the end.
+const uint8_t usb_drive_boot[] PROGMEM = {
+    0xeb, 0x3c, 0x90,                                      // Jump over the BPB
+    'M', 'S', 'D', 'O', 'S', '5', '.', '0',                // OEM name
+    0x00, 0x02,                                            // Bytes per sector
+    USB_DRIVE_CLUSTER_SECTORS,                             // Sectors per cluster
+    0x01, 0x00,                                            // Reserved sectors
+    0x01,                                                  // FATs
+    0x10, 0x00,                                            // Root directory entries
+    USB_DRIVE_SECTORS & 0xff, USB_DRIVE_SECTORS >> 8,      // Sectors
+    0xf8,                                                  // Media, fixed disk
+    USB_DRIVE_FAT_SECTORS, 0x00,                           // Sectors per FAT
+    0x01, 0x00,                                            // Sectors per track
+    0x01, 0x00,                                            // Heads
+    0x00, 0x00, 0x00, 0x00,                                // Hidden sectors
+    0x00, 0x00, 0x00, 0x00,                                // Sectors, 32 bits
+    0x80,                                                  // Drive number
+    0x00,                                                  // Reserved
+    0x29,                                                  // Extended boot signature
+    0x45, 0x4d, 0x48, 0x00,                                // Volume serial number
+    'H', 'E', 'M', ' ', 'E', 'X', 'P', 'O', 'R', 'T', ' ', // Volume label
+    'F', 'A', 'T', '1', '2', ' ', ' ', ' '};               // File system type
+
+usb_drive_file_t _usb_drive_files[USB_DRIVE_FILE_COUNT] = {
+    {"HISTORY CSV", 0, 0, 0},
+};
+volatile uint8_t _usb_drive_state   = USB_DRIVE_IDLE;
+volatile bool    _usb_drive_stopped = false; // Ejected, until the host starts the drive again
+uint16_t         _usb_drive_date    = 0;     // FAT date and time of the files, when the host took the drive
+uint16_t         _usb_drive_time    = 0;
+
+// history.csv starts with the quarter hours before the oldest reading in the
+// history, a line per sensor and quarter from _usb_drive_first_quarter on.
+uint32_t _usb_drive_first_quarter   = 0;
+uint32_t _usb_drive_quarter_lines   = 0;
+uint8_t  _usb_drive_quarter_devices = 0;
+
+// The sector last made, the host reads a sector in several parts.
+uint8_t  _usb_drive_sector[USB_DRIVE_SECTOR_SIZE];
+uint32_t _usb_drive_sector_lba = UINT32_MAX;
+
+/**
+ * Write a number right aligned in a field, space padded.
+ */
+void usb_drive_put(char* field, uint8_t width, int32_t value, uint8_t decimals) {
+  char   text[FORMAT_INT_SIZE];
+  size_t length = format_fixed(text, sizeof(text), value, decimals);
+  length        = min(length, (size_t)width);
+  memset(field, ' ', width - length);
+  memcpy(field + width - length, text, length);
+}
+
+/**
+ * Write a number zero padded.
+ */
+void usb_drive_put_digits(char* field, uint8_t width, int32_t value) {
+  char text[FORMAT_INT_SIZE];
+  format_int(text, sizeof(text), value, width, '0');
+  memcpy(field, text, width);
+}
+
+/**
+ * Start a line of history.csv with every field empty:
+ *
+ *   2023-11-05T12:34:56Z,r,  0, -12.34, 45.50,101325
+ *
+ * The kind is r for a reading and q for the average of a quarter hour.
+ */
+void usb_drive_csv_empty(char* line, char kind) {
+  memset(line, ' ', USB_DRIVE_CSV_LINE);
+  line[20]                     = ',';
+  line[21]                     = kind;
+  line[22]                     = ',';
+  line[26]                     = ',';
+  line[34]                     = ',';
+  line[41]                     = ',';
+  line[USB_DRIVE_CSV_LINE - 2] = '\r';
+  line[USB_DRIVE_CSV_LINE - 1] = '\n';
+}
+
+void usb_drive_csv_time(char* line, time_t time) {
+  struct tm date;
+  gmtime_r(&time, &date);
+  usb_drive_put_digits(line, 4, date.tm_year + 1900);
+  line[4] = '-';
+  usb_drive_put_digits(line + 5, 2, date.tm_mon + 1);
+  line[7] = '-';
+  usb_drive_put_digits(line + 8, 2, date.tm_mday);
+  line[10] = 'T';
+  usb_drive_put_digits(line + 11, 2, date.tm_hour);
+  line[13] = ':';
+  usb_drive_put_digits(line + 14, 2, date.tm_min);
+  line[16] = ':';
+  usb_drive_put_digits(line + 17, 2, date.tm_sec);
+  line[19] = 'Z';
+}
+
+/**
+ * Fill in the measurements of a line of history.csv.
+ *
+ * \param temperature hundredths of a degree Celsius
+ * \param humidity hundredths of a percent
+ * \param pressure Pascal
+ */
+void usb_drive_csv_values(char* line, int32_t temperature, int32_t humidity, int32_t pressure) {
+  usb_drive_put(line + 27, 7, temperature, 2);
+  usb_drive_put(line + 35, 6, humidity, 2);
+  usb_drive_put(line + 42, 6, pressure, 0);
+}
+
+/**
+ * Make one line of history.csv, from the average of a quarter hour for the
+ * older lines and from a reading in the history for the rest. A quarter that
+ * was not rolled up keeps its time and sensor with the measurements left
+ * empty, a reading that cannot be read is left empty altogether.
+ */
+void usb_drive_csv_line(uint32_t index, char* line) {
+  if (index < _usb_drive_quarter_lines) {
+    rollup_record_t quarter;
+    uint32_t        bucket = _usb_drive_first_quarter + index / _usb_drive_quarter_devices;
+    uint8_t         device = index % _usb_drive_quarter_devices;
+    usb_drive_csv_empty(line, 'q');
+    usb_drive_csv_time(line, bucket * rollup_bucket_seconds(ROLLUP_QUARTER));
+    usb_drive_put(line + 23, 3, device, 0);
+    if (rollup_read(ROLLUP_QUARTER, device, bucket, &quarter)) {
+      usb_drive_csv_values(line, quarter.temperature, quarter.humidity * 50, quarter.pressure + ROLLUP_PRESSURE_BASE);
+    }
+    return;
+  }
+  history_record_t record;
+  usb_drive_csv_empty(line, 'r');
+  if (history_read(index - _usb_drive_quarter_lines, &record)) {
+    usb_drive_csv_time(line, record.time);
+    usb_drive_put(line + 23, 3, record.device, 0);
+    usb_drive_csv_values(line, record.temperature, record.humidity, record.pressure + HISTORY_PRESSURE_BASE);
+  }
+}
+
+/**
+ * Fill a buffer with part of history.csv, only making the lines it covers.
+ */
+void usb_drive_read_history(uint32_t offset, uint8_t* buffer, uint32_t size) {
+  const uint32_t header = sizeof(USB_DRIVE_CSV_HEADER) - 1;
+  while (size > 0 && offset < header) {
+    *buffer++ = USB_DRIVE_CSV_HEADER[offset++];
+    size--;
+  }
+  char line[USB_DRIVE_CSV_LINE];
+  while (size > 0) {
+    uint32_t index = (offset - header) / USB_DRIVE_CSV_LINE;
+    uint32_t start = (offset - header) % USB_DRIVE_CSV_LINE;
+    uint32_t count = min(size, (uint32_t)USB_DRIVE_CSV_LINE - start);
+    usb_drive_csv_line(index, line);
+    memcpy(buffer, line + start, count);
+    buffer += count;
+    offset += count;
+    size -= count;
+  }
+}
+
+/**
+ * Work out the value of a FAT entry: the next cluster of the same file, or the
+ * end of the chain.
+ */
+uint16_t usb_drive_fat_entry(uint16_t cluster) {
+  if (cluster < 2) {
+    return (cluster == 0 ? 0xff8 : 0xfff);
+  }
+  for (uint8_t i = 0; i < USB_DRIVE_FILE_COUNT; i++) {
+    const usb_drive_file_t& file = _usb_drive_files[i];
+    if (file.cluster != 0 && cluster >= file.cluster && cluster <= file.last) {
+      return (cluster == file.last ? 0xfff : cluster + 1);
+    }
+  }
+  return 0;
+}
+
+/**
+ * Make a sector of the FAT. Entries are 12 bits, so the ones at either edge of
+ * the sector are split with the next and previous sectors.
+ */
+void usb_drive_fat(uint32_t sector, uint8_t* data) {
+  int32_t  start = sector * USB_DRIVE_SECTOR_SIZE;
+  uint16_t first = (start > 0 ? start * 2 / 3 - 1 : 0);
+  uint16_t last  = min((int32_t)((start + USB_DRIVE_SECTOR_SIZE) * 2 / 3 + 1), (int32_t)(USB_DRIVE_CLUSTERS + 2));
+  for (uint16_t cluster = first; cluster < last; cluster++) {
+    uint16_t value    = usb_drive_fat_entry(cluster);
+    int32_t  position = cluster * 3 / 2 - start;
+    uint8_t  low      = (cluster & 1 ? value << 4 : value);
+    uint8_t  high     = (cluster & 1 ? value >> 4 : value >> 8);
+    if (position >= 0 && position < USB_DRIVE_SECTOR_SIZE) {
+      data[position] |= low;
+    }
+    if (position + 1 >= 0 && position + 1 < USB_DRIVE_SECTOR_SIZE) {
+      data[position + 1] |= high;
+    }
+  }
+}
+
+void usb_drive_entry(usb_drive_entry_t& entry, const char* name, uint8_t attributes) {
+  memcpy(entry.name, name, sizeof(entry.name));
+  entry.attributes    = attributes;
+  entry.reserved      = 0x18; // Name and extension shown in lower case
+  entry.created_time  = _usb_drive_time;
+  entry.created_date  = _usb_drive_date;
+  entry.accessed_date = _usb_drive_date;
+  entry.written_time  = _usb_drive_time;
+  entry.written_date  = _usb_drive_date;
+}
+
+/**
+ * Make the root directory: the volume label and the files.
+ */
+void usb_drive_root(uint8_t* data) {
+  usb_drive_entry_t* entries = (usb_drive_entry_t*)data;
+  usb_drive_entry(entries[0], "HEM EXPORT ", 0x08);
+  entries[0].reserved = 0;
+  for (uint8_t i = 0; i < USB_DRIVE_FILE_COUNT; i++) {
+    const usb_drive_file_t& file = _usb_drive_files[i];
+    if (file.cluster == 0) {
+      continue;
+    }
+    usb_drive_entry(entries[i + 1], file.name, 0x21);
+    entries[i + 1].cluster = file.cluster;
+    entries[i + 1].size    = file.size;
+  }
+}
+
+/**
+ * Make the sector of a file that lives in a cluster, if any.
+ */
+void usb_drive_data(uint32_t sector, uint8_t* data) {
+  uint16_t cluster = 2 + sector / USB_DRIVE_CLUSTER_SECTORS;
+  for (uint8_t i = 0; i < USB_DRIVE_FILE_COUNT; i++) {
+    const usb_drive_file_t& file = _usb_drive_files[i];
+    if (file.cluster == 0 || cluster < file.cluster || cluster > file.last) {
+      continue;
+    }
+    uint32_t offset = (sector - (file.cluster - 2) * USB_DRIVE_CLUSTER_SECTORS) * USB_DRIVE_SECTOR_SIZE;
+    if (offset >= file.size) {
+      // The slack at the end of the last cluster, left zero.
+      return;
+    }
+    uint32_t size = min(file.size - offset, (uint32_t)USB_DRIVE_SECTOR_SIZE);
+    if (i == USB_DRIVE_HISTORY) {
+      usb_drive_read_history(offset, data, size);
+    }
+    return;
+  }
+}
+
+/**
+ * Make a sector of the volume, from nothing but the file sizes.
+ */
+void usb_drive_sector(uint32_t lba, uint8_t* data) {
+  memset(data, 0, USB_DRIVE_SECTOR_SIZE);
+  if (lba == 0) {
+    memcpy(data, usb_drive_boot, sizeof(usb_drive_boot));
+    data[510] = 0x55;
+    data[511] = 0xaa;
+  } else if (lba < USB_DRIVE_ROOT_START) {
+    usb_drive_fat(lba - USB_DRIVE_FAT_START, data);
+  } else if (lba == USB_DRIVE_ROOT_START) {
+    usb_drive_root(data);
+  } else if (lba < USB_DRIVE_SECTORS) {
+    usb_drive_data(lba - USB_DRIVE_DATA_START, data);
+  }
+}
+
+/**
+ * Place a file from a cluster on, cut short if it does not fit the volume.
+ *
+ * \return the first cluster after the file
+ */
+uint16_t usb_drive_place(uint8_t id, uint32_t size, uint16_t cluster) {
+  usb_drive_file_t& file = _usb_drive_files[id];
+  uint32_t          room = (uint32_t)(USB_DRIVE_CLUSTERS + 2 - cluster) * USB_DRIVE_CLUSTER_SIZE;
+  file.size              = min(size, room);
+  uint32_t          used = max((file.size + USB_DRIVE_CLUSTER_SIZE - 1) / USB_DRIVE_CLUSTER_SIZE, (uint32_t)1);
+  file.cluster           = cluster;
+  file.last              = cluster + used - 1;
+  return file.last + 1;
+}
+
+/**
+ * Work out the quarter hours history.csv starts with: those the quarter-hour
+ * rollups still keep from before the oldest reading in the history. The
+ * history holds about a week, the quarters make the file reach back 30 days.
+ * None if the time is not known.
+ */
+void usb_drive_plan_quarters(const time_context_t& now) {
+  uint32_t seconds           = rollup_bucket_seconds(ROLLUP_QUARTER);
+  uint32_t end               = now.utc / seconds;
+  _usb_drive_first_quarter   = end - ROLLUP_QUARTERS + 1;
+  _usb_drive_quarter_devices = min(ruuvi_device_count(), (uint8_t)ROLLUP_DEVICES);
+  _usb_drive_quarter_lines   = 0;
+  history_record_t oldest;
+  if (history_read(0, &oldest)) {
+    end = min(end, oldest.time / seconds);
+  }
+  if (now.valid && _usb_drive_quarter_devices > 0 && end > _usb_drive_first_quarter) {
+    _usb_drive_quarter_lines = (end - _usb_drive_first_quarter) * _usb_drive_quarter_devices;
+  }
+}
+
+/**
+ * Hand the file system over to the host, once the monitor is between tasks
+ * and not using it. The sizes of the files are fixed here. The history stops
+ * growing while the host has the drive, so the lines stay where they are.
+ */
+void usb_drive_take() {
+  const time_context_t& now = time_context();
+  if (now.valid) {
+    _usb_drive_date = (now.local.tm_year - 80) << 9 | (now.local.tm_mon + 1) << 5 | now.local.tm_mday;
+    _usb_drive_time = now.local.tm_hour << 11 | now.local.tm_min << 5 | now.local.tm_sec / 2;
+  }
+  usb_drive_plan_quarters(now);
+  uint32_t count = history_count();
+  uint32_t lines = _usb_drive_quarter_lines + count;
+  usb_drive_place(USB_DRIVE_HISTORY, sizeof(USB_DRIVE_CSV_HEADER) - 1 + lines * USB_DRIVE_CSV_LINE, 2);
+  _usb_drive_sector_lba = UINT32_MAX;
+  set_filesystem_safe(false);
+  _usb_drive_state = USB_DRIVE_READY;
+
+  Serial.print(F("USB drive: exporting "));
+  Serial.print(count);
+  Serial.print(F(" readings and "));
+  Serial.print(_usb_drive_quarter_lines);
+  Serial.println(F(" quarter hours"));
+}
+
+/**
+ * Take the file system back from the host.
+ */
+void usb_drive_give_back() {
+  _usb_drive_state = USB_DRIVE_IDLE;
+  set_filesystem_safe(true);
+  Serial.println(F("USB drive: ejected"));
+}
+
+/**
+ * Hand the file system to the host when it asks for the drive, and take it
+ * back when the drive is ejected or the cable pulled. Run often by the task
+ * scheduler, the host waits for the drive meanwhile.
+ */
+void usb_drive_service() {
+  if (_usb_drive_state == USB_DRIVE_REQUESTED && boot_phase() >= BOOT_STORAGE) {
+    usb_drive_take();
+  } else if (_usb_drive_state == USB_DRIVE_RELEASED || (_usb_drive_state == USB_DRIVE_READY && !tud_mounted())) {
+    usb_drive_give_back();
+  }
+}
+
+uint8_t usb_drive_state() {
+  return _usb_drive_state;
+}
+
+// Defining this makes the core add a mass storage interface to the USB
+// configuration.
+void __USBInstallMassStorage() {}
+
+// TinyUSB callbacks, called from the USB task in interrupt context. They only
+// touch the file system while the monitor has handed it over.
+
+extern "C" void tud_msc_inquiry_cb(uint8_t lun, uint8_t vendor_id[8], uint8_t product_id[16],
+                                   uint8_t product_rev[4]) {
+  memcpy(vendor_id, "HEM     ", 8);
+  memcpy(product_id, "History export  ", 16);
+  memcpy(product_rev, "1.0 ", 4);
+}
+
+extern "C" bool tud_msc_test_unit_ready_cb(uint8_t lun) {
+  if (_usb_drive_stopped) {
+    tud_msc_set_sense(lun, SCSI_SENSE_NOT_READY, 0x3a, 0x00); // Medium not present
+    return false;
+  }
+  if (_usb_drive_state == USB_DRIVE_IDLE) {
+    _usb_drive_state = USB_DRIVE_REQUESTED;
+  }
+  if (_usb_drive_state != USB_DRIVE_READY) {
+    tud_msc_set_sense(lun, SCSI_SENSE_NOT_READY, 0x04, 0x01); // Becoming ready
+    return false;
+  }
+  return true;
+}
+
+extern "C" void tud_msc_capacity_cb(uint8_t lun, uint32_t* block_count, uint16_t* block_size) {
+  *block_count = USB_DRIVE_SECTORS;
+  *block_size  = USB_DRIVE_SECTOR_SIZE;
+}
+
+extern "C" bool tud_msc_start_stop_cb(uint8_t lun, uint8_t power_condition, bool start, bool load_eject) {
+  if (load_eject) {
+    _usb_drive_stopped = !start;
+    if (!start && _usb_drive_state == USB_DRIVE_READY) {
+      _usb_drive_state = USB_DRIVE_RELEASED;
+    }
+  }
+  return true;
+}
+
+extern "C" bool tud_msc_is_writable_cb(uint8_t lun) {
+  return false;
+}
+
+extern "C" int32_t tud_msc_read10_cb(uint8_t lun, uint32_t lba, uint32_t offset, void* buffer, uint32_t bufsize) {
+  if (_usb_drive_state != USB_DRIVE_READY) {
+    return -1;
+  }
+  uint8_t* out  = (uint8_t*)buffer;
+  uint32_t done = 0;
+  while (done < bufsize) {
+    if (lba != _usb_drive_sector_lba) {
+      usb_drive_sector(lba, _usb_drive_sector);
+      _usb_drive_sector_lba = lba;
+    }
+    uint32_t count = min(bufsize - done, (uint32_t)USB_DRIVE_SECTOR_SIZE - offset);
+    memcpy(out + done, _usb_drive_sector + offset, count);
+    done += count;
+    offset = 0;
+    lba++;
+  }
+  return done;
+}
+
+extern "C" int32_t tud_msc_write10_cb(uint8_t lun, uint32_t lba, uint32_t offset, uint8_t* buffer, uint32_t bufsize) {
+  tud_msc_set_sense(lun, SCSI_SENSE_DATA_PROTECT, 0x27, 0x00); // Write protected
+  return -1;
+}
+
+extern "C" int32_t tud_msc_scsi_cb(uint8_t lun, uint8_t const scsi_cmd[16], void* buffer, uint16_t bufsize) {
+  if (scsi_cmd[0] == SCSI_CMD_PREVENT_ALLOW_MEDIUM_REMOVAL) {
+    return 0;
+  }
+  tud_msc_set_sense(lun, SCSI_SENSE_ILLEGAL_REQUEST, 0x20, 0x00); // Invalid command
+  return -1;
+}
+#endif
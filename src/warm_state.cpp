@@ -0,0 +1,140 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "warm_state.h"
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+
+#include "breadcrumb.h"
+#include "breadcrumb_types.h"
+#include "checksum.h"
+#include "climate.h"
+#include "common.h"
+#include "network_time.h"
+#include "rollup.h"
+#include "ruuvi.h"
+#include "timekeeping.h"
+#include "timekeeping_types.h"
+#include "warm_state_types.h"
+
+uint32_t _warm_state_sequence = 0;
+uint32_t _warm_state_content  = 0;
+bool     _warm_state_written  = false; // A snapshot was written since boot
+
+/**
+ * CRC of the part of a snapshot that is actual state, used to skip writing
+ * snapshots that did not change.
+ */
+uint32_t warm_state_content(const warm_state_t* state) {
+  return crc32(&state->last_pressure, offsetof(warm_state_t, crc) - offsetof(warm_state_t, last_pressure));
+}
+
+/**
+ * Read a snapshot and check that it is complete and of the current version.
+ */
+bool read_warm_state(const char* file_name, warm_state_t* state) {
+  File file = LittleFS.open(file_name, "r");
+  if (!file) {
+    return false;
+  }
+  size_t length = file.read((uint8_t*)state, sizeof(warm_state_t));
+  file.close();
+  return (length == sizeof(warm_state_t) && state->version == WARM_STATE_VERSION &&
+          state->crc == crc32(state, offsetof(warm_state_t, crc)));
+}
+
+/**
+ * Write a snapshot of the pressure trend, the latest readings and the rollups
+ * waiting in RAM, unless nothing changed since the last one. Run every ten minutes by the task
+ * scheduler, which keeps flash wear to a few hundred small writes a day.
+ */
+void save_warm_state() {
+  if (!is_filesystem_safe()) {
+    return;
+  }
+  warm_state_t state;
+  // Zero the padding too, it is part of the CRC.
+  memset((void*)&state, 0, sizeof(state));
+  state.version      = WARM_STATE_VERSION;
+  state.saved_at     = (time_context().valid ? time(nullptr) : 0);
+  state.saved_uptime = millis() / 1000;
+  save_climate_state(&state);
+  save_ruuvi_state(&state);
+  save_rollup_state(&state);
+
+  // The first snapshot of a run is always written, so its uptime goes with
+  // the breadcrumb of this run.
+  uint32_t content = warm_state_content(&state);
+  if (content == _warm_state_content && _warm_state_written) {
+    return;
+  }
+  state.sequence = ++_warm_state_sequence;
+  state.crc      = crc32(&state, offsetof(warm_state_t, crc));
+
+  File file = LittleFS.open((state.sequence & 1) ? WARM_STATE_FILE_A : WARM_STATE_FILE_B, "w");
+  if (file) {
+    file.write((const uint8_t*)&state, sizeof(state));
+    file.close();
+    _warm_state_content = content;
+    _warm_state_written = true;
+  }
+}
+
+/**
+ * Set the clock from the time of a snapshot, after a watchdog reset or reboot.
+ * The time since the snapshot is the uptime the breadcrumb had at the reset
+ * less the uptime at the snapshot, plus the time since this boot. After a
+ * power cut there is no telling how long the power was off, so the clock is
+ * left for NTP to set.
+ */
+void restore_clock(const warm_state_t* state) {
+  const reset_record_t& reset = last_reset();
+  if (state->saved_at == 0 || reset.cause == RESET_POWER_ON) {
+    return;
+  }
+  time_t now = state->saved_at + millis() / 1000;
+  if (reset.uptime >= state->saved_uptime) {
+    now += reset.uptime - state->saved_uptime;
+  }
+  configure_timezone();
+  clock_seed(now);
+  Serial.print(F("Clock set from saved state, not synced: "));
+  Serial.println((uint32_t)now);
+}
+
+/**
+ * Restore the newest valid snapshot. Call in setup() after the Ruuvi devices
+ * are set up, so the cached readings are shown on the first frame.
+ *
+ * \return true if a snapshot was restored
+ */
+bool restore_warm_state() {
+  warm_state_t a;
+  warm_state_t b;
+  bool         a_valid = read_warm_state(WARM_STATE_FILE_A, &a);
+  bool         b_valid = read_warm_state(WARM_STATE_FILE_B, &b);
+  if (!a_valid && !b_valid) {
+    Serial.println(F("No saved state to restore."));
+    return false;
+  }
+
+  const warm_state_t* state = (a_valid && (!b_valid || a.sequence > b.sequence)) ? &a : &b;
+  _warm_state_sequence      = state->sequence;
+  _warm_state_content       = warm_state_content(state);
+  restore_climate_state(state);
+  restore_ruuvi_state(state);
+  restore_rollup_state(state);
+  restore_clock(state);
+
+  Serial.print(F("Restored saved state "));
+  Serial.print(state->sequence);
+  Serial.print(F(" from "));
+  Serial.println((uint32_t)state->saved_at);
+  return true;
+}
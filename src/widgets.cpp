@@ -0,0 +1,274 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "widgets.h"
+
+#include <Arduino.h>
+#include <U8g2lib.h>
+#include <string.h>
+
+#include "common.h"
+#include "profile.h"
+#include "segments.h"
+#include "widget_types.h"
+
+widget_t _widgets[WIDGET_COUNT];
+int16_t  _graph_top    = 0;
+uint8_t  _graph_height = 0;
+
+/**
+ * Set up a widget at the given position, caching the font metrics.
+ */
+void place_widget(U8G2& u8g2, uint8_t id, const uint8_t* font, int16_t x, int16_t y,
+                  widget_align_t align = WIDGET_ALIGN_LEFT, uint16_t glyph = 0) {
+  widget_t& w = _widgets[id];
+  u8g2.setFont(font);
+  w.font    = font;
+  w.x       = x;
+  w.y       = y;
+  w.align   = align;
+  w.ascent  = u8g2.getAscent();
+  w.descent = u8g2.getDescent();
+  w.glyph   = glyph;
+  w.width   = u8g2.getMaxCharWidth(); // Text widgets measure their text instead
+}
+
+/**
+ * Work out where everything goes on the display. This is the only place where
+ * font metrics are looked up for positioning, other displays only need their
+ * own version of this.
+ */
+void layout_widgets() {
+  U8G2     u8g2   = get_display();
+  uint16_t width  = u8g2.getDisplayWidth();
+  uint16_t height = u8g2.getDisplayHeight();
+
+  memset(_widgets, 0, sizeof(_widgets));
+
+  // Top row, date to the left and time to the right.
+  u8g2.setFont(u8g2_font_helvR08_tf);
+  place_widget(u8g2, WIDGET_DATE, u8g2_font_helvR08_tf, 0, u8g2.getMaxCharHeight());
+  u8g2.setFont(u8g2_font_helvB08_tf);
+  place_widget(u8g2, WIDGET_CLOCK, u8g2_font_helvB08_tf, width, u8g2.getMaxCharHeight(), WIDGET_ALIGN_RIGHT);
+
+  // Bottom row, sunrise and sunset to the left.
+  int16_t xoffset = 0;
+  place_widget(u8g2, WIDGET_SUNRISE_ICON, u8g2_font_open_iconic_weather_1x_t, xoffset, height - 1,
+               WIDGET_ALIGN_LEFT, 0x45);
+  xoffset += u8g2.getMaxCharWidth();
+  place_widget(u8g2, WIDGET_SUNRISE, u8g2_font_helvR08_tf, xoffset, height - 1);
+  xoffset += u8g2.getStrWidth("00:00 ");
+  place_widget(u8g2, WIDGET_SUNSET_ICON, u8g2_font_open_iconic_weather_1x_t, xoffset, height - 1,
+               WIDGET_ALIGN_LEFT, 0x42);
+  xoffset += u8g2.getMaxCharWidth();
+  place_widget(u8g2, WIDGET_SUNSET, u8g2_font_helvR08_tf, xoffset, height - 1);
+
+  // Climate rows, indoor above outdoor.
+  u8g2.setFont(u8g2_font_helvR08_tf);
+  int16_t yoffset = 1 + u8g2.getMaxCharHeight();
+  for (uint8_t i = 0; i < 2; i++) {
+    uint8_t row = WIDGET_INDOOR_ICON + i * WIDGET_CLIMATE_ROW_SIZE;
+    u8g2.setFont(font_segments_12x17);
+    yoffset += u8g2.getMaxCharHeight() + 2;
+    place_widget(u8g2, row, (i == 0 ? u8g2_font_open_iconic_embedded_2x_t : u8g2_font_open_iconic_thing_2x_t), 0,
+                 yoffset, WIDGET_ALIGN_LEFT, (i == 0 ? 68 : 76));
+    place_widget(u8g2, row + 1, font_segments_12x17, _widgets[row].width + 2, yoffset);
+    place_widget(u8g2, row + 2, font_segments_12x17, width - 1, yoffset, WIDGET_ALIGN_RIGHT);
+  }
+
+  // Status icons in the bottom right corner.
+  u8g2.setFont(u8g2_font_siji_t_6x10);
+  int16_t icon_width = u8g2.getMaxCharWidth();
+  place_widget(u8g2, WIDGET_WIFI, u8g2_font_siji_t_6x10, width - icon_width - 1, height - 1);
+  place_widget(u8g2, WIDGET_BLUETOOTH, u8g2_font_siji_t_6x10, width - icon_width - 1, height - 1,
+               WIDGET_ALIGN_LEFT, 57355);
+  u8g2.setFont(u8g2_font_open_iconic_www_1x_t);
+  place_widget(u8g2, WIDGET_NETWORK_SETUP, u8g2_font_open_iconic_www_1x_t,
+               width - u8g2.getMaxCharWidth() - icon_width - 1, height - 1, WIDGET_ALIGN_LEFT, 72);
+  u8g2.setFont(u8g2_font_waffle_t_all);
+  place_widget(u8g2, WIDGET_FORECAST, u8g2_font_waffle_t_all, width - (2 * u8g2.getMaxCharWidth()) - 1, height - 1);
+
+  // Zone table, a line per zone between the top and bottom rows. Used in
+  // place of the climate rows when there is more than one indoor or outdoor
+  // zone.
+  u8g2.setFont(u8g2_font_helvR08_tf);
+  int16_t line              = u8g2.getMaxCharHeight();
+  int16_t temperature_right = width - 1 - u8g2.getStrWidth(" 100%");
+  for (uint8_t i = 0; i < WIDGET_ZONE_ROWS; i++) {
+    uint8_t row = WIDGET_ZONE_1_NAME + i * WIDGET_CLIMATE_ROW_SIZE;
+    yoffset     = 1 + (i + 2) * line;
+    place_widget(u8g2, row, u8g2_font_helvR08_tf, 0, yoffset);
+    place_widget(u8g2, row + 1, u8g2_font_helvR08_tf, temperature_right, yoffset, WIDGET_ALIGN_RIGHT);
+    place_widget(u8g2, row + 2, u8g2_font_helvR08_tf, width - 1, yoffset, WIDGET_ALIGN_RIGHT);
+  }
+
+  // Graph pages, a title under the top row and the graph filling the space
+  // down to the bottom row.
+  u8g2.setFont(u8g2_font_helvR08_tf);
+  place_widget(u8g2, WIDGET_GRAPH_TITLE, u8g2_font_helvR08_tf, 0, 1 + 2 * u8g2.getMaxCharHeight());
+  int16_t graph_bottom = height - 1;
+  for (uint8_t i = WIDGET_SUNRISE_ICON; i <= WIDGET_FORECAST; i++) {
+    if (i < WIDGET_INDOOR_ICON || i > WIDGET_OUTDOOR_HUMIDITY) {
+      graph_bottom = min(graph_bottom, (int16_t)(_widgets[i].y - _widgets[i].ascent - 2));
+    }
+  }
+  _graph_top    = _widgets[WIDGET_GRAPH_TITLE].y - _widgets[WIDGET_GRAPH_TITLE].descent + 2;
+  _graph_height = max(graph_bottom - _graph_top + 1, 0);
+
+  invalidate_widgets();
+}
+
+/**
+ * Clear the frame buffer and redraw every visible widget on the next render.
+ */
+void invalidate_widgets() {
+  U8G2 u8g2 = get_display();
+  u8g2.clearBuffer();
+  for (uint8_t i = 0; i < WIDGET_COUNT; i++) {
+    _widgets[i].drawn = false;
+    _widgets[i].dirty = _widgets[i].visible;
+  }
+}
+
+/**
+ * Bind a value to a widget.
+ *
+ * \param id the widget
+ * \param value the value the widget shows, in any representation that changes
+ *              whenever the displayed text would
+ * \return true if the value changed and the widget needs new text
+ */
+bool widget_bind(uint8_t id, int32_t value) {
+  widget_t& w = _widgets[id];
+  if (w.bound && w.value == value) {
+    return false;
+  }
+  w.bound = true;
+  w.value = value;
+  return true;
+}
+
+/**
+ * Set the text shown by a widget and make it visible. The text is only
+ * measured when it differs from what the widget already has.
+ */
+void widget_set_text(uint8_t id, const char* text) {
+  widget_t& w = _widgets[id];
+  if (w.visible && !strncmp(w.text, text, sizeof(w.text))) {
+    return;
+  }
+  strncpy(w.text, text, sizeof(w.text) - 1);
+  w.text[sizeof(w.text) - 1] = '\0';
+
+  if (w.font != font_segments_12x17 || !segments_width(w.text, &w.width)) {
+    U8G2 u8g2 = get_display();
+    u8g2.setFont(w.font);
+    w.width = u8g2.getUTF8Width(w.text);
+  }
+  w.visible = true;
+  w.dirty   = true;
+}
+
+/**
+ * Set the glyph shown by a widget and make it visible.
+ */
+void widget_set_glyph(uint8_t id, uint16_t glyph) {
+  widget_t& w = _widgets[id];
+  if (w.visible && w.glyph == glyph) {
+    return;
+  }
+  w.glyph   = glyph;
+  w.visible = true;
+  w.dirty   = true;
+}
+
+/**
+ * Show or hide a widget.
+ */
+void widget_set_visible(uint8_t id, bool visible) {
+  widget_t& w = _widgets[id];
+  if (w.visible != visible) {
+    w.visible = visible;
+    w.dirty   = true;
+  }
+}
+
+/**
+ * Get the part of the display left to the graph pages, the full width between
+ * their title and the bottom row.
+ */
+void widget_graph_area(int16_t* top, uint8_t* height) {
+  *top    = _graph_top;
+  *height = _graph_height;
+}
+
+bool widgets_overlap(const widget_t& a, const widget_t& b) {
+  return (a.drawn_x < b.drawn_x + b.drawn_width) && (b.drawn_x < a.drawn_x + a.drawn_width) &&
+         (a.drawn_y < b.drawn_y + b.drawn_height) && (b.drawn_y < a.drawn_y + a.drawn_height);
+}
+
+/**
+ * Redraw the widgets that changed since the last render. What a dirty widget
+ * left on screen is cleared first, and widgets sharing any of that area are
+ * redrawn as well.
+ *
+ * \return true if the frame buffer changed
+ */
+bool render_widgets() {
+  PROFILE_STAGE(PROFILE_RENDER_WIDGETS);
+  U8G2 u8g2    = get_display();
+  bool changed = false;
+  bool again   = true;
+
+  while (again) {
+    again = false;
+    for (uint8_t i = 0; i < WIDGET_COUNT; i++) {
+      widget_t& w = _widgets[i];
+      if (!w.dirty || !w.drawn) {
+        continue;
+      }
+      u8g2.setDrawColor(0);
+      u8g2.drawBox(w.drawn_x, w.drawn_y, w.drawn_width, w.drawn_height);
+      u8g2.setDrawColor(1);
+      w.drawn = false;
+      changed = true;
+      for (uint8_t j = 0; j < WIDGET_COUNT; j++) {
+        if (j != i && _widgets[j].drawn && !_widgets[j].dirty && widgets_overlap(w, _widgets[j])) {
+          _widgets[j].dirty = true;
+          again             = true;
+        }
+      }
+    }
+  }
+
+  u8g2.setFontMode(1);
+  for (uint8_t i = 0; i < WIDGET_COUNT; i++) {
+    widget_t& w = _widgets[i];
+    if (!w.dirty) {
+      continue;
+    }
+    w.dirty = false;
+    if (!w.visible) {
+      continue;
+    }
+    int16_t x = (w.align == WIDGET_ALIGN_RIGHT ? w.x - w.width : w.x);
+    if (w.glyph) {
+      u8g2.setFont(w.font);
+      u8g2.drawGlyph(x, w.y, w.glyph);
+    } else if (w.font != font_segments_12x17 || !draw_segments(u8g2, x, w.y, w.text)) {
+      // Values in the 7-segment font are blitted from pre-rasterized glyphs
+      // when possible, everything else goes through the u8g2 font decoder.
+      u8g2.setFont(w.font);
+      u8g2.drawUTF8(x, w.y, w.text);
+    }
+    w.drawn        = true;
+    w.drawn_x      = x;
+    w.drawn_y      = w.y - w.ascent;
+    w.drawn_width  = w.width;
+    w.drawn_height = w.ascent - w.descent + 1;
+    changed        = true;
+  }
+  return changed;
+}
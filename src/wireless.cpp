@@ -19,8 +19,17 @@
 #include "common.h"
 #include "configuration.h"
 #include "forecast.h"
+#include "format.h"
+#include "history.h"
+#include "http_server.h"
+#include "logging.h"
 #include "network_time.h"
+#include "profile.h"
 #include "ruuvi.h"
+#include "tasks.h"
+#include "timekeeping.h"
+#include "uplink.h"
+#include "widgets.h"
 
 const uint16_t signal_strength[5] PROGMEM = {57890, 57889, 57888, 57888, 57887};
 
@@ -35,70 +44,247 @@ bool _bluetooth_configuring = false;
 
 uint32_t comms_timer = 0;
 
-WiFiMulti multi;
+uint8_t  _wireless_state    = WIRELESS_IDLE;
+uint32_t _wireless_deadline = 0;
+uint32_t _wireless_backoff  = WIRELESS_BACKOFF_MIN;
+uint8_t  _wifi_attempt      = 0;
+
+bool                    _wireless_window = false;
+uint32_t                _window_started  = 0;
+uint32_t                _next_window     = 0;
+uint32_t                _window_closed   = 0;
+wireless_window_stats_t _window_stats    = {0, 0, 0, 0};
+
+/**
+ * Move on to another step of the wireless bring-up.
+ *
+ * \param state the next step
+ * \param timeout milliseconds until the step times out, 0 for no timeout
+ */
+void wireless_transition(uint8_t state, uint32_t timeout = 0) {
+  _wireless_state    = state;
+  _wireless_deadline = millis() + timeout;
+}
+
+bool wireless_timed_out() {
+  return (int32_t)(millis() - _wireless_deadline) >= 0;
+}
+
+/**
+ * Pause Bluetooth scanning and bring WiFi up for a while, to resync the clock.
+ */
+void open_window() {
+  Serial.println(F("Pausing Bluetooth scanning for a WiFi window."));
+  if (_bluetooth_scanning) {
+    ble_stop_scanning();
+  }
+  _wireless_window = true;
+  _window_started  = millis();
+  _window_stats.windows++;
+  wireless_transition(WIRELESS_IDLE);
+}
+
+/**
+ * Hand the radio back to Bluetooth and note how much scanning time the window
+ * cost.
+ *
+ * \param delay milliseconds until the next window
+ */
+void close_window(bool success, uint32_t delay) {
+  uint32_t lost = millis() - _window_started;
+  _window_stats.last_lost = lost;
+  _window_stats.total_lost += lost;
+  if (!success) {
+    _window_stats.failed++;
+  }
+  _wireless_window = false;
+  _next_window     = millis() + delay;
+  _window_closed   = millis();
+  Serial.print(F("WiFi window closed, scanning paused for "));
+  Serial.print(lost);
+  Serial.println(F(" ms."));
+  wireless_transition(WIRELESS_READY);
+}
+
+/**
+ * Give up on the current attempt, drop WiFi and wait a while before trying
+ * again. The wait doubles with every failure in a row. A failed window gives
+ * the radio back to Bluetooth until it is time to try again.
+ */
+void wireless_fail(const __FlashStringHelper* reason) {
+  Serial.print(reason);
+  Serial.print(F(" Retrying in "));
+  Serial.print(_wireless_backoff / 1000);
+  Serial.println(F(" s."));
+  cancel_network_time();
+  uplink_cancel();
+  http_server_end();
+  WiFi.disconnect(true);
+  _network_connected     = false;
+  _network_setup_running = false;
+  _wifi_attempt++;
+  if (_wireless_window) {
+    close_window(false, _wireless_backoff);
+  } else {
+    wireless_transition(WIRELESS_BACKOFF, _wireless_backoff);
+  }
+  _wireless_backoff = min(_wireless_backoff * 2, (uint32_t)WIRELESS_BACKOFF_MAX);
+  request_render();
+}
 
 /**
  * Controls the wireless hardware state according to the current state of the
- * system.
+ * system. Takes at most one step of the bring-up per call and never waits, so
+ * it can run from the scheduler every few hundred milliseconds.
  */
 void control_wireless() {
-  if (!_network_connected && !network_time_set()) {
-    Serial.println(F("No network connection, trying to connect."));
-    connect_network();
-  } else if (_network_connected && !network_time_set()) {
-    configure_network_time();
-  } else if (network_time_set() && _network_connected &&
-             !_bluetooth_configured) {
-    Serial.println(F("Disabling WiFi to configure Bluetooth..."));
-    disconnect_network();
-  } else if (!_network_connected && network_time_set() &&
-             !_bluetooth_configured) {
-    Serial.println(
-        F("Time is set and network disconnected, setting up Bluetooth..."));
-    configure_bluetooth();
+  PROFILE_STAGE(PROFILE_CONTROL_WIRELESS);
+  if (_wireless_window && (millis() - _window_started) >= WIRELESS_WINDOW_TIMEOUT &&
+      _wireless_state != WIRELESS_DISCONNECTING && _wireless_state != WIRELESS_SERVING) {
+    wireless_fail(F("WiFi window timed out."));
+    return;
   }
+
+  switch (_wireless_state) {
+    case WIRELESS_IDLE:
+      if (!configured()) {
+        break;
+      }
+      Serial.println(F("No network connection, trying to connect."));
+      connect_network();
+      wireless_transition(WIRELESS_CONNECTING, WIRELESS_CONNECT_TIMEOUT);
+      break;
+
+    case WIRELESS_CONNECTING:
+      if (WiFi.status() == WL_CONNECTED) {
+        Serial.println(F("WiFi connected."));
+        _network_connected     = true;
+        _network_setup_running = false;
+        request_render();
+        wireless_transition(WIRELESS_TIME, WIRELESS_TIME_TIMEOUT);
+      } else if (wireless_timed_out()) {
+        wireless_fail(F("Timeout connecting to WiFi."));
+      }
+      break;
+
+    case WIRELESS_TIME:
+      if (configure_network_time()) {
+        _wireless_backoff = WIRELESS_BACKOFF_MIN;
+        wireless_transition(WIRELESS_UPLINK);
+      } else if (!WiFi.connected()) {
+        wireless_fail(F("WiFi connection lost while waiting for the time."));
+      } else if (wireless_timed_out()) {
+        wireless_fail(F("Timeout waiting for network time."));
+      }
+      break;
+
+    case WIRELESS_UPLINK:
+      // A failed flush keeps the readings for the next window, the time is
+      // what the window is for.
+      if (!WiFi.connected()) {
+        uplink_cancel();
+        wireless_transition(WIRELESS_DISCONNECTING);
+      } else if (uplink_flush()) {
+        if (http_server_enabled()) {
+          http_server_begin();
+          wireless_transition(WIRELESS_SERVING, http_server_listen_time());
+        } else {
+          Serial.println(F("Disabling WiFi to hand the radio to Bluetooth..."));
+          wireless_transition(WIRELESS_DISCONNECTING);
+        }
+      }
+      break;
+
+    case WIRELESS_SERVING:
+      http_server_poll();
+      if (wireless_timed_out() || !WiFi.connected()) {
+        http_server_end();
+        Serial.println(F("Disabling WiFi to hand the radio to Bluetooth..."));
+        wireless_transition(WIRELESS_DISCONNECTING);
+      }
+      break;
+
+    case WIRELESS_DISCONNECTING:
+      disconnect_network();
+      if (_network_connected) {
+        break;
+      }
+      if (_wireless_window) {
+        close_window(true, clock_sync_interval());
+      } else {
+        Serial.println(F("Time is set and network disconnected, setting up Bluetooth..."));
+        wireless_transition(WIRELESS_BLUETOOTH);
+      }
+      break;
+
+    case WIRELESS_BLUETOOTH:
+      configure_bluetooth();
+      if (_bluetooth_configured) {
+        _next_window = millis() + clock_sync_interval();
+        wireless_transition(WIRELESS_READY);
+      }
+      break;
+
+    case WIRELESS_READY:
+      if ((int32_t)(millis() - _next_window) >= 0) {
+        open_window();
+      } else if (uplink_backlogged() && (millis() - _window_closed) >= WIRELESS_UPLINK_WINDOW_GAP) {
+        Serial.println(F("Uplink queue filling up."));
+        open_window();
+      }
+      break;
+
+    case WIRELESS_BACKOFF:
+      if (wireless_timed_out()) {
+        wireless_transition(WIRELESS_IDLE);
+      }
+      break;
+
+    default:
+      break;
+  }
+}
+
+uint8_t wireless_state() {
+  return _wireless_state;
+}
+
+bool wireless_window_open() {
+  return _wireless_window;
+}
+
+const wireless_window_stats_t* wireless_window_stats() {
+  return &_window_stats;
 }
 
 //// WiFi section
 
 /**
- * Connects to WiFi.
+ * Start connecting to WiFi without waiting for it. Tries the primary and
+ * secondary networks in turn, one per attempt. control_wireless() checks
+ * whether the connection came up.
  */
 void connect_network() {
   if (!configured() || _network_setup_running || WiFi.connected()) {
     return;
   }
 
-  _network_setup_running = true;
-  Config configuration   = get_config();
-
-  WiFi.setHostname("envmon");
-
+  Config                   configuration = get_config();
+  network_section_entry_t* networks[2]   = {&configuration.networks.primary, &configuration.networks.secondary};
+  network_section_entry_t* network       = networks[_wifi_attempt % 2];
+  if (network->ssid.length() == 0) {
+    network = networks[(_wifi_attempt + 1) % 2];
+  }
+  _wifi_ap_configured = (network->ssid.length() > 0);
   if (!_wifi_ap_configured) {
-    if (configuration.networks.secondary.ssid.length() > 0) {
-      Serial.print("Adding network: ");
-      Serial.println(configuration.networks.secondary.ssid.c_str());
-      if (multi.addAP(configuration.networks.secondary.ssid.c_str(),
-                      configuration.networks.secondary.password.c_str())) {
-        _wifi_ap_configured = true;
-      } else {
-        _wifi_ap_configured = false;
-      }
-    }
-    if (configuration.networks.primary.ssid.length() > 0) {
-      Serial.print("Adding network: ");
-      Serial.println(configuration.networks.primary.ssid.c_str());
-      if (multi.addAP(configuration.networks.primary.ssid.c_str(),
-                      configuration.networks.primary.password.c_str())) {
-        _wifi_ap_configured = true;
-      } else {
-        _wifi_ap_configured = false;
-      }
-    }
+    return;
   }
 
-  _network_connected     = (multi.run() == WL_CONNECTED);
-  _network_setup_running = false;
+  _network_setup_running = true;
+  Serial.print(F("Connecting to network: "));
+  Serial.println(network->ssid.c_str());
+  WiFi.setHostname("envmon");
+  WiFi.beginNoBlock(network->ssid.c_str(), network->password.c_str());
 }
 
 /**
@@ -108,6 +294,7 @@ void disconnect_network() {
   if (!_network_setup_running && _network_connected) {
     if (WiFi.disconnect(true) == WL_DISCONNECTED) {
       _network_connected = false;
+      request_render();
     }
   }
 }
@@ -134,21 +321,14 @@ uint8_t wifi_signal_rating(int rssi) {
  * Show the current WiFi status on the OLED.
  */
 void print_wifi_status() {
-  U8G2 u8g2 = get_display();
+  PROFILE_STAGE(PROFILE_PRINT_WIFI_STATUS);
   if (_network_connected) {
-    u8g2.setFont(u8g2_font_siji_t_6x10);
-    uint16_t signal_icon = signal_strength[wifi_signal_rating(WiFi.RSSI())];
-    u8g2.drawGlyph(u8g2.getDisplayWidth() - u8g2.getMaxCharWidth() - 1,
-                   u8g2.getDisplayHeight() - 1, signal_icon);
-  }
-  uint8_t icon_width = u8g2.getMaxCharWidth();
-  if (!_bluetooth_configured && !_bluetooth_scanning &&
-      !_bluetooth_configuring) {
-    u8g2.setFont(u8g2_font_open_iconic_www_1x_t);
-    u8g2.drawGlyph(
-        u8g2.getDisplayWidth() - u8g2.getMaxCharWidth() - icon_width - 1,
-        u8g2.getDisplayHeight() - 1, 72);
+    widget_set_glyph(WIDGET_WIFI, signal_strength[wifi_signal_rating(WiFi.RSSI())]);
+  } else {
+    widget_set_visible(WIDGET_WIFI, false);
   }
+  widget_set_visible(WIDGET_NETWORK_SETUP,
+                     !_bluetooth_configured && !_bluetooth_scanning && !_bluetooth_configuring);
 }
 
 bool wifi_ap_configured() {
@@ -184,25 +364,23 @@ void configure_bluetooth() {
   _bluetooth_configured  = true;
   _bluetooth_configuring = false;
   Serial.println(F("Bluetooth configured."));
+  request_render();
 }
 
 /**
  * Show Bluetooth status on the OLED.
  */
 void print_bluetooth_status() {
-  if (_bluetooth_scanning && !_network_connected) {
-    U8G2 u8g2 = get_display();
-    u8g2.setFont(u8g2_font_siji_t_6x10);
-    u8g2.drawGlyph(u8g2.getDisplayWidth() - u8g2.getMaxCharWidth() - 1,
-                   u8g2.getDisplayHeight() - 1, 57355);
-  }
+  PROFILE_STAGE(PROFILE_PRINT_BLUETOOTH_STATUS);
+  widget_set_visible(WIDGET_BLUETOOTH, _bluetooth_scanning && !_network_connected);
 }
 
 /**
  * Control the Bluetooth scanning state.
  */
 void control_bluetooth_scanning() {
-  if (!_network_connected && _bluetooth_configured) {
+  PROFILE_STAGE(PROFILE_BLUETOOTH_SCANNING);
+  if (!_network_connected && _bluetooth_configured && !_wireless_window) {
     // Scan for 10 seconds then sleep for 10 seconds
     if ((millis() - comms_timer) >= 10000) {
       if (_bluetooth_scanning) {
@@ -221,6 +399,7 @@ void ble_start_scanning() {
   comms_timer         = millis();
   _bluetooth_scanning = true;
   BTstack.bleStartScanning();
+  request_render();
 }
 
 /**
@@ -230,6 +409,7 @@ void ble_stop_scanning() {
   comms_timer = millis();
   BTstack.bleStopScanning();
   _bluetooth_scanning = false;
+  request_render();
 }
 
 /**
@@ -237,55 +417,39 @@ void ble_stop_scanning() {
  * discovered during BLE device scan.
  */
 void advertisementCallback(BLEAdvertisement* adv) {
-  char adv_addr[strlen(adv->getBdAddr()->getAddressString())];
+  PROFILE_STAGE(PROFILE_ADVERTISEMENT_CALLBACK);
+  char adv_addr[strlen(adv->getBdAddr()->getAddressString()) + 1];
   strcpy(adv_addr, adv->getBdAddr()->getAddressString());
   if (adv->isIBeacon()) {
-    Serial.print("iBeacon found ");
-    Serial.print(adv->getBdAddr()->getAddressString());
-    Serial.print(", RSSI ");
-    Serial.print(adv->getRssi());
-    Serial.print(", UUID ");
-    Serial.print(adv->getIBeaconUUID()->getUuidString());
-    Serial.print(", MajorID ");
-    Serial.print(adv->getIBeaconMajorID());
-    Serial.print(", MinorID ");
-    Serial.print(adv->getIBecaonMinorID());
-    Serial.print(", Measured Power ");
-    Serial.println(adv->getiBeaconMeasuredPower());
+    LOG(LOG_IBEACON, adv->getRssi(), adv->getIBeaconMajorID(), adv->getIBecaonMinorID(),
+        adv->getiBeaconMeasuredPower());
   } else {
     if (!configured() || !ruuvi_devices_configured()) {
       return;
     }
 
     for (size_t i = 0; i < get_config().ruuvi.devices.size(); i++) {
-      if (!strcmp(adv_addr,
-                  get_config().ruuvi.devices[i].addr.getAddressString())) {
+      // getAddressString() is not const, so it needs a copy of the address.
+      BD_ADDR device_addr = get_config().ruuvi.devices[i].addr;
+      if (!strcmp(adv_addr, device_addr.getAddressString())) {
         uint8_t data[LE_ADVERTISING_DATA_SIZE];
         memcpy(data, adv->getAdvData(), LE_ADVERTISING_DATA_SIZE);
         if ((data[0] != 0x11) && ((data[3] == 0x1B) && (data[4] == 0xFF) &&
                                   (data[5] == 0x99) && (data[6] == 0x04))) {
-          time_t       now   = time(nullptr);
-          ruuvi_data_t rdata = make_ruuvi_data(data);
+          const time_context_t& now   = time_context();
+          ruuvi_data_t          rdata = make_ruuvi_data(data);
           store_ruuvi_reading(i, rdata);
           if ((ruuvi_reading_times()[i] == 0) ||
-              difftime(now, ruuvi_reading_times()[i]) >= 360.0f) {
-            Serial.println(
-                F("Six minutes since last logged reading, saving..."));
-            store_ruuvi_reading_time(i, now);
-            Serial.print(F("Logging Ruuvi device: "));
-            Serial.println(get_config().ruuvi.devices[i].name.c_str());
-            Serial.print(F("Current pressure trend: "));
-            Serial.println(pressure_trend());
-            Serial.print(F("Zambretti trend: "));
-            Serial.println(current_trend(pressure_trend()).baro_trend);
-            Serial.print(F("Zambretti indication: "));
-            Serial.println(current_trend(pressure_trend()).indication);
+              difftime(now.utc, ruuvi_reading_times()[i]) >= 360.0f) {
+            // Six minutes since the last logged reading.
+            store_ruuvi_reading_time(i, now.utc);
+            uplink_queue_reading(i, rdata, now.utc);
+            history_log_reading(i, rdata, now.utc);
+            LOG(LOG_READING_LOGGED, i, rdata.temperature, rdata.humidity, rdata.pressure);
+            float trend = pressure_trend();
+            LOG(LOG_PRESSURE_TREND, trend, current_trend(trend).baro_trend);
             if (average_pressure() > 0) {
-              zambretti_forecast f = get_forecast();
-              Serial.print(F("Forecast: "));
-              Serial.print(f.forecast);
-              Serial.print(F(": "));
-              Serial.println(f.description);
+              LOG(LOG_FORECAST, get_forecast(now).forecast);
             }
           }
         }
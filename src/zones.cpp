@@ -0,0 +1,61 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "zones.h"
+
+#include <Arduino.h>
+#include <string.h>
+#include <strings.h>
+
+#include "zone_types.h"
+
+zone_t  _zones[ZONE_MAX];
+uint8_t _zone_count = 0;
+
+void zones_clear() {
+  _zone_count = 0;
+}
+
+/**
+ * Look up a zone by name, adding it if it is new, so each placement string is
+ * compared once at config load and sensors only carry a small id. Names are
+ * compared whole and without case, so placements that only differ after the
+ * characters shown are still zones of their own. A sensor without a placement is indoor, as before
+ * zones had names.
+ *
+ * \param name placement from the configuration
+ * \return the id of the zone, ZONE_NONE if ZONE_MAX zones are already known
+ */
+uint8_t zone_intern(const char* name) {
+  if (name == nullptr || *name == '\0') {
+    name = "indoor";
+  }
+  for (uint8_t i = 0; i < _zone_count; i++) {
+    if (!strcasecmp(_zones[i].placement.c_str(), name)) {
+      return i;
+    }
+  }
+  if (_zone_count >= ZONE_MAX) {
+    return ZONE_NONE;
+  }
+  zone_t& zone   = _zones[_zone_count];
+  zone.placement = name;
+  strncpy(zone.name, name, sizeof(zone.name) - 1);
+  zone.name[sizeof(zone.name) - 1] = '\0';
+  zone.outdoor                     = !strcasecmp(name, "outdoor") || !strcasecmp(name, "outside");
+  return _zone_count++;
+}
+
+uint8_t zone_count() {
+  return _zone_count;
+}
+
+const char* zone_name(uint8_t zone) {
+  return zone < _zone_count ? _zones[zone].name : "";
+}
+
+bool zone_is_outdoor(uint8_t zone) {
+  return zone < _zone_count && _zones[zone].outdoor;
+}
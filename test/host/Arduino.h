@@ -0,0 +1,117 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+// Just enough of the Arduino core for the parts of the firmware that are
+// tested on the host.
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+
+using std::max;
+using std::min;
+
+#define constrain(amount, low, high) ((amount) < (low) ? (low) : ((amount) > (high) ? (high) : (amount)))
+
+class __FlashStringHelper;
+#define F(string_literal) (reinterpret_cast<const __FlashStringHelper*>(string_literal))
+#define PROGMEM
+
+// Faked by the test.
+unsigned long millis();
+
+// Tests run on one thread.
+#define noInterrupts()
+#define interrupts()
+
+class String : public std::string {
+public:
+  String(const char* text = "") : std::string(text) {}
+};
+
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t byte) = 0;
+
+  virtual size_t write(const uint8_t* buffer, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+      write(buffer[i]);
+    }
+    return size;
+  }
+
+  size_t print(const char* text) {
+    return write((const uint8_t*)text, strlen(text));
+  }
+  size_t print(const __FlashStringHelper* text) {
+    return print(reinterpret_cast<const char*>(text));
+  }
+  size_t print(char c) {
+    return write((uint8_t)c);
+  }
+  size_t print(int value) {
+    return print((long long)value);
+  }
+  size_t print(unsigned int value) {
+    return print((unsigned long long)value);
+  }
+  size_t print(long value) {
+    return print((long long)value);
+  }
+  size_t print(unsigned long value) {
+    return print((unsigned long long)value);
+  }
+  size_t print(long long value) {
+    char text[24];
+    snprintf(text, sizeof(text), "%lld", value);
+    return print(text);
+  }
+  size_t print(unsigned long long value) {
+    char text[24];
+    snprintf(text, sizeof(text), "%llu", value);
+    return print(text);
+  }
+  size_t print(double value, int digits = 2) {
+    char text[32];
+    snprintf(text, sizeof(text), "%.*f", digits, value);
+    return print(text);
+  }
+
+  size_t println() {
+    return print("\r\n");
+  }
+  template <typename T> size_t println(T value) {
+    return print(value) + println();
+  }
+  size_t println(double value, int digits) {
+    return print(value, digits) + println();
+  }
+};
+
+/**
+ * USB serial, which prints nothing on the host.
+ */
+class HostSerial : public Print {
+public:
+  size_t write(uint8_t byte) {
+    return 1;
+  }
+  explicit operator bool() {
+    return false;
+  }
+  int availableForWrite() {
+    return 0;
+  }
+};
+
+static HostSerial Serial;
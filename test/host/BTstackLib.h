@@ -0,0 +1,11 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+// Only the types the firmware headers name.
+
+class BD_ADDR {};
+class BLEAdvertisement;
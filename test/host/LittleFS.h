@@ -0,0 +1,143 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+// A file system in memory with the parts of the LittleFS interface the
+// firmware uses. Files are written through at once, there is no power to cut.
+
+#include <Arduino.h>
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+typedef std::map<std::string, std::vector<uint8_t>> host_files_t;
+
+static host_files_t _host_files;
+
+class File {
+public:
+  File() : _open(false), _position(0) {}
+  File(const std::string& name) : _name(name), _open(true), _position(0) {}
+
+  explicit operator bool() const {
+    return _open && _host_files.count(_name) > 0;
+  }
+  void close() {
+    _open = false;
+  }
+  size_t size() const {
+    return (*this ? _host_files[_name].size() : 0);
+  }
+  size_t position() const {
+    return _position;
+  }
+  bool seek(uint32_t position) {
+    if (!*this || position > size()) {
+      return false;
+    }
+    _position = position;
+    return true;
+  }
+  size_t read(uint8_t* buffer, size_t length) {
+    length = (*this ? min(length, size() - _position) : 0);
+    if (length > 0) {
+      memcpy(buffer, &_host_files[_name][_position], length);
+    }
+    _position += length;
+    return length;
+  }
+  size_t write(const uint8_t* buffer, size_t length) {
+    if (!*this) {
+      return 0;
+    }
+    std::vector<uint8_t>& data = _host_files[_name];
+    if (data.size() < _position + length) {
+      data.resize(_position + length);
+    }
+    memcpy(&data[_position], buffer, length);
+    _position += length;
+    return length;
+  }
+
+private:
+  std::string _name;
+  bool        _open;
+  size_t      _position;
+};
+
+/**
+ * The files of a directory as they were when it was opened.
+ */
+class Dir {
+public:
+  Dir(const std::string& path) : _next(0) {
+    std::string prefix = path + "/";
+    for (host_files_t::iterator file = _host_files.begin(); file != _host_files.end(); ++file) {
+      if (file->first.compare(0, prefix.size(), prefix) == 0) {
+        _names.push_back(file->first.substr(prefix.size()));
+      }
+    }
+  }
+  bool next() {
+    return ++_next <= _names.size();
+  }
+  String fileName() {
+    return String(_names[_next - 1].c_str());
+  }
+
+private:
+  std::vector<std::string> _names;
+  size_t                   _next;
+};
+
+struct FSInfo {
+  size_t totalBytes;
+  size_t usedBytes;
+};
+
+class HostFS {
+public:
+  File open(const char* name, const char* mode) {
+    if (mode[0] == 'w') {
+      _host_files[name].clear();
+    } else if (_host_files.count(name) == 0) {
+      return File();
+    }
+    return File(name);
+  }
+  bool exists(const char* name) {
+    return _host_files.count(name) > 0;
+  }
+  bool remove(const char* name) {
+    return _host_files.erase(name) > 0;
+  }
+  bool rename(const char* from, const char* to) {
+    if (_host_files.count(from) == 0) {
+      return false;
+    }
+    _host_files[to] = _host_files[from];
+    _host_files.erase(from);
+    return true;
+  }
+  bool mkdir(const char* name) {
+    return true;
+  }
+  Dir openDir(const char* name) {
+    return Dir(name);
+  }
+  bool info(FSInfo& info) {
+    info.totalBytes = 256 * 1024;
+    info.usedBytes  = 0;
+    for (host_files_t::iterator file = _host_files.begin(); file != _host_files.end(); ++file) {
+      info.usedBytes += file->second.size();
+    }
+    return true;
+  }
+};
+
+static HostFS LittleFS;
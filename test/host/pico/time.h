@@ -0,0 +1,11 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <stdint.h>
+
+// The microsecond timer, faked by the test.
+uint32_t time_us_32();
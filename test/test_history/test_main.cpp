@@ -0,0 +1,150 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+// Boots the history log on a file system in memory and checks which segment
+// files survive.
+
+#include <unity.h>
+
+#include "../../src/checksum.cpp"
+#include "../../src/history.cpp"
+
+#define TEST_TIME 1700000000
+
+// Fakes of the firmware the history log uses.
+
+unsigned long _millis = 0;
+
+unsigned long millis() {
+  return _millis;
+}
+uint32_t time_us_32() {
+  return _millis * 1000;
+}
+bool is_filesystem_safe() {
+  return true;
+}
+void log_write(uint8_t id, const uint32_t* arguments, uint8_t count) {}
+
+/**
+ * Write a whole segment file with count records.
+ */
+void write_segment(uint32_t sequence, uint16_t count) {
+  history_segment_t segment;
+  memset(&segment, 0, sizeof(segment));
+  segment.header.magic    = HISTORY_MAGIC;
+  segment.header.version  = HISTORY_VERSION;
+  segment.header.sequence = sequence;
+  segment.header.count    = count;
+  for (uint16_t i = 0; i < count; i++) {
+    segment.records[i].time = TEST_TIME + (sequence * HISTORY_SEGMENT_RECORDS + i) * 60;
+  }
+  segment.header.crc = history_segment_crc(&segment);
+
+  char name[32];
+  history_segment_name(name, sizeof(name), sequence);
+  File file = LittleFS.open(name, "w");
+  file.write((const uint8_t*)&segment, sizeof(segment.header) + count * sizeof(history_record_t));
+  file.close();
+}
+
+bool segment_exists(uint32_t sequence) {
+  char name[32];
+  history_segment_name(name, sizeof(name), sequence);
+  return LittleFS.exists(name);
+}
+
+/**
+ * Forget everything in RAM, as a reboot does.
+ */
+void reboot() {
+  _history_reader.close();
+  _history_reader_sequence = 0;
+  _history_sealed          = 0;
+  _history_written         = 0;
+  _history_ready           = false;
+  _history_staged_head     = 0;
+  _history_staged_count    = 0;
+  memset(&_history_open, 0, sizeof(_history_open));
+  history_begin();
+}
+
+/**
+ * A full ring is 15 sealed segments and a partly filled newest one.
+ */
+void write_full_ring() {
+  for (uint32_t sequence = 1; sequence < HISTORY_SEGMENTS; sequence++) {
+    write_segment(sequence, HISTORY_SEGMENT_RECORDS);
+  }
+  write_segment(HISTORY_SEGMENTS, 100);
+}
+
+void setUp() {
+  _host_files.clear();
+  _millis = 0;
+}
+
+void tearDown() {}
+
+void test_reboot_keeps_full_ring() {
+  write_full_ring();
+  for (uint8_t boot = 0; boot < 3; boot++) {
+    reboot();
+    for (uint32_t sequence = 1; sequence <= HISTORY_SEGMENTS; sequence++) {
+      TEST_ASSERT_TRUE(segment_exists(sequence));
+    }
+    TEST_ASSERT_EQUAL_UINT32((HISTORY_SEGMENTS - 1) * HISTORY_SEGMENT_RECORDS + 100, history_count());
+    TEST_ASSERT_EQUAL_UINT16(100, _history_open.header.count);
+  }
+}
+
+void test_reboot_reads_oldest_record() {
+  write_full_ring();
+  reboot();
+  history_record_t record;
+  TEST_ASSERT_TRUE(history_read(0, &record));
+  TEST_ASSERT_EQUAL_UINT32(TEST_TIME + HISTORY_SEGMENT_RECORDS * 60, record.time);
+}
+
+void test_seal_removes_only_oldest() {
+  write_full_ring();
+  reboot();
+  ruuvi_data_t reading;
+  for (uint16_t i = 100; i < HISTORY_SEGMENT_RECORDS; i++) {
+    history_log_reading(0, reading, TEST_TIME);
+    history_service();
+  }
+  TEST_ASSERT_FALSE(segment_exists(1));
+  for (uint32_t sequence = 2; sequence <= HISTORY_SEGMENTS; sequence++) {
+    TEST_ASSERT_TRUE(segment_exists(sequence));
+  }
+  TEST_ASSERT_EQUAL_UINT32(HISTORY_SEGMENTS - 1, _history_sealed);
+  TEST_ASSERT_EQUAL_UINT32(HISTORY_SEGMENTS + 1, _history_open.header.sequence);
+
+  reboot();
+  TEST_ASSERT_EQUAL_UINT32((HISTORY_SEGMENTS - 1) * HISTORY_SEGMENT_RECORDS, history_count());
+  TEST_ASSERT_TRUE(segment_exists(2));
+}
+
+void test_reboot_with_every_segment_full() {
+  for (uint32_t sequence = 1; sequence <= HISTORY_SEGMENTS; sequence++) {
+    write_segment(sequence, HISTORY_SEGMENT_RECORDS);
+  }
+  reboot();
+  // The new segment needs a slot, only the oldest makes way for it.
+  TEST_ASSERT_FALSE(segment_exists(1));
+  TEST_ASSERT_TRUE(segment_exists(2));
+  TEST_ASSERT_EQUAL_UINT32((HISTORY_SEGMENTS - 1) * HISTORY_SEGMENT_RECORDS, history_count());
+  TEST_ASSERT_EQUAL_UINT32(HISTORY_SEGMENTS + 1, _history_open.header.sequence);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_reboot_keeps_full_ring);
+  RUN_TEST(test_reboot_reads_oldest_record);
+  RUN_TEST(test_seal_removes_only_oldest);
+  RUN_TEST(test_reboot_with_every_segment_full);
+  return UNITY_END();
+}
@@ -0,0 +1,265 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+// Renders the Prometheus and JSON responses of the HTTP server into a buffer,
+// with everything they read from the rest of the firmware faked here.
+
+#include <stdlib.h>
+#include <unity.h>
+
+#include <string>
+
+#include "../../src/http_metrics.cpp"
+
+#define TEST_NOW 1700000000
+
+// Fakes of the firmware the responses are printed from.
+
+Config                  _config;
+ruuvi_data_t            _readings[3];
+time_context_t          _now;
+zone_aggregate_t        _aggregates[2];
+memory_sample_t         _memory;
+wireless_window_stats_t _windows = {12, 1, 800, 9600};
+uplink_stats_t          _uplink  = {300, 290, 3, 5, 1, 4000, 400, 40, 900};
+time_t                  _query_from;
+time_t                  _query_to;
+
+const Config& get_config() {
+  return _config;
+}
+uint8_t ruuvi_device_count() {
+  return _config.ruuvi.devices.size();
+}
+ruuvi_data_t ruuvi_reading(uint8_t i) {
+  return _readings[i];
+}
+time_t ruuvi_reading_time(uint8_t i) {
+  return TEST_NOW - 60 * (i + 1);
+}
+const time_context_t& time_context() {
+  return _now;
+}
+void update_zone_aggregates() {}
+const zone_aggregate_t& zone_aggregate(uint8_t zone) {
+  return _aggregates[zone];
+}
+uint8_t zone_count() {
+  return 2;
+}
+const char* zone_name(uint8_t zone) {
+  return zone == 0 ? "living room" : "outdoor";
+}
+bool zone_is_outdoor(uint8_t zone) {
+  return zone == 1;
+}
+float pressure_trend() {
+  return -0.5f;
+}
+int32_t average_pressure() {
+  return 101300;
+}
+zambretti_forecast_t get_forecast(const time_context_t& now) {
+  zambretti_forecast_t forecast;
+  forecast.forecast    = 'B';
+  forecast.description = (char*)"Fine weather";
+  return forecast;
+}
+const memory_sample_t* memory_latest() {
+  return &_memory;
+}
+int32_t clock_drift() {
+  return 250;
+}
+const wireless_window_stats_t* wireless_window_stats() {
+  return &_windows;
+}
+const uplink_stats_t* uplink_stats() {
+  return &_uplink;
+}
+uint16_t uplink_pending() {
+  return 7;
+}
+uint32_t http_server_requests() {
+  return 3;
+}
+unsigned long millis() {
+  return 90500;
+}
+bool query_zone(uint8_t zone, time_t from, time_t to, query_result_t* result) {
+  _query_from = from;
+  _query_to   = to;
+  memset(result, 0, sizeof(query_result_t));
+  if (zone != 0) {
+    return false;
+  }
+  result->temperature_min = 18.25f;
+  result->temperature     = 21.5f;
+  result->temperature_max = 23.75f;
+  result->humidity_min    = 40.5f;
+  result->humidity        = 45.0f;
+  result->humidity_max    = 50.5f;
+  result->pressure        = 101325.0f;
+  result->minutes         = 1440;
+  return true;
+}
+
+/**
+ * Collects a response in memory.
+ */
+class test_buffer : public Print {
+public:
+  size_t write(uint8_t byte) {
+    text += (char)byte;
+    return 1;
+  }
+  std::string text;
+};
+
+void add_device(const char* name, const char* placement) {
+  ruuvi_device_t device;
+  device.name      = name;
+  device.placement = placement;
+  _config.ruuvi.devices.push_back(device);
+}
+
+bool contains(const std::string& text, const char* part) {
+  return text.find(part) != std::string::npos;
+}
+
+void setUp() {
+  _config.ruuvi.devices.clear();
+  add_device("Kitchen \"A\"", "living room");
+  add_device("Yard", "outdoor");
+  add_device("Attic", "attic");
+  _readings[0].temperature = 21.5f;
+  _readings[0].humidity    = 45.25f;
+  _readings[0].pressure    = 101325;
+  _readings[1].temperature = -3.25f;
+  _readings[1].humidity    = 80.0f;
+  _readings[1].pressure    = 101200;
+  // Not heard from yet.
+  _readings[2].pressure    = 0;
+  _now.utc                 = TEST_NOW;
+  _aggregates[0]           = {2150, 4525, 1};
+  _aggregates[1]           = {-325, 8000, 1};
+  memset(&_memory, 0, sizeof(_memory));
+  _memory.heap_free     = 12345;
+  _memory.largest_block = 8192;
+}
+
+void tearDown() {}
+
+void test_metrics_samples() {
+  test_buffer out;
+  http_write_metrics(out);
+  TEST_ASSERT_TRUE(contains(out.text, "# HELP hem_temperature_celsius Latest temperature of the sensor.\r\n"
+                                      "# TYPE hem_temperature_celsius gauge\r\n"
+                                      "hem_temperature_celsius{sensor=\"Kitchen \\\"A\\\"\",placement=\"living room\"} "
+                                      "21.50\r\n"
+                                      "hem_temperature_celsius{sensor=\"Yard\",placement=\"outdoor\"} -3.25\r\n"
+                                      "# HELP hem_humidity_percent"));
+  TEST_ASSERT_TRUE(contains(out.text, "hem_pressure_pascals{sensor=\"Yard\",placement=\"outdoor\"} 101200\r\n"));
+  TEST_ASSERT_TRUE(contains(out.text, "hem_reading_age_seconds{sensor=\"Yard\",placement=\"outdoor\"} 120\r\n"));
+  TEST_ASSERT_FALSE(contains(out.text, "Attic"));
+  TEST_ASSERT_TRUE(contains(out.text, "hem_zone_humidity_percent{zone=\"living room\"} 45.25\r\n"));
+  TEST_ASSERT_TRUE(contains(out.text, "hem_forecast_info{code=\"B\",description=\"Fine weather\"} 1\r\n"));
+  TEST_ASSERT_TRUE(contains(out.text, "# TYPE hem_uptime_seconds counter\r\nhem_uptime_seconds 90\r\n"));
+  TEST_ASSERT_TRUE(contains(out.text, "hem_heap_largest_block_bytes 8192\r\n"));
+  TEST_ASSERT_TRUE(contains(out.text, "hem_uplink_dropped_total 3\r\n"));
+  TEST_ASSERT_TRUE(contains(out.text, "hem_http_requests_total 3\r\n"));
+}
+
+/**
+ * Every line of the text format is a comment, or a metric name, optional
+ * labels and a number, and every metric has its type declared before it.
+ */
+void test_metrics_format() {
+  test_buffer out;
+  http_write_metrics(out);
+  TEST_ASSERT_TRUE(out.text.size() > 2 && out.text.compare(out.text.size() - 2, 2, "\r\n") == 0);
+
+  std::string typed = " ";
+  size_t      start = 0;
+  while (start < out.text.size()) {
+    size_t      end  = out.text.find("\r\n", start);
+    std::string line = out.text.substr(start, end - start);
+    start            = end + 2;
+    TEST_ASSERT_TRUE(end != std::string::npos && !line.empty());
+    if (line.compare(0, 7, "# TYPE ") == 0) {
+      std::string name = line.substr(7, line.find(' ', 7) - 7);
+      std::string type = line.substr(8 + name.size());
+      TEST_ASSERT_TRUE(type == "gauge" || type == "counter");
+      typed += name + " ";
+      continue;
+    }
+    if (line.compare(0, 7, "# HELP ") == 0) {
+      continue;
+    }
+    size_t name_end = line.find_first_not_of("abcdefghijklmnopqrstuvwxyz_");
+    TEST_ASSERT_TRUE(name_end != std::string::npos && name_end > 0);
+    TEST_ASSERT_TRUE(line[name_end] == ' ' || line[name_end] == '{');
+    TEST_ASSERT_TRUE(contains(typed, (" " + line.substr(0, name_end) + " ").c_str()));
+    size_t value_start = line.rfind(' ') + 1;
+    if (line[name_end] == '{') {
+      TEST_ASSERT_TRUE(line.compare(value_start - 3, 3, "\"} ") == 0);
+    }
+    char* value_end = nullptr;
+    strtod(line.c_str() + value_start, &value_end);
+    TEST_ASSERT_TRUE(*value_end == '\0' && value_end > line.c_str() + value_start);
+  }
+}
+
+void test_json() {
+  test_buffer out;
+  http_write_json(out);
+  TEST_ASSERT_EQUAL_STRING("{\"sensors\":["
+                           "{\"name\":\"Kitchen \\\"A\\\"\",\"placement\":\"living room\",\"temperature\":21.50,"
+                           "\"humidity\":45.25,\"pressure\":101325,\"age\":60},"
+                           "{\"name\":\"Yard\",\"placement\":\"outdoor\",\"temperature\":-3.25,"
+                           "\"humidity\":80.00,\"pressure\":101200,\"age\":120}],"
+                           "\"zones\":{"
+                           "\"living room\":{\"temperature\":21.50,\"humidity\":45.25,\"sensors\":1,\"outdoor\":false},"
+                           "\"outdoor\":{\"temperature\":-3.25,\"humidity\":80.00,\"sensors\":1,\"outdoor\":true}},"
+                           "\"forecast\":{\"code\":\"B\",\"description\":\"Fine weather\",\"trend\":-0.50},"
+                           "\"uptime\":90,\"heap_free\":12345,\"clock_drift\":250,\"uplink_pending\":7,\"requests\":3}"
+                           "\r\n",
+                           out.text.c_str());
+}
+
+void test_json_without_readings() {
+  _readings[0].pressure = 0;
+  _readings[1].pressure = 0;
+  _aggregates[0]        = {0, 0, 0};
+  _aggregates[1]        = {0, 0, 0};
+  test_buffer out;
+  http_write_json(out);
+  TEST_ASSERT_TRUE(contains(out.text, "{\"sensors\":[],\"zones\":{},\"forecast\":{\"code\":\"B\""));
+}
+
+void test_summary() {
+  test_buffer out;
+  http_write_summary(out, 24);
+  TEST_ASSERT_EQUAL_STRING("{\"hours\":24,\"zones\":{\"living room\":{\"minutes\":1440,"
+                           "\"temperature\":{\"min\":18.25,\"avg\":21.50,\"max\":23.75},"
+                           "\"humidity\":{\"min\":40.5,\"avg\":45.0,\"max\":50.5},\"pressure\":101325}}}\r\n",
+                           out.text.c_str());
+  TEST_ASSERT_EQUAL(24 * 3600, _query_to - _query_from);
+
+  test_buffer shortest;
+  http_write_summary(shortest, 0);
+  TEST_ASSERT_TRUE(contains(shortest.text, "{\"hours\":1,"));
+  TEST_ASSERT_EQUAL(3600, _query_to - _query_from);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_metrics_samples);
+  RUN_TEST(test_metrics_format);
+  RUN_TEST(test_json);
+  RUN_TEST(test_json_without_readings);
+  RUN_TEST(test_summary);
+  return UNITY_END();
+}
@@ -0,0 +1,192 @@
+// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+// Builds the tree of a made up year of days the way the monitor does, one
+// batch of days at a time, checks windows down the tree against a scan of the
+// leaves and prints how long both take. Run with `pio test -e native -v` to
+// see the numbers.
+
+#include <chrono>
+#include <stdio.h>
+#include <unity.h>
+
+#include "../../src/query_tree.cpp"
+
+#define TEST_TODAY 20000
+#define TEST_DAYS_PER_RUN 31
+#define TEST_WINDOWS 10000
+
+query_summary_t _tree[QUERY_TREE_NODES];
+uint32_t        _reads = 0;
+query_batch_t   _batch;
+
+bool read_node(uint16_t node, query_summary_t* summary) {
+  _reads++;
+  *summary = _tree[node];
+  return true;
+}
+
+uint32_t next_random() {
+  static uint32_t state = 12345;
+  state                 = state * 1103515245 + 12345;
+  return state >> 8;
+}
+
+uint64_t elapsed_ns(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * A day with a yearly swing of 20 degrees and a daily one of 8.
+ */
+void make_day(uint16_t day, query_summary_t& leaf) {
+  int16_t temperature  = 1000 + 1000 * sin(day * 2 * M_PI / 365);
+  leaf.temperature_sum = (int64_t)temperature * 1440;
+  leaf.pressure_sum    = (int64_t)1325 * 1440;
+  leaf.humidity_sum    = 120 * 1440;
+  leaf.minutes         = 1440;
+  leaf.temperature_min = temperature - 400;
+  leaf.temperature_max = temperature + 400;
+  leaf.humidity_min    = 80;
+  leaf.humidity_max    = 160;
+  leaf.day             = day;
+}
+
+/**
+ * Add the days from first up to, not including, last in batches, as the
+ * service does.
+ *
+ * \return the most nodes a batch changed
+ */
+uint16_t build(uint16_t first, uint16_t last) {
+  uint16_t most = 0;
+  while (first < last) {
+    uint16_t end = (last - first > TEST_DAYS_PER_RUN ? first + TEST_DAYS_PER_RUN : last);
+    query_batch_begin(_batch);
+    for (; first < end; first++) {
+      query_summary_t leaf;
+      make_day(first, leaf);
+      if (!query_batch_set_day(_batch, first, leaf)) {
+        break;
+      }
+    }
+    query_batch_finish(_batch, first - 1, &read_node);
+    for (uint16_t i = 0; i < _batch.count; i++) {
+      _tree[_batch.nodes[i]] = _batch.summaries[i];
+    }
+    most = (_batch.count > most ? _batch.count : most);
+  }
+  return most;
+}
+
+void scan(uint16_t first, uint16_t last, query_summary_t& summary) {
+  for (uint16_t day = first; day < last; day++) {
+    query_summary_t leaf;
+    read_node(QUERY_DAYS + day % QUERY_DAYS, &leaf);
+    query_combine(summary, leaf);
+  }
+}
+
+/**
+ * Like query_days() on the monitor, the days are a ring of leaves.
+ */
+void walk(uint16_t first, uint16_t last, query_summary_t& summary) {
+  uint16_t first_leaf = first % QUERY_DAYS;
+  uint16_t last_leaf  = last % QUERY_DAYS;
+  if (first_leaf < last_leaf) {
+    query_tree_leaves(first_leaf, last_leaf, &read_node, summary);
+  } else {
+    query_tree_leaves(first_leaf, QUERY_DAYS, &read_node, summary);
+    query_tree_leaves(0, last_leaf, &read_node, summary);
+  }
+}
+
+void setUp() {
+  for (uint16_t node = 0; node < QUERY_TREE_NODES; node++) {
+    query_empty(_tree[node]);
+  }
+}
+
+void tearDown() {}
+
+void test_batches_fit() {
+  for (uint16_t first = TEST_TODAY; first < TEST_TODAY + QUERY_DAYS; first++) {
+    query_batch_begin(_batch);
+    for (uint16_t day = first; day < first + TEST_DAYS_PER_RUN; day++) {
+      query_summary_t leaf;
+      make_day(day, leaf);
+      TEST_ASSERT_TRUE(query_batch_set_day(_batch, day, leaf));
+    }
+    query_batch_finish(_batch, first + TEST_DAYS_PER_RUN - 1, &read_node);
+    TEST_ASSERT_LESS_OR_EQUAL(QUERY_BATCH_NODES, _batch.count);
+  }
+}
+
+void test_root_holds_the_year() {
+  // A year and a half, so the ring of leaves wraps.
+  build(TEST_TODAY - 2 * QUERY_DAYS / 3, TEST_TODAY + QUERY_DAYS);
+  query_summary_t year;
+  query_empty(year);
+  scan(TEST_TODAY, TEST_TODAY + QUERY_DAYS, year);
+  TEST_ASSERT_EQUAL_UINT32(year.minutes, _tree[1].minutes);
+  TEST_ASSERT_EQUAL_INT64(year.temperature_sum, _tree[1].temperature_sum);
+  TEST_ASSERT_EQUAL_INT(year.temperature_min, _tree[1].temperature_min);
+  TEST_ASSERT_EQUAL_INT(year.temperature_max, _tree[1].temperature_max);
+  TEST_ASSERT_EQUAL_UINT32(QUERY_TREE_MAGIC, _tree[0].minutes);
+  TEST_ASSERT_EQUAL_INT(TEST_TODAY + QUERY_DAYS - 1, _tree[0].day);
+}
+
+void test_windows_match_a_scan() {
+  auto     start      = std::chrono::steady_clock::now();
+  uint16_t most       = build(TEST_TODAY - QUERY_DAYS + 1, TEST_TODAY);
+  uint64_t build_ns   = elapsed_ns(start);
+  uint64_t tree_ns    = 0;
+  uint64_t scan_ns    = 0;
+  uint32_t tree_reads = 0;
+  uint32_t scan_reads = 0;
+  for (uint32_t i = 0; i < TEST_WINDOWS; i++) {
+    uint16_t first = TEST_TODAY - QUERY_DAYS + 1 + next_random() % (QUERY_DAYS - 1);
+    uint16_t last  = first + 1 + next_random() % (TEST_TODAY - first);
+
+    query_summary_t tree;
+    query_empty(tree);
+    _reads = 0;
+    start  = std::chrono::steady_clock::now();
+    walk(first, last, tree);
+    tree_ns += elapsed_ns(start);
+    tree_reads += _reads;
+
+    query_summary_t leaves;
+    query_empty(leaves);
+    _reads = 0;
+    start  = std::chrono::steady_clock::now();
+    scan(first, last, leaves);
+    scan_ns += elapsed_ns(start);
+    scan_reads += _reads;
+
+    TEST_ASSERT_EQUAL_UINT32(leaves.minutes, tree.minutes);
+    TEST_ASSERT_EQUAL_INT64(leaves.temperature_sum, tree.temperature_sum);
+    TEST_ASSERT_EQUAL_INT(leaves.temperature_min, tree.temperature_min);
+    TEST_ASSERT_EQUAL_INT(leaves.temperature_max, tree.temperature_max);
+  }
+  TEST_ASSERT_LESS_OR_EQUAL(2 * QUERY_TREE_HEIGHT + 2, tree_reads / TEST_WINDOWS);
+
+  char message[160];
+  snprintf(message, sizeof(message), "Year built in %llu us, at most %u nodes per batch",
+           (unsigned long long)(build_ns / 1000), most);
+  TEST_MESSAGE(message);
+  snprintf(message, sizeof(message), "Per window, tree: %llu ns in %u node reads, scan: %llu ns in %u",
+           (unsigned long long)(tree_ns / TEST_WINDOWS), tree_reads / TEST_WINDOWS,
+           (unsigned long long)(scan_ns / TEST_WINDOWS), scan_reads / TEST_WINDOWS);
+  TEST_MESSAGE(message);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_batches_fit);
+  RUN_TEST(test_root_holds_the_year);
+  RUN_TEST(test_windows_match_a_scan);
+  return UNITY_END();
+}
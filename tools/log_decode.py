@@ -0,0 +1,105 @@
+"""Turn the binary deferred log of the monitor back into text.
+
+With -DHEM_LOG_BINARY the monitor sends each log record as a telemetry frame
+(type 0x90, see src/logging.cpp) instead of formatting it on the device. This
+reads those frames from the serial port, or from a capture of it, looks up the
+message formats in include/log_messages.h and prints the records as text.
+Anything printed as text between the frames is passed through.
+
+Needs pyserial (pip install pyserial) to read from a serial port.
+
+Usage: python tools/log_decode.py PORT_OR_FILE [--messages include/log_messages.h]
+"""
+
+import argparse
+import os
+import re
+import struct
+import sys
+import zlib
+
+from telemetry import cobs_decode
+
+LOG_FRAME = 0x90
+RECORD = struct.Struct("<BBI")
+
+
+def load_messages(path):
+    """Return the message formats from the LOG_MESSAGES table, in id order."""
+    with open(path) as header:
+        text = header.read()
+    entries = re.findall(r'X\(\s*(\w+)\s*,\s*(\w+)\s*,\s*"((?:[^"\\]|\\.)*)"\s*\)', text)
+    return [(name, level, bytes(fmt, "ascii").decode("unicode_escape")) for name, level, fmt in entries]
+
+
+def format_record(messages, frame):
+    identifier, count, time = RECORD.unpack_from(frame)
+    words = struct.unpack_from("<%dI" % count, frame, RECORD.size)
+    stamp = "[%d.%03d]" % (time // 1000, time % 1000)
+    if identifier >= len(messages):
+        return "%s unknown log message %d" % (stamp, identifier)
+
+    fmt = messages[identifier][2]
+    arguments = []
+    conversions = re.findall(r"%(?:\.\d)?([a-z%])", fmt)
+    for conversion, word in zip([c for c in conversions if c != "%"], words):
+        if conversion == "d":
+            arguments.append(struct.unpack("<i", struct.pack("<I", word))[0])
+        elif conversion == "f":
+            arguments.append(struct.unpack("<f", struct.pack("<I", word))[0])
+        elif conversion == "c":
+            arguments.append(chr(word & 0xFF))
+        else:
+            arguments.append(word)
+    try:
+        return "%s %s" % (stamp, fmt % tuple(arguments))
+    except (TypeError, ValueError):
+        return "%s %s %r" % (stamp, messages[identifier][0], words)
+
+
+def chunks(source):
+    """Yield what was sent between zero bytes."""
+    buffer = bytearray()
+    while True:
+        data = source.read(256)
+        if not data:
+            if os.path.isfile(getattr(source, "name", "")):
+                break
+            continue
+        buffer += data
+        while b"\x00" in buffer:
+            chunk, _, buffer = buffer.partition(b"\x00")
+            if chunk:
+                yield bytes(chunk)
+
+
+def main():
+    default_messages = os.path.join(os.path.dirname(__file__), "..", "include", "log_messages.h")
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("source", help="serial port like /dev/ttyACM0, or a file with a capture")
+    parser.add_argument("--messages", default=default_messages, help="the LOG_MESSAGES table")
+    args = parser.parse_args()
+    messages = load_messages(args.messages)
+
+    if os.path.isfile(args.source):
+        source = open(args.source, "rb")
+    else:
+        import serial
+
+        source = serial.Serial(args.source, 115200, timeout=0.1)
+
+    for chunk in chunks(source):
+        try:
+            frame = cobs_decode(chunk)
+            (crc,) = struct.unpack_from("<I", frame, len(frame) - 4)
+            if len(frame) < 8 or zlib.crc32(frame[:-4]) != crc:
+                raise ValueError("bad CRC")
+        except (ValueError, struct.error):
+            sys.stdout.write(chunk.decode("ascii", "replace"))
+            continue
+        if frame[0] == LOG_FRAME:
+            print(format_record(messages, frame[4:-4]))
+
+
+if __name__ == "__main__":
+    main()
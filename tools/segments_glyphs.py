@@ -0,0 +1,93 @@
+"""Generate pre-rasterized glyphs for the Segments 12x17 font.
+
+Reads the BDF source of the font and writes include/segments_glyphs.h with one
+bitmap per glyph, already rotated for the vertical byte layout of the SH1107
+frame buffer with the display turned 270 degrees (U8G2_R3). Each row of a glyph
+becomes one 16 bit word where bit 15 is the leftmost column, so a row lands on
+two adjacent tile rows of the frame buffer when blitted.
+
+Usage: python tools/segments_glyphs.py [fonts/Segments_12x17.bdf] [include/segments_glyphs.h]
+"""
+
+import re
+import sys
+
+# The glyphs used in the temperature and humidity rows: space, digits, '.',
+# '%', '+', '-', 'C' and the degree sign.
+GLYPHS = [32, 37, 43, 45, 46] + list(range(48, 58)) + [67, 176]
+ROWS = 16
+
+
+def parse_bdf(path):
+    glyphs = {}
+    with open(path, encoding="latin-1") as bdf:
+        text = bdf.read()
+    for match in re.finditer(
+        r"ENCODING (\d+).*?DWIDTH (\d+) \d+.*?BBX (-?\d+) (-?\d+) (-?\d+) (-?\d+)\nBITMAP\n(.*?)ENDCHAR",
+        text,
+        re.S,
+    ):
+        encoding = int(match.group(1))
+        width, height, xoffset, yoffset = (int(match.group(i)) for i in range(3, 7))
+        bitmap = [int(row, 16) for row in match.group(7).split()]
+        glyphs[encoding] = {
+            "advance": int(match.group(2)),
+            "width": width,
+            "height": height,
+            "xoffset": xoffset,
+            "yoffset": yoffset,
+            "bitmap": bitmap,
+        }
+    return glyphs
+
+
+def rasterize(glyph):
+    rows = [0] * ROWS
+    row_bits = ((glyph["width"] + 7) // 8) * 8
+    for j, bits in enumerate(glyph["bitmap"]):
+        row = ROWS - glyph["yoffset"] - glyph["height"] + j
+        if row < 0 or row >= ROWS:
+            raise ValueError("glyph does not fit in %d rows" % ROWS)
+        for i in range(glyph["width"]):
+            if bits & (1 << (row_bits - 1 - i)):
+                rows[row] |= 1 << (15 - (glyph["xoffset"] + i))
+    return rows
+
+
+def main():
+    source = sys.argv[1] if len(sys.argv) > 1 else "fonts/Segments_12x17.bdf"
+    target = sys.argv[2] if len(sys.argv) > 2 else "include/segments_glyphs.h"
+    glyphs = parse_bdf(source)
+
+    lines = [
+        "// Pre-rasterized glyphs for the Segments 12x17 font.",
+        "//",
+        "// Copyright (c) 2023 Jan Lindblom (janlindblom@fastmail.fm)",
+        "//",
+        "// This software is released under the MIT License.",
+        "// https://opensource.org/licenses/MIT",
+        "//",
+        "// Generated by tools/segments_glyphs.py from fonts/Segments_12x17.bdf, do",
+        "// not edit by hand.",
+        "",
+        "#pragma once",
+        "",
+        '#include "segments.h"',
+        "",
+        "// clang-format off",
+        "const segments_glyph_t segments_glyphs[%d] PROGMEM = {" % len(GLYPHS),
+    ]
+    for encoding in GLYPHS:
+        glyph = glyphs[encoding]
+        ink = glyph["xoffset"] + glyph["width"] if glyph["width"] else 0
+        rows = ", ".join("0x%04x" % row for row in rasterize(glyph))
+        lines.append("  {%d, %d, %d, {%s}}," % (encoding, glyph["advance"], ink, rows))
+    lines.append("};")
+    lines.append("// clang-format on")
+
+    with open(target, "w", newline="\n") as header:
+        header.write("\n".join(lines) + "\n")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,185 @@
+"""Pull readings, history, counters and profiler histograms from the monitor.
+
+Talks the COBS framed telemetry protocol of src/telemetry.cpp over the USB
+serial port. Each frame is a 4 byte header (type, frame number, flags), the
+items of the response and a CRC-32, COBS encoded between zero bytes. Text
+printed by the monitor between frames is skipped, or shown with --text.
+
+Needs pyserial (pip install pyserial).
+
+Usage: python tools/telemetry.py PORT {ping,readings,counters,profile,history} [--csv FILE] [--text]
+"""
+
+import argparse
+import datetime
+import struct
+import sys
+import time
+import zlib
+
+COMMANDS = {"ping": 0, "readings": 1, "counters": 2, "profile": 3, "history": 4}
+RESPONSE = 0x80
+ERROR = 0xFF
+LAST = 0x01
+
+READING = struct.Struct("<BBhHII")
+COUNTERS = struct.Struct("<12I")
+COUNTER_NAMES = [
+    "uptime_s",
+    "heap_free",
+    "largest_block",
+    "clock_drift_ppb",
+    "wifi_windows",
+    "wifi_windows_failed",
+    "wifi_window_lost_ms",
+    "uplink_queued",
+    "uplink_sent",
+    "uplink_dropped",
+    "uplink_pending",
+    "http_requests",
+]
+PROFILE_BUCKETS = 16
+PROFILE = struct.Struct("<BI%dI" % PROFILE_BUCKETS)
+PROFILE_STAGES = [
+    "wireless",
+    "scanning",
+    "wifi",
+    "time",
+    "bluetooth",
+    "climate",
+    "forecast",
+    "pressure",
+    "backlight",
+    "advert",
+    "widgets",
+    "display",
+    "watchdog",
+    "sparkline",
+]
+HISTORY = struct.Struct("<IIhHB")
+ITEMS = {1: READING, 2: COUNTERS, 3: PROFILE, 4: HISTORY}
+
+
+def cobs_encode(data):
+    out = bytearray([0])
+    block = bytearray()
+    for byte in data:
+        if byte == 0:
+            out += bytes([len(block) + 1]) + block
+            block = bytearray()
+        else:
+            block.append(byte)
+            if len(block) == 254:
+                out += b"\xff" + block
+                block = bytearray()
+    out += bytes([len(block) + 1]) + block + b"\x00"
+    return bytes(out)
+
+
+def cobs_decode(data):
+    out = bytearray()
+    index = 0
+    while index < len(data):
+        code = data[index]
+        if code == 0 or index + code > len(data):
+            raise ValueError("broken COBS encoding")
+        out += data[index + 1 : index + code]
+        index += code
+        if code != 0xFF and index < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+def request(port, command):
+    body = bytes([command])
+    port.write(cobs_encode(body + struct.pack("<I", zlib.crc32(body))))
+
+
+def frames(port, show_text, timeout):
+    """Yield decoded frames until timeout seconds pass without one."""
+    buffer = bytearray()
+    deadline = time.monotonic() + timeout
+    while time.monotonic() < deadline:
+        buffer += port.read(port.in_waiting or 1)
+        while b"\x00" in buffer:
+            chunk, _, buffer = buffer.partition(b"\x00")
+            if not chunk:
+                continue
+            try:
+                frame = cobs_decode(chunk)
+                (crc,) = struct.unpack_from("<I", frame, len(frame) - 4)
+                if len(frame) < 8 or zlib.crc32(frame[:-4]) != crc:
+                    raise ValueError("bad CRC")
+            except (ValueError, struct.error):
+                if show_text:
+                    sys.stderr.write(chunk.decode("ascii", "replace"))
+                continue
+            deadline = time.monotonic() + timeout
+            yield frame
+
+
+def fetch(port, name, show_text, timeout=2.0):
+    """Send a request and collect the items of the response."""
+    command = COMMANDS[name]
+    request(port, command)
+    items = []
+    expected = 0
+    for frame in frames(port, show_text, timeout):
+        kind, number, flags = struct.unpack_from("<BHB", frame)
+        if kind == ERROR:
+            raise RuntimeError("the monitor refused the request")
+        if kind != command | RESPONSE:
+            continue
+        if number != expected:
+            raise RuntimeError("frame %d missing" % expected)
+        expected += 1
+        body = frame[4:-4]
+        if command in ITEMS:
+            items += list(ITEMS[command].iter_unpack(body))
+        if flags & LAST:
+            return items
+    raise RuntimeError("no complete response")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("port", help="serial port of the monitor, like /dev/ttyACM0")
+    parser.add_argument("command", choices=sorted(COMMANDS))
+    parser.add_argument("--csv", help="write readings or history to this file")
+    parser.add_argument("--text", action="store_true", help="show text printed between frames")
+    args = parser.parse_args()
+
+    import serial
+
+    with serial.Serial(args.port, 115200, timeout=0.05) as port:
+        started = time.monotonic()
+        items = fetch(port, args.command, args.text)
+        elapsed = time.monotonic() - started
+
+    rows = []
+    if args.command == "readings":
+        for device, outdoor, temperature, humidity, pressure, age in items:
+            rows.append((device, "outdoor" if outdoor else "indoor", temperature / 100, humidity / 100, pressure, age))
+            print("device %d (%s): %.2f C, %.2f %%, %d Pa, %d s old" % rows[-1])
+    elif args.command == "counters":
+        for name, value in zip(COUNTER_NAMES, items[0]):
+            print("%s: %d" % (name, value))
+    elif args.command == "profile":
+        for stage, maximum, *buckets in items:
+            if any(buckets):
+                print("%-10s max=%d %s" % (PROFILE_STAGES[stage], maximum, ",".join(map(str, buckets))))
+    elif args.command == "history":
+        for stamp, pressure, temperature, humidity, device in items:
+            rows.append((stamp, device, temperature / 100, humidity / 100, pressure))
+            utc = datetime.datetime.fromtimestamp(stamp, datetime.timezone.utc).isoformat()
+            print("%s device %d: %.2f C, %.2f %%, %d Pa" % ((utc,) + rows[-1][1:]))
+    print("%d items in %.2f s" % (len(items), elapsed), file=sys.stderr)
+
+    if args.csv and rows:
+        with open(args.csv, "w") as csv:
+            for row in rows:
+                csv.write(",".join(str(value) for value in row) + "\n")
+
+
+if __name__ == "__main__":
+    main()
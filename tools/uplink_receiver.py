@@ -0,0 +1,126 @@
+"""Stand-in collector for the uplink frames sent by the monitor.
+
+Listens for HTTP POSTs of uplink frames (see src/uplink.cpp), checks the CRC,
+decodes the delta-encoded readings and prints them, optionally appending them
+to a CSV file. Answers 204 to acknowledge a frame and 400 to refuse it, which
+leaves the readings queued on the monitor for the next WiFi window.
+
+Usage: python tools/uplink_receiver.py [--port 8080] [--path /readings] [--csv readings.csv]
+"""
+
+import argparse
+import datetime
+import http.server
+import struct
+import zlib
+
+MAGIC = 0x4548
+VERSION = 1
+HEADER = struct.Struct("<HBBHI")
+
+
+def read_varint(data, offset):
+    value = 0
+    shift = 0
+    while True:
+        byte = data[offset]
+        offset += 1
+        value |= (byte & 0x7F) << shift
+        if byte < 0x80:
+            return value, offset
+        shift += 7
+
+
+def read_signed(data, offset):
+    value, offset = read_varint(data, offset)
+    return (value >> 1) ^ -(value & 1), offset
+
+
+def decode_frame(frame):
+    """Return the sequence number and a list of readings, or raise ValueError."""
+    if len(frame) < HEADER.size + 4:
+        raise ValueError("frame too short")
+    (crc,) = struct.unpack_from("<I", frame, len(frame) - 4)
+    if zlib.crc32(frame[:-4]) != crc:
+        raise ValueError("bad CRC")
+    magic, version, count, sequence, base = HEADER.unpack_from(frame)
+    if magic != MAGIC or version != VERSION:
+        raise ValueError("unknown frame %04x version %d" % (magic, version))
+
+    readings = []
+    previous = {}
+    offset = HEADER.size
+    time = base
+    for _ in range(count):
+        device = frame[offset]
+        offset += 1
+        last = previous.get(device, (0, 0, 0))
+        delta_time, offset = read_signed(frame, offset)
+        delta_temperature, offset = read_signed(frame, offset)
+        delta_humidity, offset = read_signed(frame, offset)
+        delta_pressure, offset = read_signed(frame, offset)
+        time = (time + delta_time) & 0xFFFFFFFF
+        values = (
+            last[0] + delta_temperature,
+            last[1] + delta_humidity,
+            (last[2] + delta_pressure) & 0xFFFFFFFF,
+        )
+        previous[device] = values
+        readings.append((device, time) + values)
+    if offset != len(frame) - 4:
+        raise ValueError("%d bytes left over" % (len(frame) - 4 - offset))
+    return sequence, readings
+
+
+class Handler(http.server.BaseHTTPRequestHandler):
+    def do_POST(self):
+        if self.path != self.server.path:
+            self.send_error(404)
+            return
+        frame = self.rfile.read(int(self.headers.get("Content-Length", 0)))
+        try:
+            sequence, readings = decode_frame(frame)
+        except (ValueError, IndexError, struct.error) as error:
+            print("Refused frame from %s: %s" % (self.client_address[0], error))
+            self.send_error(400)
+            return
+
+        print(
+            "Frame %d from %s: %d readings in %d bytes, %.1f bytes per reading"
+            % (sequence, self.client_address[0], len(readings), len(frame), len(frame) / max(len(readings), 1))
+        )
+        for device, time, temperature, humidity, pressure in readings:
+            stamp = datetime.datetime.fromtimestamp(time, datetime.timezone.utc).isoformat()
+            values = (temperature / 100, humidity / 100, pressure)
+            print("  %s device %d: %.2f C, %.2f %%, %d Pa" % ((stamp, device) + values))
+            if self.server.csv:
+                self.server.csv.write("%d,%d,%.2f,%.2f,%d\n" % ((time, device) + values))
+        if self.server.csv:
+            self.server.csv.flush()
+
+        self.send_response(204)
+        self.end_headers()
+
+    def log_message(self, format, *args):
+        pass
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--port", type=int, default=8080)
+    parser.add_argument("--path", default="/readings")
+    parser.add_argument("--csv", help="append readings to this file")
+    args = parser.parse_args()
+
+    server = http.server.HTTPServer(("", args.port), Handler)
+    server.path = args.path
+    server.csv = open(args.csv, "a") if args.csv else None
+    print("Listening on port %d for %s" % (args.port, args.path))
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()